@@ -0,0 +1,783 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+// DSP throughput benchmarks for the library's hier blocks and the whole tuner flowgraph.  Each case
+// runs a repeating synthetic signal through head into the block and null sinks, as fast as the
+// flowgraph goes, in a child process of its own so the CPU time and peak RSS are the case's alone.
+// The results are printed to stdout as JSON, the library's messages go to stderr.
+//
+//   rtl_bench [-s signal_seconds] [-r replay_base_path] [-c case] ...
+//
+// -s sets how many seconds of signal each case processes (default 10).  -r runs the full chain on a
+// recording made with rtl_tuner_options_t::record_path instead of a synthetic one.  -c runs only
+// the named cases.  Check cases add what they measured to their entry and fail if it's off.
+// The cu8_channelizer_<kernel> cases time each of that block's dot products, a kernel the build or
+// the CPU doesn't have fails its case.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gnuradio/top_block.h>
+#include <gnuradio/blocks/head.h>
+#include <gnuradio/blocks/null_sink.h>
+#include <gnuradio/blocks/vector_sink_f.h>
+#include <gnuradio/blocks/vector_source_c.h>
+#include <gnuradio/blocks/vector_source_f.h>
+#include <gnuradio/blocks/vector_source_s.h>
+
+#include "gr_cu8_channelizer.h"
+#include "gr_fm_channelizer.h"
+#include "gr_fm_deemph.h"
+#include "gr_iq_file.h"
+#include "gr_psk_demod.h"
+#include "gr_rds_callsign.h"
+#include "gr_rds_receiver.h"
+#include "gr_rtl_tuner.h"
+#include "gr_wfmrcv.h"
+#include "gr_wfmrcv_stereo.h"
+
+// The rates of the default tuner config: 1 MS/s RTL and quadrature rate, 250 kHz MPX
+const double BENCH_QUAD_RATE = 1e6;
+const unsigned int BENCH_AUDIO_DEC = 4;
+const double BENCH_MPX_RATE = BENCH_QUAD_RATE / BENCH_AUDIO_DEC;
+const double BENCH_CHANNEL_BW = 200e3;
+const double BENCH_PSK_RATE = 9500;   // rds_receiver's symbol sync input, 4 samples per RDS symbol
+const double BENCH_FM_DEVIATION = 75e3;
+const double BENCH_PERIOD_S = 0.1;    // every tone below completes whole cycles in this
+const char *BENCH_RECORDING = "/tmp/rtl_bench_chain";
+const char *BENCH_AGC_RECORDING = "/tmp/rtl_bench_agc";
+const double BENCH_AGC_REF_GAIN = 20.0;      // gain the AGC recordings are taken as made at
+const double BENCH_AGC_HIGH_DBFS = -0.9;     // the AGC's target peak window, 0.35 to 0.9 of full scale
+const double BENCH_AGC_LOW_DBFS = -9.1;
+const double BENCH_AGC_POLL_S = 0.01;
+const double BENCH_AGC_MIN_GAIN = 0.0;       // ends of the R820T range the ADC model has
+const double BENCH_AGC_MAX_GAIN = 49.6;
+const unsigned int BENCH_MAX_METRICS = 6;
+const double BENCH_EQUIV_SECONDS = 1.0;      // of signal the fused and reference wfmrcv are compared on
+const double BENCH_EQUIV_TOLERANCE = 1e-3;   // largest difference allowed, full deviation is +-1.0
+const double BENCH_RDS_GROUP_RATE = 1187.5 / 104;   // groups a second, each carries the PI
+
+// A number a check case measured, printed with its result
+struct bench_metric {
+    char name[32];
+    double value;
+};
+
+struct bench_result {
+    int ok;
+    double input_rate;
+    unsigned long long samples;
+    double wall_s;
+    double cpu_s;
+    long peak_rss_kb;
+    unsigned int num_metrics;
+    bench_metric metrics[BENCH_MAX_METRICS];
+};
+
+struct bench_case {
+    std::string name;
+    std::function<bool(bench_result &)> run;
+};
+
+static double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+static void add_metric(bench_result &result, const char *name, double value)
+{
+    if (result.num_metrics < BENCH_MAX_METRICS) {
+        bench_metric &metric = result.metrics[result.num_metrics++];
+        snprintf(metric.name, sizeof(metric.name), "%s", name);
+        metric.value = value;
+    }
+}
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Stereo MPX with a 1 kHz tone in L+R, 3 kHz in L-R, the 19 kHz pilot and a little 57 kHz carrier
+// for the RDS receiver to lock to
+static std::vector<float> make_mpx(double rate)
+{
+    std::vector<float> mpx(size_t(rate * BENCH_PERIOD_S));
+    for (size_t i = 0; i < mpx.size(); ++i) {
+        double t = i / rate;
+        mpx[i] = 0.45 * sin(2 * M_PI * 1e3 * t) +
+                 0.35 * sin(2 * M_PI * 3e3 * t) * sin(2 * M_PI * 38e3 * t) +
+                 0.1 * sin(2 * M_PI * 19e3 * t) +
+                 0.05 * sin(2 * M_PI * 57e3 * t);
+    }
+    return mpx;
+}
+
+// The MPX frequency modulated onto a complex baseband carrier
+// @param amplitude Of the carrier, 1.0 is the ADC's full scale
+static std::vector<gr_complex> make_fm_iq(double rate, double amplitude = 0.5)
+{
+    std::vector<float> mpx = make_mpx(rate);
+    std::vector<gr_complex> iq(mpx.size());
+    double phase = 0.0;
+    for (size_t i = 0; i < iq.size(); ++i) {
+        phase += 2 * M_PI * BENCH_FM_DEVIATION * mpx[i] / rate;
+        iq[i] = gr_complex(amplitude * cos(phase), amplitude * sin(phase));
+    }
+    return iq;
+}
+
+// The FM signal as the dongle delivers it, one I/Q byte pair in each short
+static std::vector<short> make_fm_cu8(double rate)
+{
+    std::vector<gr_complex> iq = make_fm_iq(rate);
+    std::vector<uint8_t> bytes(2 * iq.size());
+    for (size_t i = 0; i < iq.size(); ++i) {
+        bytes[2 * i] = uint8_t(lround(127.5 + 127.5 * iq[i].real()));
+        bytes[2 * i + 1] = uint8_t(lround(127.5 + 127.5 * iq[i].imag()));
+    }
+    std::vector<short> items(iq.size());
+    memcpy(&items[0], &bytes[0], bytes.size());
+    return items;
+}
+
+// Random BPSK symbols at 4 samples a symbol, 10 Hz off frequency for the FLL to pull in
+static std::vector<gr_complex> make_bpsk(double rate)
+{
+    std::mt19937 rng(1);
+    std::vector<gr_complex> iq(size_t(rate * BENCH_PERIOD_S));
+    float symbol = 1.0f;
+    for (size_t i = 0; i < iq.size(); ++i) {
+        if (i % 4 == 0) {
+            symbol = (rng() & 1) ? 1.0f : -1.0f;
+        }
+        double phase = 2 * M_PI * 10.0 * i / rate;
+        iq[i] = symbol * gr_complex(cos(phase), sin(phase));
+    }
+    return iq;
+}
+
+// Connects every output of block to a null sink
+static void terminate_outputs(gr::top_block_sptr tb, gr::basic_block_sptr block)
+{
+    const std::vector<int> sizes = block->output_signature()->sizeof_stream_items();
+    for (int i = 0; i < block->output_signature()->max_streams(); ++i) {
+        size_t item_size = sizes[std::min(size_t(i), sizes.size() - 1)];
+        tb->connect(block, i, gr::blocks::null_sink::make(item_size), 0);
+    }
+}
+
+// Runs a repeating signal through block
+// @param result Filled in with the timing
+// @param source Repeating vector source of the block's input
+// @param item_size Size of an input sample
+// @param rate Sample rate of the input
+// @param seconds Amount of signal to run through, in seconds at rate
+static void run_block(bench_result &result, gr::basic_block_sptr source, size_t item_size,
+                      double rate, double seconds, gr::basic_block_sptr block)
+{
+    unsigned long long samples = (unsigned long long)(rate * seconds);
+    gr::top_block_sptr tb = gr::make_top_block("bench");
+    gr::blocks::head::sptr head = gr::blocks::head::make(item_size, samples);
+    tb->connect(source, 0, head, 0);
+    tb->connect(head, 0, block, 0);
+    if (block->output_signature()->max_streams() > 0) {
+        terminate_outputs(tb, block);
+    }
+
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    tb->run();
+    result.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.cpu_s = cpu_seconds() - cpu_start;
+    result.input_rate = rate;
+    result.samples = samples;
+}
+
+static bool bench_complex(bench_result &result, const std::vector<gr_complex> &signal, double rate,
+                          double seconds, gr::basic_block_sptr block)
+{
+    run_block(result, gr::blocks::vector_source_c::make(signal, true), sizeof(gr_complex), rate, seconds, block);
+    return true;
+}
+
+static bool bench_float(bench_result &result, const std::vector<float> &signal, double rate,
+                        double seconds, gr::basic_block_sptr block)
+{
+    run_block(result, gr::blocks::vector_source_f::make(signal, true), sizeof(float), rate, seconds, block);
+    return true;
+}
+
+// Largest and RMS difference between two outputs, over the samples both have
+static void compare_outputs(const std::vector<float> &a, const std::vector<float> &b, double &max_err, double &rms_err)
+{
+    size_t n = std::min(a.size(), b.size());
+    double sum_sq = 0.0;
+    max_err = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        double err = fabs(double(a[i]) - double(b[i]));
+        max_err = std::max(max_err, err);
+        sum_sq += err * err;
+    }
+    rms_err = n > 0 ? sqrt(sum_sq / n) : 0.0;
+}
+
+// Feeds the same IQ to wfmrcv with fm_demod_fused_cf and with the quadrature_demod_cf -> fir_filter_fff
+// -> fm_deemph reference chain and compares the audio and MPX sample by sample.  Only float rounding
+// should tell them apart, both start from zeroed history and decimate at the same phase.
+static bool bench_wfmrcv_equivalence(bench_result &result, double seconds)
+{
+    double compare_s = std::min(seconds, BENCH_EQUIV_SECONDS);
+    unsigned long long samples = (unsigned long long)(BENCH_QUAD_RATE * compare_s);
+    gr::top_block_sptr tb = gr::make_top_block("bench_equivalence");
+    gr::blocks::head::sptr head = gr::blocks::head::make(sizeof(gr_complex), samples);
+    gr::analog::wfmrcv::sptr fused = gr::analog::wfmrcv::make(BENCH_QUAD_RATE, BENCH_AUDIO_DEC, true);
+    gr::analog::wfmrcv::sptr reference = gr::analog::wfmrcv::make(BENCH_QUAD_RATE, BENCH_AUDIO_DEC, false);
+    gr::blocks::vector_sink_f::sptr sinks[4];
+    for (gr::blocks::vector_sink_f::sptr &sink : sinks) {
+        sink = gr::blocks::vector_sink_f::make();
+    }
+    tb->connect(gr::blocks::vector_source_c::make(make_fm_iq(BENCH_QUAD_RATE), true), 0, head, 0);
+    tb->connect(head, 0, fused, 0);
+    tb->connect(head, 0, reference, 0);
+    for (int output = 0; output < 2; ++output) {
+        tb->connect(fused, output, sinks[output], 0);
+        tb->connect(reference, output, sinks[2 + output], 0);
+    }
+
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    tb->run();
+    result.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.cpu_s = cpu_seconds() - cpu_start;
+    result.input_rate = BENCH_QUAD_RATE;
+    result.samples = samples;
+
+    std::vector<float> audio = sinks[0]->data();
+    std::vector<float> audio_ref = sinks[2]->data();
+    std::vector<float> mpx = sinks[1]->data();
+    std::vector<float> mpx_ref = sinks[3]->data();
+    double audio_max, audio_rms, mpx_max, mpx_rms;
+    compare_outputs(audio, audio_ref, audio_max, audio_rms);
+    compare_outputs(mpx, mpx_ref, mpx_max, mpx_rms);
+    add_metric(result, "outputs_compared", double(std::min(audio.size(), audio_ref.size())));
+    add_metric(result, "audio_max_err", audio_max);
+    add_metric(result, "audio_rms_err", audio_rms);
+    add_metric(result, "mpx_max_err", mpx_max);
+    add_metric(result, "mpx_rms_err", mpx_rms);
+    return !audio.empty() && audio.size() == audio_ref.size() && mpx.size() == mpx_ref.size() &&
+           audio_max <= BENCH_EQUIV_TOLERANCE && mpx_max <= BENCH_EQUIV_TOLERANCE;
+}
+
+// Writes seconds of the synthetic FM signal to a recording the way the tuner records the dongle
+// @param amplitude Of the carrier, above 1.0 needs CF32 to keep it from clipping
+// @param rate RTL sample rate the recording is made at
+static bool make_recording(const std::string &base_path, double seconds,
+                           gr::blocks::iq_format format = gr::blocks::iq_format::CU8, double amplitude = 0.5,
+                           double rate = BENCH_QUAD_RATE)
+{
+    gr::top_block_sptr tb = gr::make_top_block("bench_record");
+    gr::blocks::head::sptr head = gr::blocks::head::make(
+        sizeof(gr_complex), (unsigned long long)(rate * seconds));
+    gr::blocks::iq_recorder_c::sptr recorder = gr::blocks::iq_recorder_c::make(
+        base_path, format, rate, 101.9e6);
+    tb->connect(gr::blocks::vector_source_c::make(make_fm_iq(rate, amplitude), true), 0, head, 0);
+    tb->connect(head, 0, recorder, 0);
+    tb->run();
+    return access(gr::blocks::iq_data_path(base_path).c_str(), R_OK) == 0;
+}
+
+// Runs a recording through create_fm_device's flowgraph, channelizer to the audio sink.  Creating
+// the tuner isn't timed, rtl_get_startup_stats covers that.
+// @param config The flowgraph's rates, the RTL rate is the recording's
+static bool bench_chain(bench_result &result, const std::string &base_path, const rtl_tuner_config_t &config)
+{
+    unsigned long long samples;
+    double rate;
+    {
+        gr::blocks::iq_replay_source_c::sptr replay = gr::blocks::iq_replay_source_c::make(base_path, false, false);
+        samples = replay->num_samples();
+        rate = replay->sample_rate();
+    }
+
+    rtl_tuner_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.replay_path = base_path.c_str();
+
+    rtl_ctx_t *tuner = rtl_create_tuner_with_config(0, &options, &config);
+    if (tuner == NULL) {
+        return false;
+    }
+    rtl_add_wav_sink(tuner, "/dev/null", 48000);
+
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    rtl_start_fm(tuner);
+    rtl_wait(tuner);
+    result.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.cpu_s = cpu_seconds() - cpu_start;
+    result.input_rate = rate;
+    result.samples = samples;
+    rtl_destroy_tuner(tuner);
+    return true;
+}
+
+// Replays a station at amplitude (at BENCH_AGC_REF_GAIN) through the ADC model, in real time, and
+// follows the software AGC from BENCH_AGC_REF_GAIN.  Passes if it settles with the peak in its
+// window, without running into either end of the gain range on the way.
+static bool bench_agc(bench_result &result, double seconds, double amplitude)
+{
+    std::string base_path = BENCH_AGC_RECORDING;
+    if (!make_recording(base_path, seconds, gr::blocks::iq_format::CF32, amplitude)) {
+        return false;
+    }
+    rtl_tuner_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.replay_path = base_path.c_str();
+    options.replay_realtime = 1;
+    options.replay_adc_model = 1;
+    rtl_tuner_config_t config;
+    rtl_get_default_tuner_config(&config);
+    config.gain_mode = RTL_GAIN_SOFTWARE_AGC;
+    config.gain = BENCH_AGC_REF_GAIN;
+
+    rtl_ctx_t *tuner = rtl_create_tuner_with_config(0, &options, &config);
+    if (tuner == NULL) {
+        return false;
+    }
+    rtl_add_wav_sink(tuner, "/dev/null", 48000);
+
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    rtl_start_fm(tuner);
+    double settled_s = -1.0;
+    double min_gain = 1e9;
+    double max_gain = -1e9;
+    unsigned int changes_at_settle = 0;
+    rtl_agc_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    double elapsed = 0.0;
+    while (elapsed < seconds) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(BENCH_AGC_POLL_S));
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rtl_get_agc_stats(tuner, &stats);
+        min_gain = std::min(min_gain, stats.gain_db);
+        max_gain = std::max(max_gain, stats.gain_db);
+        bool in_window = stats.peak_dbfs <= BENCH_AGC_HIGH_DBFS && stats.peak_dbfs >= BENCH_AGC_LOW_DBFS &&
+                         stats.clip_percent == 0.0;
+        if (settled_s < 0.0 && in_window && stats.gain_changes > 0) {
+            settled_s = elapsed;
+            changes_at_settle = stats.gain_changes;
+        }
+    }
+    rtl_stop_fm(tuner);
+    rtl_wait(tuner);
+    result.wall_s = elapsed;
+    result.cpu_s = cpu_seconds() - cpu_start;
+    result.input_rate = BENCH_QUAD_RATE;
+    result.samples = (unsigned long long)(BENCH_QUAD_RATE * elapsed);
+    rtl_destroy_tuner(tuner);
+    remove(gr::blocks::iq_data_path(base_path).c_str());
+    remove(gr::blocks::iq_meta_path(base_path).c_str());
+
+    add_metric(result, "settle_s", settled_s);
+    add_metric(result, "final_gain_db", stats.gain_db);
+    add_metric(result, "final_peak_dbfs", stats.peak_dbfs);
+    add_metric(result, "min_gain_db", min_gain);
+    add_metric(result, "max_gain_db", max_gain);
+    add_metric(result, "gain_changes_after_settle", stats.gain_changes - changes_at_settle);
+    return settled_s >= 0.0 && min_gain > BENCH_AGC_MIN_GAIN && max_gain < BENCH_AGC_MAX_GAIN;
+}
+
+// The three letter calls of NRSC-4-B annex D as (PI, call) pairs, for reference_callsign
+static const struct {
+    unsigned int pi;
+    const char *call;
+} BENCH_THREE_LETTER[] = {
+    {0x9950, "KEX"}, {0x9951, "KFH"}, {0x9952, "KFI"}, {0x9953, "KGA"}, {0x9954, "KGO"},
+    {0x9955, "KGU"}, {0x9956, "KGW"}, {0x9957, "KGY"}, {0x9958, "KID"}, {0x9959, "KIT"},
+    {0x995A, "KJR"}, {0x995B, "KLO"}, {0x995C, "KLZ"}, {0x995D, "KMA"}, {0x995E, "KMJ"},
+    {0x995F, "KNX"}, {0x9960, "KOA"}, {0x9964, "KQV"}, {0x9965, "KSL"}, {0x9966, "KUJ"},
+    {0x9967, "KVI"}, {0x9968, "KWG"}, {0x996B, "KYW"}, {0x996D, "WBZ"}, {0x996E, "WDZ"},
+    {0x996F, "WEW"}, {0x9971, "WGL"}, {0x9972, "WGN"}, {0x9973, "WGR"}, {0x9975, "WHA"},
+    {0x9976, "WHB"}, {0x9977, "WHK"}, {0x9978, "WHO"}, {0x997A, "WIP"}, {0x997B, "WJR"},
+    {0x997C, "WKY"}, {0x997D, "WLS"}, {0x997E, "WLW"}, {0x9981, "WOC"}, {0x9983, "WOL"},
+    {0x9984, "WOR"}, {0x9988, "WWJ"}, {0x9989, "WWL"}, {0x9990, "KDB"}, {0x9991, "KGB"},
+    {0x9992, "KOY"}, {0x9993, "KPQ"}, {0x9994, "KSD"}, {0x9995, "KUT"}, {0x9996, "KXL"},
+    {0x9997, "KXO"}, {0x9999, "WBT"}, {0x999A, "WGH"}, {0x999B, "WGY"}, {0x999C, "WHP"},
+    {0x999D, "WIL"}, {0x999E, "WMC"}, {0x999F, "WMT"}, {0x99A0, "WOI"}, {0x99A1, "WOW"},
+    {0x99A2, "WRR"}, {0x99A3, "WSB"}, {0x99A4, "WSM"}, {0x99A5, "KBW"}, {0x99A6, "KCY"},
+    {0x99A7, "KDF"}, {0x99AA, "KHQ"}, {0x99AB, "KOB"}, {0x99B3, "WIS"}, {0x99B4, "WJW"},
+    {0x99B5, "WJZ"}, {0x99B9, "WRC"}
+};
+
+// The call sign decoding rds_sink had before gr_rds_callsign.h, written out step by step, with its
+// range fixed to take in WZZZ and the three letter calls and compressed codes added
+static void reference_callsign(unsigned int pi, char *csign_out)
+{
+    csign_out[0] = '\0';
+    if ((pi >> 12) == 0xA) {
+        if (((pi >> 8) & 0xF) == 0xF) {
+            pi = (pi & 0xFF) << 8;
+        }
+        else {
+            pi = (((pi >> 8) & 0xF) << 12) | (pi & 0xFF);
+        }
+    }
+    if (pi > 4095 && pi <= 39247) {
+        int code;
+        if (pi > 21671) {
+            csign_out[0] = 'W';
+            code = pi - 21672;
+        }
+        else {
+            csign_out[0] = 'K';
+            code = pi - 4096;
+        }
+        int call2 = code / 676;
+        code = code - (676 * call2);
+        int call3 = code / 26;
+        int call4 = code - (26 * call3);
+        csign_out[1] = char(call2 + 65);
+        csign_out[2] = char(call3 + 65);
+        csign_out[3] = char(call4 + 65);
+        csign_out[4] = '\0';
+        return;
+    }
+    for (const auto &entry : BENCH_THREE_LETTER) {
+        if (entry.pi == pi) {
+            strcpy(csign_out, entry.call);
+            return;
+        }
+    }
+}
+
+// Checks pi_to_callsign against reference_callsign for every 16 bit PI, then times it over all of them
+static bool bench_callsign(bench_result &result, double seconds)
+{
+    unsigned int mismatches = 0;
+    for (unsigned int pi = 0; pi <= 0xFFFF; ++pi) {
+        char expected[8];
+        char decoded[8];
+        reference_callsign(pi, expected);
+        gr::rds::pi_to_callsign(pi, decoded);
+        if (strcmp(expected, decoded) != 0 && ++mismatches <= 10) {
+            fprintf(stderr, "callsign: PI 0x%04X decoded \"%s\", expected \"%s\"\n", pi, decoded, expected);
+        }
+    }
+
+    unsigned int passes = (unsigned int)std::max(1.0, seconds * 10);
+    unsigned long checksum = 0;
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int pass = 0; pass < passes; ++pass) {
+        for (unsigned int pi = 0; pi <= 0xFFFF; ++pi) {
+            char decoded[8];
+            gr::rds::pi_to_callsign(pi, decoded);
+            checksum += (unsigned char)decoded[0] + (unsigned char)decoded[3];
+        }
+    }
+    result.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.cpu_s = cpu_seconds() - cpu_start;
+    result.input_rate = BENCH_RDS_GROUP_RATE;
+    result.samples = (unsigned long long)passes * 0x10000;
+
+    add_metric(result, "pis_checked", 0x10000);
+    add_metric(result, "mismatches", mismatches);
+    // Keeps the timed loop from being optimized away
+    add_metric(result, "checksum", double(checksum));
+    return mismatches == 0;
+}
+
+// @param stereo Non-zero for the stereo flowgraph
+static rtl_tuner_config_t chain_config(int stereo)
+{
+    rtl_tuner_config_t config;
+    rtl_get_default_tuner_config(&config);
+    config.stereo = stereo;
+    return config;
+}
+
+// Rates for the fm_sweep cases, from a 250 kS/s capture for low-end hardware to 2.4 MS/s
+struct sweep_config {
+    const char *name;
+    unsigned int sample_rate;
+    unsigned int max_quadrature_rate;
+    unsigned int audio_decimation;
+};
+
+static const sweep_config BENCH_SWEEP[] = {
+    {"250k_q250k_d2", 250000, 250000, 2},
+    {"1m_q250k_d2", 1000000, 250000, 2},
+    {"1m_q500k_d4", 1000000, 500000, 4},
+    {"1m_q1m_d4", 1000000, 1000000, 4},
+    {"1m_q1m_d8", 1000000, 1000000, 8},
+    {"2m4_q1m2_d8", 2400000, 1200000, 8},
+    {"2m4_q2m4_d16", 2400000, 2400000, 16},
+};
+
+// Records the synthetic station at the sweep entry's RTL rate and times the chain on it.  The
+// rates the tuner ended up with are added to the result, so the entries can be compared.
+static bool bench_sweep(bench_result &result, double seconds, const sweep_config &sweep, int stereo)
+{
+    std::string base_path = std::string(BENCH_RECORDING) + "_" + sweep.name;
+    if (!make_recording(base_path, seconds, gr::blocks::iq_format::CU8, 0.5, sweep.sample_rate)) {
+        return false;
+    }
+    rtl_tuner_config_t config = chain_config(stereo);
+    config.max_quadrature_rate = sweep.max_quadrature_rate;
+    config.audio_decimation = sweep.audio_decimation;
+    bool ok = bench_chain(result, base_path, config);
+    remove(gr::blocks::iq_data_path(base_path).c_str());
+    remove(gr::blocks::iq_meta_path(base_path).c_str());
+
+    unsigned int dec = gr::filter::fm_channelizer::choose_decimation(
+        sweep.sample_rate, sweep.max_quadrature_rate, 1e3 * sweep.audio_decimation);
+    double quad_rate = double(sweep.sample_rate) / dec;
+    add_metric(result, "quad_rate", quad_rate);
+    add_metric(result, "mpx_rate", quad_rate / sweep.audio_decimation);
+    add_metric(result, "stereo", stereo);
+    return ok;
+}
+
+static std::vector<bench_case> make_cases(double seconds, const std::string &chain_path)
+{
+    std::vector<bench_case> cases;
+    cases.push_back({"fm_channelizer", [=](bench_result &r) {
+        unsigned int dec = gr::filter::fm_channelizer::choose_decimation(
+            BENCH_QUAD_RATE, BENCH_QUAD_RATE, 1e3 * BENCH_AUDIO_DEC);
+        return bench_complex(r, make_fm_iq(BENCH_QUAD_RATE), BENCH_QUAD_RATE, seconds,
+                             gr::filter::fm_channelizer::make(BENCH_QUAD_RATE, dec, BENCH_CHANNEL_BW));
+    }});
+    const struct {
+        const char *name;
+        gr::filter::cu8_kernel kernel;
+    } cu8_kernels[] = {
+        {"cu8_channelizer", gr::filter::cu8_kernel::AUTO},
+        {"cu8_channelizer_scalar", gr::filter::cu8_kernel::SCALAR},
+        {"cu8_channelizer_sse2", gr::filter::cu8_kernel::SSE2},
+        {"cu8_channelizer_avx2", gr::filter::cu8_kernel::AVX2},
+        {"cu8_channelizer_neon", gr::filter::cu8_kernel::NEON},
+    };
+    for (const auto &k : cu8_kernels) {
+        gr::filter::cu8_kernel kernel = k.kernel;
+        cases.push_back({k.name, [=](bench_result &r) {
+            if (!gr::filter::cu8_channelizer::kernel_available(kernel)) {
+                fprintf(stderr, "Warning: cu8_channelizer - kernel not in this build or CPU, skipped\n");
+                return false;
+            }
+            unsigned int dec = gr::filter::fm_channelizer::choose_decimation(
+                BENCH_QUAD_RATE, BENCH_QUAD_RATE, 1e3 * BENCH_AUDIO_DEC);
+            run_block(r, gr::blocks::vector_source_s::make(make_fm_cu8(BENCH_QUAD_RATE), true), sizeof(short),
+                      BENCH_QUAD_RATE, seconds,
+                      gr::filter::cu8_channelizer::make(BENCH_QUAD_RATE, dec, BENCH_CHANNEL_BW, kernel));
+            return true;
+        }});
+    }
+    cases.push_back({"wfmrcv", [=](bench_result &r) {
+        return bench_complex(r, make_fm_iq(BENCH_QUAD_RATE), BENCH_QUAD_RATE, seconds,
+                             gr::analog::wfmrcv::make(BENCH_QUAD_RATE, BENCH_AUDIO_DEC, true));
+    }});
+    cases.push_back({"wfmrcv_unfused", [=](bench_result &r) {
+        return bench_complex(r, make_fm_iq(BENCH_QUAD_RATE), BENCH_QUAD_RATE, seconds,
+                             gr::analog::wfmrcv::make(BENCH_QUAD_RATE, BENCH_AUDIO_DEC, false));
+    }});
+    cases.push_back({"wfmrcv_equivalence", [=](bench_result &r) {
+        return bench_wfmrcv_equivalence(r, seconds);
+    }});
+    cases.push_back({"wfmrcv_stereo", [=](bench_result &r) {
+        return bench_complex(r, make_fm_iq(BENCH_QUAD_RATE), BENCH_QUAD_RATE, seconds,
+                             gr::analog::wfmrcv_stereo::make(BENCH_QUAD_RATE, BENCH_AUDIO_DEC));
+    }});
+    cases.push_back({"fm_deemph", [=](bench_result &r) {
+        return bench_float(r, make_mpx(BENCH_MPX_RATE), BENCH_MPX_RATE, seconds,
+                           gr::analog::fm_deemph::make(BENCH_MPX_RATE));
+    }});
+    cases.push_back({"rds_receiver", [=](bench_result &r) {
+        return bench_float(r, make_mpx(BENCH_MPX_RATE), BENCH_MPX_RATE, seconds,
+                           gr::analog::rds_receiver::make(false, BENCH_MPX_RATE));
+    }});
+    cases.push_back({"psk_demod", [=](bench_result &r) {
+        gr::digital::psk_demod_params_t params;
+        params.constellation_points = 2;
+        params.differential = false;
+        params.samples_per_symbol = 4;
+        params.pre_diff_code = 0;
+        params.excess_bw = 0.35;
+        params.freq_bw = 6.28/100.0;
+        params.timing_bw = 6.28/100.0;
+        params.phase_bw = 6.28/100.0;
+        params.mod_code = gr::digital::mod_code::GRAY_CODE;
+        return bench_complex(r, make_bpsk(BENCH_PSK_RATE), BENCH_PSK_RATE, seconds,
+                             gr::digital::psk_demod::make(params));
+    }});
+    // PIs decoded a second against the rate the PIs arrive at
+    cases.push_back({"callsign", [=](bench_result &r) {
+        return bench_callsign(r, seconds);
+    }});
+    cases.push_back({"fm_chain_mono", [=](bench_result &r) {
+        return bench_chain(r, chain_path, chain_config(0));
+    }});
+    cases.push_back({"fm_chain_stereo", [=](bench_result &r) {
+        return bench_chain(r, chain_path, chain_config(1));
+    }});
+    // CPU per rtl_tuner_config_t: cpu_percent at realtime_factor 1 is what the config costs live
+    for (const sweep_config &sweep : BENCH_SWEEP) {
+        for (int stereo = 0; stereo <= 1; ++stereo) {
+            std::string name = std::string("fm_sweep_") + sweep.name + (stereo ? "_stereo" : "_mono");
+            cases.push_back({name, [=](bench_result &r) {
+                return bench_sweep(r, seconds, sweep, stereo);
+            }});
+        }
+    }
+    // 6 dB over full scale at the starting gain, and 19 dB under the AGC's window
+    cases.push_back({"agc_strong", [=](bench_result &r) {
+        return bench_agc(r, seconds, 2.0);
+    }});
+    cases.push_back({"agc_weak", [=](bench_result &r) {
+        return bench_agc(r, seconds, 0.04);
+    }});
+    return cases;
+}
+
+// Runs one case in a child process and passes its result back through a pipe
+static bench_result run_isolated(const bench_case &c)
+{
+    bench_result result;
+    memset(&result, 0, sizeof(result));
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return result;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        try {
+            result.ok = c.run(result);
+        }
+        catch (const std::exception &e) {
+            fprintf(stderr, "Error: %s - %s\n", c.name.c_str(), e.what());
+            result.ok = 0;
+        }
+        result.peak_rss_kb = peak_rss_kb();
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid > 0) {
+        if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+            memset(&result, 0, sizeof(result));
+        }
+        waitpid(pid, NULL, 0);
+    }
+    close(fds[0]);
+    return result;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-s signal_seconds] [-r replay_base_path] [-c case] ...\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 10.0;
+    std::string replay_path;
+    std::vector<std::string> only;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:c:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            replay_path = optarg;
+            break;
+        case 'c':
+            only.push_back(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (seconds <= 0.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // The chain cases replay the synthetic signal unless given a recording.  It's made in a child so
+    // the parent never starts any flowgraph threads before forking.
+    std::string chain_path = replay_path;
+    if (chain_path.empty()) {
+        chain_path = BENCH_RECORDING;
+        bench_case record = {"record", [=](bench_result &) { return make_recording(chain_path, seconds); }};
+        if (!run_isolated(record).ok) {
+            fprintf(stderr, "Warning: could not write %s, the chain cases will fail\n", chain_path.c_str());
+        }
+    }
+
+    struct utsname host;
+    uname(&host);
+    printf("{\n");
+    printf("  \"machine\": \"%s\",\n", host.machine);
+    printf("  \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("  \"signal_seconds\": %g,\n", seconds);
+    printf("  \"benchmarks\": [");
+
+    bool first = true;
+    for (const bench_case &c : make_cases(seconds, chain_path)) {
+        if (!only.empty() && std::find(only.begin(), only.end(), c.name) == only.end()) {
+            continue;
+        }
+        fprintf(stderr, "bench: %s\n", c.name.c_str());
+        bench_result r = run_isolated(c);
+        printf("%s\n    {\"name\": \"%s\", \"ok\": %s", first ? "" : ",", c.name.c_str(), r.ok ? "true" : "false");
+        if (r.ok && r.wall_s > 0.0 && r.samples > 0) {
+            printf(", \"input_rate\": %.0f, \"samples\": %llu, \"wall_s\": %.4f, \"samples_per_s\": %.0f, "
+                   "\"ns_per_sample\": %.3f, \"realtime_factor\": %.2f, \"cpu_percent\": %.1f, \"peak_rss_kb\": %ld",
+                   r.input_rate, r.samples, r.wall_s, r.samples / r.wall_s,
+                   r.wall_s * 1e9 / r.samples, r.samples / r.wall_s / r.input_rate,
+                   100.0 * r.cpu_s / r.wall_s, r.peak_rss_kb);
+        }
+        for (unsigned int i = 0; i < r.num_metrics && i < BENCH_MAX_METRICS; ++i) {
+            printf(", \"%s\": %g", r.metrics[i].name, r.metrics[i].value);
+        }
+        printf("}");
+        fflush(stdout);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+
+    if (replay_path.empty()) {
+        remove(gr::blocks::iq_data_path(chain_path).c_str());
+        remove(gr::blocks::iq_meta_path(chain_path).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_ADC_HEADROOM_PROBE_H
+#define INCLUDED_GR_RUNTIME_ADC_HEADROOM_PROBE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+// One window of adc_headroom_probe's histogram
+struct headroom_window {
+    uint64_t seq;          // windows completed since the probe was made, starting at 1
+    float peak;            // 99.9th percentile of max(|I|, |Q|), as a fraction of the ADC's full scale
+    float clip_fraction;   // share of the samples in the histogram's top bin, i.e. clipped
+};
+
+// Sink that watches how close the raw RTL samples come to the 8 bit ADC's limits, for the AGC.
+// Only every stride-th sample is looked at, and only to add max(|I|, |Q|) to a HIST_BINS histogram,
+// so it costs next to nothing at the full RTL rate.  Takes complex floats from gr-osmosdr (full
+// scale 1.0) or the 2 byte cu8 items of rtl_cu8_source.
+class BLOCKS_API adc_headroom_probe : public sync_block
+{
+public:
+    typedef boost::shared_ptr<adc_headroom_probe> sptr;
+
+    static const unsigned int HIST_BINS = 64;
+
+    static sptr make(bool cu8, unsigned int stride, unsigned int window_samples);
+
+    ~adc_headroom_probe();
+
+    uint64_t reset(uint64_t holdoff_samples);
+    bool wait_for_window(uint64_t after_seq, unsigned int timeout_ms, headroom_window &window_out);
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    adc_headroom_probe(void) {}
+    adc_headroom_probe(bool cu8, unsigned int stride, unsigned int window_samples);
+
+    void complete_window();
+
+    bool _cu8;
+    unsigned int _stride;
+    unsigned int _window_samples;
+    unsigned int _skip;             // samples to step over at the start of the next work call
+    unsigned int _count;
+    unsigned int _hist[HIST_BINS];
+    uint64_t _holdoff;              // samples still to drop before the next window starts
+    std::atomic<bool> _restart;
+
+    std::mutex _mtx;
+    std::condition_variable _window_cv;
+    headroom_window _last;          // guarded by _mtx
+    uint64_t _restart_holdoff;      // guarded by _mtx, taken over by the next work call
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
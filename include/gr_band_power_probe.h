@@ -0,0 +1,80 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_BAND_POWER_PROBE_H
+#define INCLUDED_GR_RUNTIME_BAND_POWER_PROBE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include <gnuradio/fft/api.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/fft/fft.h>
+
+namespace gr
+{
+namespace fft
+{
+
+// Sink that accumulates a windowed FFT power spectrum of a complex stream.
+// Used by the wideband scanner to measure every channel inside the captured span at once.
+// An "rx_freq" retune tag restarts the accumulation at the tagged sample.
+class FFT_API band_power_probe : public sync_block
+{
+public:
+    typedef boost::shared_ptr<band_power_probe> sptr;
+
+    static sptr make(unsigned int fft_size);
+
+    ~band_power_probe();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+    void set_enabled(bool enabled);
+    void reset();
+    bool wait_for_frames(unsigned int num_frames, unsigned int timeout_ms);
+    std::vector<float> get_spectrum();
+    unsigned int fft_size() const;
+
+    void arm_retune(double freq_hz);
+    bool wait_for_retune(unsigned int timeout_ms);
+
+private:
+    band_power_probe(void) {}
+    band_power_probe(unsigned int fft_size);
+
+    void init_block(unsigned int fft_size);
+    void accumulate_frame();
+    void accumulate(const gr_complex *in, int num_items);
+    void handle_retune(const tag_t &tag);
+
+    unsigned int _fft_size;
+    std::vector<float> _window;
+    std::unique_ptr<fft_complex> _fft;
+    unsigned int _fill;
+
+    std::atomic<bool> _enabled;
+    std::atomic<bool> _restart;
+    std::vector<tag_t> _tags;
+
+    std::mutex _mtx;
+    std::condition_variable _frame_cv;
+    std::vector<float> _power_sum;
+    unsigned int _num_frames;
+    double _armed_freq_hz;
+    bool _retune_seen;
+};
+
+} // namespace fft
+} // namespace gr
+
+#endif
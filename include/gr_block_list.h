@@ -0,0 +1,40 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_BLOCK_LIST_H
+#define INCLUDED_GR_RUNTIME_BLOCK_LIST_H
+
+#include <gnuradio/basic_block.h>
+
+namespace gr
+{
+
+// GNU Radio doesn't expose what a hier block is made of, so the library's hier blocks list their
+// blocks here.  rtl_get_perf_stats walks the lists down to each primitive block of a flowgraph.
+class block_list
+{
+public:
+    virtual ~block_list() {}
+
+    const basic_block_vector_t& inner_blocks() const
+    {
+        return _inner_blocks;
+    }
+
+protected:
+    void add_inner_blocks(const basic_block_vector_t &blocks)
+    {
+        _inner_blocks.insert(_inner_blocks.end(), blocks.begin(), blocks.end());
+    }
+
+private:
+    basic_block_vector_t _inner_blocks;
+};
+
+} // namespace gr
+
+#endif
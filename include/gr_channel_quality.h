@@ -0,0 +1,101 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_CHANNEL_QUALITY_H
+#define INCLUDED_GR_RUNTIME_CHANNEL_QUALITY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <gnuradio/analog/api.h>
+#include <gnuradio/block.h>
+
+namespace gr
+{
+namespace analog
+{
+
+// What channel_quality has measured since its last restart
+struct channel_metrics {
+    double rssi_dbfs;      // channel power before demodulation, dB relative to full scale
+    double snr_db;         // a full deviation tone over the noise in 15 kHz of audio before
+                           // de-emphasis.  The noise density is taken beside the pilot (17 and
+                           // 21 kHz), where no program is, and follows FM's f^2 noise down to 0 Hz.
+    double pilot_snr_db;   // 19 kHz pilot over that noise, in the tone detectors' 25 Hz bandwidth
+    double mpx_seconds;    // MPX measured, the estimates need about 50 ms to settle
+};
+
+// Sink that measures the quality of the tuned channel as the samples go by:
+//   in 0: the channel at the quadrature rate, for the RSSI
+//   in 1: wfmrcv's MPX, full deviation at +-1.0, for the SNR and the pilot
+// The two run at different rates and are consumed independently.  Each sample costs a handful of
+// multiply-adds: running means for the power, and single bin tone detectors (a rotating phasor and
+// two one pole averages in a row) at 17, 19 and 21 kHz.  The second pole keeps the program 2 kHz
+// away about 80 dB down, a single one would let it through at about -40 dB and cap the SNR there.
+// An "rx_freq" retune tag restarts the input it is on.
+class ANALOG_API channel_quality : public block
+{
+public:
+    typedef boost::shared_ptr<channel_quality> sptr;
+
+    static sptr make(double mpx_rate);
+
+    ~channel_quality();
+
+    void reset();
+    bool wait_for_mpx(double seconds, unsigned int timeout_ms);
+    void get_metrics(channel_metrics &metrics_out);
+
+    void forecast(int noutput_items, gr_vector_int &ninput_items_required);
+
+    int general_work(
+        int noutput_items,
+        gr_vector_int &ninput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    // Power of the MPX at one frequency
+    struct tone_detector {
+        gr_complex phasor;   // e^-jwn
+        gr_complex step;     // e^-jw
+        gr_complex acc1;     // one pole average of x[n] * e^-jwn
+        gr_complex acc;      // and the same again of that
+        double power;        // running mean of |acc|^2
+    };
+
+    channel_quality(void) {}
+    channel_quality(double mpx_rate);
+
+    void restart_iq();
+    void restart_mpx();
+    void measure_iq(const gr_complex *in, int num_items);
+    void measure_mpx(const float *in, int num_items);
+    void publish();
+
+    double _mpx_rate;
+    float _detector_alpha;
+    double _detector_gain;             // share of white noise's power the detectors pass
+    uint64_t _rssi_n;
+    double _rssi_sum;
+    uint64_t _mpx_n;
+    uint64_t _power_n;
+    tone_detector _tones[3];           // noise at 17 kHz, pilot, noise at 21 kHz
+    std::atomic<bool> _restart;
+    std::vector<tag_t> _tags;
+
+    std::mutex _mtx;
+    std::condition_variable _mpx_cv;
+    channel_metrics _metrics;          // guarded by _mtx
+};
+
+} // namespace analog
+} // namespace gr
+
+#endif
@@ -0,0 +1,77 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_CU8_CHANNELIZER_H
+#define INCLUDED_GR_RUNTIME_CU8_CHANNELIZER_H
+
+#include <cstdint>
+#include <vector>
+
+#include <gnuradio/filter/api.h>
+#include <gnuradio/sync_decimator.h>
+
+namespace gr
+{
+namespace filter
+{
+
+// fm_channelizer for the RTL's own samples: takes interleaved unsigned 8 bit I/Q (2 byte items)
+// and runs the channel filter and the decimation to the quadrature rate in 16 bit fixed point, so
+// the only float conversion is of the decimated output.  The taps are fm_channelizer's, quantized to
+// 16 bits.  The dot products use AVX2 or SSE2 (pmaddwd) on x86, picked when the block is made from
+// what the CPU has whatever the build targets, NEON (vmlal) when the build targets ARM with it, and
+// plain C otherwise.
+enum class cu8_kernel {
+    AUTO,       // the fastest of the others that the CPU runs
+    SCALAR,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+class FILTER_API cu8_channelizer : public sync_decimator
+{
+public:
+    typedef boost::shared_ptr<cu8_channelizer> sptr;
+    typedef int32_t (*dot_s16_fn)(const int16_t *x, const int16_t *h, unsigned int n);
+
+    static sptr make(
+        double samp_rate,
+        unsigned int decimation,
+        double channel_bw,
+        cu8_kernel kernel = cu8_kernel::AUTO);
+
+    static bool kernel_available(cu8_kernel kernel);
+    cu8_kernel kernel() const;
+
+    ~cu8_channelizer();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    cu8_channelizer(void) {}
+    cu8_channelizer(
+        double samp_rate,
+        unsigned int decimation,
+        double channel_bw,
+        cu8_kernel kernel);
+
+    cu8_kernel _kernel;
+    dot_s16_fn _dot;
+    std::vector<int16_t> _taps_rev;   // reversed, zero-padded at the front to a multiple of 16
+    float _out_scale;                 // accumulator to the +/-1.0 float range
+    std::vector<int16_t> _i;          // last ntaps - 1 samples, then the current ones
+    std::vector<int16_t> _q;
+};
+
+} // namespace filter
+} // namespace gr
+
+#endif
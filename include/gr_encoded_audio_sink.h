@@ -0,0 +1,103 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_ENCODED_AUDIO_SINK_H
+#define INCLUDED_GR_RUNTIME_ENCODED_AUDIO_SINK_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+enum class audio_codec : uint32_t {
+    FLAC = 0,   // lossless, about half the size of 16 bit WAV
+    OPUS = 1    // lossy, Ogg Opus at the given bitrate
+};
+
+class audio_encoder;
+
+// Records its inputs (one per channel) to FLAC or Ogg Opus files.  work() only copies the samples
+// into a lock-free queue; a thread of the block's own encodes them and writes the file a megabyte
+// at a time, so a slow disk never holds up the flowgraph.  If the encoder falls more than
+// QUEUE_SECONDS behind, samples are dropped rather than stalling the audio.
+//
+// The files are <base_path>.flac or <base_path>.opus, or with segment_seconds set a new
+// <base_path>-0000.flac, <base_path>-0001.flac, ... every segment_seconds.
+class BLOCKS_API encoded_audio_sink : public sync_block
+{
+public:
+    typedef boost::shared_ptr<encoded_audio_sink> sptr;
+
+    static constexpr double QUEUE_SECONDS = 4.0;
+
+    static sptr make(
+        const std::string &base_path,
+        audio_codec codec,
+        unsigned int channels,
+        unsigned int sample_rate,
+        unsigned int bitrate,
+        unsigned int segment_seconds);
+
+    ~encoded_audio_sink();
+
+    bool start();
+    bool stop();
+
+    uint64_t dropped_frames() const;
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    encoded_audio_sink(
+        std::unique_ptr<audio_encoder> encoder,
+        const std::string &base_path,
+        unsigned int channels,
+        unsigned int sample_rate,
+        unsigned int segment_seconds);
+
+    void encoder_thread();
+    void drain();
+    void encode(const float *frames, size_t num_frames);
+
+    std::unique_ptr<audio_encoder> _encoder;
+    std::string _base_path;
+    unsigned int _channels;
+    uint64_t _segment_frames;      // 0 for one file
+    uint64_t _frames_in_segment;
+    unsigned int _segment;
+
+    // Interleaved frames, the positions count frames ever written and read
+    std::vector<float> _queue;
+    size_t _queue_frames;          // a power of two
+    // Padded apart so the two threads don't share a cache line; alignas isn't honoured by new in C++11
+    std::atomic<uint64_t> _write_pos;
+    char _write_pad[64];
+    std::atomic<uint64_t> _read_pos;
+    char _read_pad[64];
+    std::atomic<uint64_t> _dropped;
+
+    std::thread _thread;
+    std::atomic<bool> _stop_thread;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
@@ -0,0 +1,66 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_FM_CHANNELIZER_H
+#define INCLUDED_GR_RUNTIME_FM_CHANNELIZER_H
+
+#include <gnuradio/filter/api.h>
+#include <gnuradio/hier_block2.h>
+
+#include "gr_block_list.h"
+
+namespace gr
+{
+namespace filter
+{
+
+// Channel selection and decimation from the RTL sample rate down to the quadrature rate in a
+// single filter pass.  Short filters run as a decimating FIR, which only evaluates the output
+// phases that are kept; long ones run as an FFT overlap-save filter.
+class FILTER_API fm_channelizer : public hier_block2, public gr::block_list
+{
+public:
+    typedef boost::shared_ptr<fm_channelizer> sptr;
+
+    static sptr make(
+        double samp_rate,
+        unsigned int decimation,
+        double channel_bw);
+
+    static unsigned int choose_decimation(
+        double samp_rate,
+        double max_quad_rate,
+        double rate_step);
+
+    static const std::vector<float>& design_taps(
+        double samp_rate,
+        unsigned int decimation,
+        double channel_bw);
+
+    ~fm_channelizer();
+
+    const std::vector<float>& taps() const;
+
+private:
+    fm_channelizer(void) {}
+    fm_channelizer(
+        double samp_rate,
+        unsigned int decimation,
+        double channel_bw);
+
+    void init_block(
+        double samp_rate,
+        unsigned int decimation,
+        double channel_bw);
+
+    std::vector<float> _taps;
+};
+
+} // namespace filter
+} // namespace gr
+
+#endif
@@ -10,24 +10,53 @@
 
 #include <gnuradio/analog/api.h>
 #include <gnuradio/hier_block2.h>
-#include <gnuradio/filter/iir_filter_ffd.h>
+#include <gnuradio/sync_block.h>
+
+#include "gr_block_list.h"
 
 namespace gr
 {
 namespace analog
 {
 
-class ANALOG_API fm_deemph : public hier_block2
+// The first order IIR of fm_deemph, the same arithmetic as iir_filter_ffd.  At an "rx_freq"
+// retune tag its state starts over, so the new station doesn't start with the old one's output.
+class ANALOG_API deemph_ff : public sync_block
+{
+    public:
+        typedef boost::shared_ptr<deemph_ff> sptr;
+        static sptr make(const std::vector<double> &btaps, const std::vector<double> &ataps);
+        ~deemph_ff();
+
+        int work(
+            int noutput_items,
+            gr_vector_const_void_star &input_items,
+            gr_vector_void_star &output_items);
+
+    private:
+        deemph_ff(void) {}
+        deemph_ff(const std::vector<double> &btaps, const std::vector<double> &ataps);
+
+        std::vector<tag_t> _tags;
+        double _b0;
+        double _b1;
+        double _a1;
+        double _prev_in;
+        double _prev_out;
+};
+
+class ANALOG_API fm_deemph : public hier_block2, public gr::block_list
 {
     public:
         typedef boost::shared_ptr<fm_deemph> sptr;
         static sptr make(float audio_rate);
+        static void design(float audio_rate, std::vector<double> &btaps, std::vector<double> &ataps);
         ~fm_deemph();
 
     private:
         fm_deemph(void) {}
         fm_deemph(float audio_rate);
-        gr::filter::iir_filter_ffd::sptr iirfilt;
+        deemph_ff::sptr iirfilt;
 };
 
 } // namespace analog
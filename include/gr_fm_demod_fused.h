@@ -0,0 +1,74 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_FM_DEMOD_FUSED_H
+#define INCLUDED_GR_RUNTIME_FM_DEMOD_FUSED_H
+
+#include <gnuradio/analog/api.h>
+#include <gnuradio/sync_decimator.h>
+
+namespace gr
+{
+namespace analog
+{
+
+// quadrature_demod_cf -> decimating fir_filter_fff -> first order IIR in one block and one pass
+// over the samples.  The discriminator is a conjugate multiply and fast_atan2f per sample, the
+// low-pass is only evaluated at the output phases that are kept, and the IIR runs on the decimated
+// output.  The vector kernels go through VOLK, which picks the AVX2/NEON versions at runtime.
+// The optional second output is the low-passed discriminator before de-emphasis (the MPX signal).
+// At an "rx_freq" retune tag the discriminator and the de-emphasis start over, so the first samples
+// of the new station don't carry the old one's filter state.
+class ANALOG_API fm_demod_fused_cf : public sync_decimator
+{
+public:
+    typedef boost::shared_ptr<fm_demod_fused_cf> sptr;
+
+    static sptr make(
+        float gain,
+        unsigned int decimation,
+        const std::vector<float> &taps,
+        const std::vector<double> &btaps,
+        const std::vector<double> &ataps);
+
+    ~fm_demod_fused_cf();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    fm_demod_fused_cf(void) {}
+    fm_demod_fused_cf(
+        float gain,
+        unsigned int decimation,
+        const std::vector<float> &taps,
+        const std::vector<double> &btaps,
+        const std::vector<double> &ataps);
+
+    void restart(const gr_complex &first);
+
+    float _gain;
+    std::vector<tag_t> _tags;
+    std::vector<float> _taps_rev;       // taps in reverse so the FIR is a plain dot product
+    std::vector<gr_complex> _prod;      // x[n] * conj(x[n - 1])
+    std::vector<float> _disc;           // last ntaps - 1 discriminator outputs, then the current ones
+    gr_complex _last;
+    bool _restart_pending;
+
+    double _b0;
+    double _b1;
+    double _a1;
+    double _prev_in;
+    double _prev_out;
+};
+
+} // namespace analog
+} // namespace gr
+
+#endif
@@ -0,0 +1,152 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_IQ_FILE_H
+#define INCLUDED_GR_RUNTIME_IQ_FILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+// Sample format of a recording.  CU8 is what the RTL delivers, half the size of CF32.
+enum class iq_format : uint32_t {
+    CU8 = 0,
+    CF32 = 1
+};
+
+// A SigMF capture segment: from sample_start on the dongle was tuned to frequency
+struct iq_capture {
+    uint64_t sample_start;
+    double frequency;   // Hz
+};
+
+// Recordings are a SigMF pair, <base>.sigmf-data with the samples and <base>.sigmf-meta with the
+// datatype, sample rate and one capture per retune
+std::string iq_data_path(const std::string &base_path);
+std::string iq_meta_path(const std::string &base_path);
+
+// Writes the IQ stream to a recording.  Placed after retune_tagger_cc, so every "rx_freq" tag starts
+// a new capture.  The metadata is written when the flowgraph stops.  SigMF has one rate per
+// recording, so a recording that spans a wideband scan (which changes the RTL rate) doesn't replay
+// correctly past it.
+class BLOCKS_API iq_recorder_c : public sync_block
+{
+public:
+    typedef boost::shared_ptr<iq_recorder_c> sptr;
+
+    static sptr make(
+        const std::string &base_path,
+        iq_format format,
+        double sample_rate,
+        double center_freq);
+
+    ~iq_recorder_c();
+
+    bool start();
+    bool stop();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    iq_recorder_c(void) {}
+    iq_recorder_c(
+        int fd,
+        const std::string &base_path,
+        iq_format format,
+        double sample_rate,
+        double center_freq);
+
+    bool write_meta();
+
+    int _fd;
+    std::string _base_path;
+    iq_format _format;
+    double _sample_rate;
+    std::vector<iq_capture> _captures;
+    std::vector<tag_t> _tags;
+    std::vector<uint8_t> _cu8_buf;
+    uint64_t _recorded;          // samples in the data file
+    uint64_t _run_start;         // of them recorded before the flowgraph was last started
+};
+
+// Plays a recording back in place of the RTL source.  The data file is mapped and the samples are
+// converted straight into the output buffer.  Each recorded capture after the first is tagged
+// "rx_freq" where it starts, as retune_tagger_cc would have.  Without realtime it runs as fast as
+// the flowgraph takes samples, for throughput benchmarks.
+class BLOCKS_API iq_replay_source_c : public sync_block
+{
+public:
+    typedef boost::shared_ptr<iq_replay_source_c> sptr;
+
+    static sptr make(const std::string &base_path, bool realtime, bool repeat);
+
+    ~iq_replay_source_c();
+
+    double sample_rate() const;
+    double center_freq() const;
+    uint64_t num_samples() const;
+    void set_adc_gain(double gain_db, uint64_t delay_samples);
+
+    bool start();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    iq_replay_source_c(void) {}
+    iq_replay_source_c(
+        const void *mapping,
+        size_t mapping_len,
+        iq_format format,
+        double sample_rate,
+        const std::vector<iq_capture> &captures,
+        bool realtime,
+        bool repeat);
+
+    const void *_mapping;
+    size_t _mapping_len;
+    iq_format _format;
+    double _sample_rate;
+    std::vector<iq_capture> _captures;
+    bool _realtime;
+    bool _repeat;
+    uint64_t _num_samples;
+    uint64_t _pos;               // next sample of the file
+    size_t _next_capture;        // first capture not tagged yet
+    std::atomic<double> _center_freq;
+    std::chrono::steady_clock::time_point _start_time;
+    uint64_t _samples_since_start;
+
+    // ADC model, off until set_adc_gain
+    std::mutex _adc_mtx;
+    bool _adc_model;              // guarded by _adc_mtx along with the rest
+    float _adc_scale;             // applied to the samples now
+    float _adc_next_scale;        // and from _adc_switch_at on
+    uint64_t _adc_switch_at;      // in nitems_written(0)
+    uint64_t _adc_written;        // nitems_written(0) after the last work call
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
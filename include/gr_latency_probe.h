@@ -0,0 +1,64 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_LATENCY_PROBE_H
+#define INCLUDED_GR_RUNTIME_LATENCY_PROBE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+// Sink that sits next to the audio sinks and measures how long the "rx_stamp" tags from
+// retune_tagger_cc took to get there.  In a stereo graph every stamp reaches the audio through
+// several paths, so only the first copy of each stamp is counted.
+class BLOCKS_API latency_probe_f : public sync_block
+{
+public:
+    typedef boost::shared_ptr<latency_probe_f> sptr;
+
+    static sptr make();
+
+    ~latency_probe_f();
+
+    bool start();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+    unsigned int get_stats(double &last_ms, double &mean_ms, double &min_ms, double &max_ms);
+    uint64_t first_sample_time() const;
+    void reset();
+
+private:
+    latency_probe_f(void);
+
+    std::vector<tag_t> _tags;
+    uint64_t _last_stamp;
+    std::atomic<uint64_t> _first_sample;
+
+    std::mutex _mtx;
+    double _last_ms;
+    double _sum_ms;
+    double _min_ms;
+    double _max_ms;
+    unsigned int _count;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
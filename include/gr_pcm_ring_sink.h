@@ -0,0 +1,109 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_PCM_RING_SINK_H
+#define INCLUDED_GR_RUNTIME_PCM_RING_SINK_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+const uint32_t PCM_RING_MAGIC = 0x52544c50;  // "RTLP"
+const uint32_t PCM_RING_VERSION = 1;
+
+enum class pcm_format : uint32_t {
+    FLOAT32 = 0,
+    S16 = 1
+};
+
+// Fixed layout at the start of the shared memory object, followed by the interleaved frames.
+// The positions count frames ever written/read; index into the data with pos & (capacity - 1).
+struct pcm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t channels;
+    uint32_t format;
+    uint32_t sample_rate;
+    uint32_t capacity;         // in frames, a power of two
+    uint32_t bytes_per_frame;
+    uint32_t data_offset;      // from the start of the header
+    alignas(64) std::atomic<uint64_t> write_pos;
+    alignas(64) std::atomic<uint64_t> read_pos;
+    alignas(64) std::atomic<uint64_t> overruns;  // frames dropped because the consumer fell behind
+};
+
+// Single producer, single consumer ring of PCM frames in POSIX shared memory.  The producer never
+// blocks: when the ring is full the newest frames are dropped and counted.  The consumer reads the
+// frames where they are with acquire()/release(), without copying them out.
+class BLOCKS_API pcm_ring
+{
+public:
+    typedef std::shared_ptr<pcm_ring> sptr;
+
+    static sptr create(
+        const std::string &shm_name,
+        unsigned int channels,
+        pcm_format format,
+        unsigned int sample_rate,
+        unsigned int capacity_frames);
+    static sptr open(const std::string &shm_name);
+
+    ~pcm_ring();
+
+    size_t write(const float *const *channel_data, size_t num_frames);
+    size_t acquire(const void **data, size_t max_frames);
+    void release(size_t num_frames);
+
+    const pcm_ring_header &header() const;
+
+private:
+    pcm_ring(const std::string &shm_name, void *mapping, size_t mapping_len, bool owner);
+
+    std::string _shm_name;
+    void *_mapping;
+    size_t _mapping_len;
+    bool _owner;
+    pcm_ring_header *_hdr;
+    uint8_t *_data;
+};
+
+// Writes its inputs (one per channel) interleaved into a pcm_ring, converting to int16 on the way
+// if the ring is in S16 format
+class BLOCKS_API pcm_ring_sink : public sync_block
+{
+public:
+    typedef boost::shared_ptr<pcm_ring_sink> sptr;
+
+    static sptr make(pcm_ring::sptr ring);
+
+    ~pcm_ring_sink();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    pcm_ring_sink(void) {}
+    pcm_ring_sink(pcm_ring::sptr ring);
+
+    pcm_ring::sptr _ring;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
@@ -0,0 +1,79 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_POWER_PROBE_H
+#define INCLUDED_GR_RUNTIME_POWER_PROBE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <gnuradio/analog/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace analog
+{
+
+// Sink that measures the mean squared magnitude of a float stream over fixed windows of samples.
+// Every completed window is published on the "power" message port and wakes any thread blocked in
+// wait_for_windows(), so callers can sleep on real sample counts instead of polling level().
+// An "rx_freq" retune tag restarts the measurement at the tagged sample.
+class ANALOG_API power_probe_f : public sync_block
+{
+public:
+    typedef boost::shared_ptr<power_probe_f> sptr;
+
+    static sptr make(unsigned int window_size);
+
+    ~power_probe_f();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+    float level() const;
+    void reset();
+    bool wait_for_windows(unsigned int num_windows, unsigned int timeout_ms);
+    double mean_level();
+    unsigned int get_stats(double &mean, double &variance);
+    unsigned int window_size() const;
+
+    void arm_retune(double freq_hz);
+    bool wait_for_retune(unsigned int timeout_ms);
+
+private:
+    power_probe_f(void) {}
+    power_probe_f(unsigned int window_size);
+
+    void init_block(unsigned int window_size);
+    void complete_window();
+    void accumulate(const float *in, int num_items);
+    void handle_retune(const tag_t &tag);
+
+    unsigned int _window_size;
+    unsigned int _fill;
+    double _acc;
+    std::atomic<float> _level;
+    std::atomic<bool> _restart;
+    std::vector<tag_t> _tags;
+
+    std::mutex _mtx;
+    std::condition_variable _window_cv;
+    double _level_sum;
+    double _level_sq_sum;
+    unsigned int _num_windows;
+    double _armed_freq_hz;
+    bool _retune_seen;
+};
+
+} // namespace analog
+} // namespace gr
+
+#endif
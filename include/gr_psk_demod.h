@@ -10,6 +10,10 @@
 
 #include <gnuradio/digital/api.h>
 #include <gnuradio/hier_block2.h>
+#include <gnuradio/digital/fll_band_edge_cc.h>
+#include <gnuradio/digital/constellation_receiver_cb.h>
+
+#include "gr_block_list.h"
 
 namespace gr
 {
@@ -45,7 +49,7 @@ typedef struct psk_demod_params {
     float phase_bw;
 } psk_demod_params_t;
 
-class DIGITAL_API psk_demod : public hier_block2
+class DIGITAL_API psk_demod : public hier_block2, public gr::block_list
 {
 public:
     typedef boost::shared_ptr<psk_demod> sptr;
@@ -54,8 +58,11 @@ public:
 
     ~psk_demod();
 
+    void reset();
+
 private:
-    gray_code_generator _gcg;
+    fll_band_edge_cc::sptr _freq_recov;
+    constellation_receiver_cb::sptr _receiver;
     psk_demod(void) {}
     psk_demod(psk_demod_params_t params);
 
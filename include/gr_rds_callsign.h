@@ -0,0 +1,105 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Tim Rice (trice2@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_RDSCALLSIGN_H
+#define INCLUDED_GR_RUNTIME_RDSCALLSIGN_H
+
+// RBDS program identifier to U.S. call sign, NRSC-4-B annex D.  Everything is constexpr and works on
+// the integer PI, so it can be checked at compile time and costs a few compares at run time.
+
+namespace gr
+{
+namespace rds
+{
+namespace callsign_detail
+{
+
+// Calls with three letters, indexed by PI - THREE_LETTER_FIRST.  Empty where nothing is assigned.
+constexpr char three_letter[][4] = {
+    "KEX", "KFH", "KFI", "KGA", "KGO", "KGU", "KGW", "KGY",  // 0x9950
+    "KID", "KIT", "KJR", "KLO", "KLZ", "KMA", "KMJ", "KNX",  // 0x9958
+    "KOA", "", "", "", "KQV", "KSL", "KUJ", "KVI",  // 0x9960
+    "KWG", "", "", "KYW", "", "WBZ", "WDZ", "WEW",  // 0x9968
+    "", "WGL", "WGN", "WGR", "", "WHA", "WHB", "WHK",  // 0x9970
+    "WHO", "", "WIP", "WJR", "WKY", "WLS", "WLW", "",  // 0x9978
+    "", "WOC", "", "WOL", "WOR", "", "", "",  // 0x9980
+    "WWJ", "WWL", "", "", "", "", "", "",  // 0x9988
+    "KDB", "KGB", "KOY", "KPQ", "KSD", "KUT", "KXL", "KXO",  // 0x9990
+    "", "WBT", "WGH", "WGY", "WHP", "WIL", "WMC", "WMT",  // 0x9998
+    "WOI", "WOW", "WRR", "WSB", "WSM", "KBW", "KCY", "KDF",  // 0x99A0
+    "", "", "KHQ", "KOB", "", "", "", "",  // 0x99A8
+    "", "", "", "WIS", "WJW", "WJZ", "", "",  // 0x99B0
+    "", "WRC",  // 0x99B8
+};
+constexpr unsigned int THREE_LETTER_FIRST = 0x9950;
+constexpr unsigned int THREE_LETTER_COUNT = sizeof(three_letter) / sizeof(three_letter[0]);
+
+constexpr unsigned int K_FIRST = 0x1000;   // KAAA
+constexpr unsigned int W_FIRST = 0x54A8;   // WAAA
+constexpr unsigned int W_LAST = 0x994F;    // WZZZ
+
+// A PI starting with A is a compressed form kept free of network codes: AFxy stands for xy00 and
+// Axyz for x0yz
+constexpr unsigned int expand(unsigned int pi)
+{
+    return (pi >> 12) != 0xA ? pi
+         : ((pi >> 8) & 0xF) == 0xF ? (pi & 0xFF) << 8
+         : (((pi >> 8) & 0xF) << 12) | (pi & 0xFF);
+}
+
+// Four letter calls are base 26 counted from KAAA and WAAA
+constexpr char four_letter(unsigned int pi, unsigned int i)
+{
+    return i == 0 ? (pi >= W_FIRST ? 'W' : 'K')
+         : i > 3 ? '\0'
+         : char('A' + ((pi - (pi >= W_FIRST ? W_FIRST : K_FIRST)) / (i == 1 ? 676 : i == 2 ? 26 : 1)) % 26);
+}
+
+constexpr char decode(unsigned int pi, unsigned int i)
+{
+    return pi >= K_FIRST && pi <= W_LAST ? four_letter(pi, i)
+         : pi >= THREE_LETTER_FIRST && pi - THREE_LETTER_FIRST < THREE_LETTER_COUNT && i < 3
+             ? three_letter[pi - THREE_LETTER_FIRST][i]
+         : '\0';
+}
+
+} // namespace callsign_detail
+
+// Character i of the call sign for a PI.  PIs below 0x1000, the B, D and E network codes and
+// unassigned three letter codes have no call sign.
+// @param pi The program identifier
+// @param i Position in the call sign, 0-3
+// @return The character, '\0' past the end of the call sign or if there is none
+constexpr char callsign_char(unsigned int pi, unsigned int i)
+{
+    return callsign_detail::decode(callsign_detail::expand(pi & 0xFFFF), i);
+}
+
+// @param pi The program identifier
+// @param csign_out Receives the NUL terminated call sign, at least 5 bytes.  Empty if the PI has none.
+inline void pi_to_callsign(unsigned int pi, char *csign_out)
+{
+    unsigned int i = 0;
+    while (i < 4 && (csign_out[i] = callsign_char(pi, i)) != '\0') {
+        i++;
+    }
+    csign_out[i] = '\0';
+}
+
+static_assert(callsign_char(0x1000, 0) == 'K' && callsign_char(0x1000, 3) == 'A', "KAAA");
+static_assert(callsign_char(0x994F, 0) == 'W' && callsign_char(0x994F, 1) == 'Z' &&
+              callsign_char(0x994F, 3) == 'Z', "WZZZ");
+static_assert(callsign_char(0x0FFF, 0) == '\0' && callsign_char(0xB001, 0) == '\0', "no call sign");
+static_assert(callsign_char(0x9950, 1) == 'E' && callsign_char(0x9950, 3) == '\0', "KEX");
+static_assert(callsign_char(0x99B9, 1) == 'R' && callsign_char(0x9961, 0) == '\0', "WRC, unassigned");
+static_assert(callsign_char(0xA123, 3) == callsign_char(0x1023, 3) &&
+              callsign_char(0xAF12, 3) == callsign_char(0x1200, 3), "compressed codes");
+
+} // namespace rds
+} // namespace gr
+
+#endif
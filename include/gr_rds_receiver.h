@@ -8,8 +8,12 @@
 #ifndef INCLUDED_GR_RUNTIME_RDSRECEIVER_H
 #define INCLUDED_GR_RUNTIME_RDSRECEIVER_H
 
+#include <condition_variable>
+#include <mutex>
+
 #include <gnuradio/analog/api.h>
 
+#include "gr_block_list.h"
 #include "gr_psk_demod.h"
 #include "gr_rds_sink.h"
 
@@ -18,21 +22,36 @@ namespace gr
 namespace analog
 {
 
-class ANALOG_API rds_receiver : public hier_block2
+class ANALOG_API rds_receiver : public hier_block2, public gr::block_list
 {
 public:
     typedef boost::shared_ptr<rds_receiver> sptr;
 
-    static sptr make();
+    static sptr make(bool baseband_input = false, double sampling_freq = 250000);
 
     ~rds_receiver();
 
+    void reset();
+
+    void set_cache(gr::rds::station_cache::sptr cache);
+    void arm_retune(double freq_hz);
+    bool wait_for_retune(unsigned int timeout_ms);
+
     gr::rds::rds_sink::sptr rds_sink;
 
 private:
-    rds_receiver(void);
+    gr::digital::psk_demod::sptr _psk_demod;
+    gr::rds::station_cache::sptr _cache;
+
+    std::mutex _mtx;
+    std::condition_variable _retune_cv;
+    double _armed_freq_hz;
+    bool _retune_seen;
+
+    rds_receiver(bool baseband_input, double sampling_freq);
 
-    void init_block();
+    void init_block(bool baseband_input, double sampling_freq);
+    void handle_retune(double freq_hz);
 };
 
 } // namespace analog
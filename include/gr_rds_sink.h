@@ -8,14 +8,70 @@
 #ifndef INCLUDED_GR_RUNTIME_RDSSINK_H
 #define INCLUDED_GR_RUNTIME_RDSSINK_H
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
 #include <rds/api.h>
 #include <gnuradio/block.h>
 
+#include "gr_station_cache.h"
+
 namespace gr
 {
 namespace rds
 {
 
+// Groups are counted per type, index 2 * group type + version (0 = A, 1 = B)
+const unsigned int RDS_GROUP_TYPES = 32;
+
+// Most alternative frequencies a method A list can carry
+const unsigned int RDS_MAX_AF = 25;
+
+// Bits of the changed fields mask passed to the change callback
+enum rds_field : uint32_t {
+    RDS_FIELD_PI = 1 << 0,
+    RDS_FIELD_PS = 1 << 1,
+    RDS_FIELD_PTY = 1 << 2,
+    RDS_FIELD_RADIOTEXT = 1 << 3,
+    RDS_FIELD_RTPLUS = 1 << 4,
+    RDS_FIELD_CLOCK = 1 << 5,
+    RDS_FIELD_AF = 1 << 6,
+    RDS_FIELD_FLAGS = 1 << 7,
+};
+
+// One RadioText+ tag, the text is cut out of the RadioText it points into
+struct rds_rtplus_tag {
+    uint32_t content_type;               // RT+ content type, 1 = item title, 4 = item artist, 0 = none
+    char text[65];
+};
+
+// Everything rds_sink knows about the current station.  Fixed size, so it can be copied out without
+// allocating.  Strings are NUL terminated.
+struct rds_snapshot {
+    uint32_t seq;                        // bumped on every change
+    uint32_t pi;                         // program identifier, 0 until decoded
+    char callsign[8];                    // from the PI, empty if it isn't a U.S. call sign
+    char ps[9];                          // program service name, set once all four segments arrived
+    uint32_t pty_code;                   // program type code
+    char pty[32];                        // program type name (RBDS table), empty until decoded
+    uint8_t traffic_program;
+    uint8_t traffic_announcement;
+    uint8_t music;                       // music/speech switch, 1 = music
+    char radiotext[65];                  // set once the whole message arrived
+    uint8_t rtplus_running;              // the RT+ item is still running
+    rds_rtplus_tag rtplus[2];
+    int64_t clock_time;                  // UTC seconds since the epoch from the last CT group, 0 if none
+    int32_t clock_offset_min;            // local time offset the station sent with it
+    uint32_t num_af;
+    uint32_t af_khz[RDS_MAX_AF];         // alternative frequencies in the order they were first seen
+    uint32_t group_counts[RDS_GROUP_TYPES];  // groups received per type since the last reset
+};
+
+// Called on the message thread after a group changed any of the fields in changed (rds_field bits).
+// It must not block, get_snapshot() can be called from it.
+typedef void (*rds_change_callback)(uint32_t changed, void *user_data);
+
 class RDS_API rds_sink : public gr::block
 {
 public:
@@ -27,17 +83,51 @@ public:
 
     const std::string get_curr_station();
     const std::string get_curr_station_type();
+    unsigned int get_curr_pi();
+    void get_snapshot(rds_snapshot &snapshot_out) const;
     void reset();
 
+    void set_cache(station_cache::sptr cache, int channel);
+    void set_change_callback(rds_change_callback callback, void *user_data);
+
     ~rds_sink();
 
 private:
     rds_sink(void);
 
     void init_block();
+    rds_snapshot &begin_update();
+    void publish();
+    void clear_assembly();
+    uint32_t decode_group(rds_snapshot &back, const uint16_t *group);
+    uint32_t decode_ps(rds_snapshot &back, const uint16_t *group, bool version_b);
+    uint32_t decode_af(rds_snapshot &back, unsigned int code);
+    uint32_t decode_radiotext(rds_snapshot &back, const uint16_t *group, bool version_b);
+    uint32_t decode_rtplus(rds_snapshot &back, const uint16_t *group);
+    uint32_t resolve_rtplus(rds_snapshot &back);
+    uint32_t decode_clock(rds_snapshot &back, const uint16_t *group);
+
+    // Same double buffered seqlock as the tuner's station list: writers fill
+    // _snapshots[(seq + 1) & 1] and bump _seq, readers copy _snapshots[seq & 1] and retry if _seq
+    // moved meanwhile.  rds_rcv runs on the message thread and reset() on the callers', so the
+    // writers take _write_mtx between themselves.  Readers never lock.
+    rds_snapshot _snapshots[2];
+    std::atomic<uint32_t> _seq;
+    std::mutex _write_mtx;
+    station_cache::sptr _cache;
+    int _cache_channel = -1;
+    rds_change_callback _callback = nullptr;
+    void *_callback_user_data = nullptr;
 
-    std::string _curr_station;
-    std::string _curr_station_type;
+    // Partly received PS and RadioText, only touched with _write_mtx held.  A segment mask bit is
+    // set per segment received, the text is published once all segments are in.
+    char _ps_buf[8];
+    uint32_t _ps_segments;
+    char _rt_buf[64];
+    uint32_t _rt_segments;
+    int _rt_ab;                          // text A/B flag, a toggle means a new message
+    int _rtplus_group;                   // 2 * type + version of the RT+ ODA group, -1 if not announced
+    uint8_t _rtplus_raw[2][3];           // content type, start and length marker of the last tags
 };
 
 } // namespace rds
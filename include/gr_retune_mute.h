@@ -0,0 +1,69 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_RETUNE_MUTE_H
+#define INCLUDED_GR_RUNTIME_RETUNE_MUTE_H
+
+#include <atomic>
+#include <functional>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+// Audio pass-through in front of the sinks that hides a station change.  After arm() it fades the
+// audio still queued from the old frequency out and keeps it muted until the "rx_freq" retune tag of
+// the new frequency arrives, then fades back in.  The sinks keep getting a steady stream, so there
+// are no underruns, and nothing of the old station plays once the retune was asked for.
+class BLOCKS_API retune_mute_ff : public sync_block
+{
+public:
+    typedef boost::shared_ptr<retune_mute_ff> sptr;
+
+    static sptr make(double sample_rate);
+
+    ~retune_mute_ff();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+    void arm(double freq_hz);
+    void hold(bool held);
+    void set_open_callback(std::function<void(double)> callback);
+
+private:
+    retune_mute_ff(void) {}
+    retune_mute_ff(double sample_rate);
+
+    void init_block(double sample_rate);
+    void open();
+
+    std::atomic<double> _armed_freq_hz;
+    std::atomic<bool> _arm_pending;
+    std::atomic<bool> _held;
+    std::function<void(double)> _open_callback;
+
+    double _target_freq_hz;
+    bool _waiting;
+    unsigned int _muted;
+    unsigned int _max_muted;
+    float _gain;
+    float _fade_out_step;
+    float _fade_in_step;
+    std::vector<tag_t> _tags;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_RETUNE_TAGGER_H
+#define INCLUDED_GR_RUNTIME_RETUNE_TAGGER_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+// Pass-through placed right after the RTL source.  The rtl backend of gr-osmosdr doesn't tag
+// frequency changes, so after tag_retune() this block puts an "rx_freq" tag on the sample a holdoff
+// after the first one it passes on.  The holdoff skips what the USB transfer and the buffers still
+// held from the old frequency, so blocks downstream use the tag to find where the samples of the
+// new frequency start.
+// It also puts a "rx_stamp" tag holding the wall time the sample left the source on one sample in
+// every set_timestamp_interval(), so a probe at the end of the chain can measure latency.
+class BLOCKS_API retune_tagger_cc : public sync_block
+{
+public:
+    typedef boost::shared_ptr<retune_tagger_cc> sptr;
+
+    static sptr make();
+
+    ~retune_tagger_cc();
+
+    bool start();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+    void tag_retune(double freq_hz, uint64_t holdoff);
+
+    static pmt::pmt_t retune_key();
+
+    void set_timestamp_interval(unsigned int num_samples);
+    static pmt::pmt_t timestamp_key();
+    static uint64_t timestamp_now();
+
+    uint64_t first_sample_time() const;
+
+private:
+    retune_tagger_cc(void);
+
+    std::atomic<double> _freq_hz;
+    std::atomic<uint64_t> _holdoff;
+    std::atomic<bool> _pending;
+    bool _tag_due;                // a tag goes on _tag_at
+    uint64_t _tag_at;
+    double _tag_freq_hz;
+    std::atomic<unsigned int> _stamp_interval;
+    uint64_t _next_stamp;         // in nitems_written(0), which starts over with every start()
+    std::atomic<uint64_t> _first_sample;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
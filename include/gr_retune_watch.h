@@ -0,0 +1,50 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_RETUNE_WATCH_H
+#define INCLUDED_GR_RUNTIME_RETUNE_WATCH_H
+
+#include <functional>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace blocks
+{
+
+// Pass-through for the inside of a decoder chain.  When an "rx_freq" retune tag passes, it calls a
+// function with the tagged frequency in Hz from its own thread, before any sample at the new
+// frequency is passed on.  The decoder can then clear its state in step with the stream instead of
+// from whichever thread asked for the retune.
+class BLOCKS_API retune_watch_cc : public sync_block
+{
+public:
+    typedef boost::shared_ptr<retune_watch_cc> sptr;
+
+    static sptr make(std::function<void(double)> callback);
+
+    ~retune_watch_cc();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    retune_watch_cc(void) {}
+    retune_watch_cc(std::function<void(double)> callback);
+
+    std::function<void(double)> _callback;
+    std::vector<tag_t> _tags;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
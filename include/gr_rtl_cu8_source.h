@@ -0,0 +1,87 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_RTL_CU8_SOURCE_H
+#define INCLUDED_GR_RUNTIME_RTL_CU8_SOURCE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gnuradio/blocks/api.h>
+#include <gnuradio/sync_block.h>
+
+struct rtlsdr_dev;
+
+namespace gr
+{
+namespace blocks
+{
+
+// An RTL dongle opened through librtlsdr, putting out its samples as they come off USB: interleaved
+// unsigned 8 bit I/Q, 2 byte items.  Feeds cu8_channelizer, which saves the float conversion at the
+// full RTL rate that gr-osmosdr does.  A thread of the block's own runs rtlsdr_read_async into a
+// ring of about a second; if the flowgraph falls further behind the newest samples are dropped.
+class BLOCKS_API rtl_cu8_source : public sync_block
+{
+public:
+    typedef boost::shared_ptr<rtl_cu8_source> sptr;
+
+    static sptr make(
+        unsigned int device_index,
+        double sample_rate,
+        double center_freq,
+        int freq_corr_ppm,
+        bool auto_gain,
+        double gain_db);
+
+    ~rtl_cu8_source();
+
+    bool start();
+    bool stop();
+
+    void set_center_freq(double freq);
+    double set_gain(double gain_db);
+    const std::vector<double>& gains() const;
+    double center_freq() const;
+    double sample_rate() const;
+    unsigned int transfer_samples() const;
+    uint64_t dropped_samples() const;
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    rtl_cu8_source(void) {}
+    rtl_cu8_source(rtlsdr_dev *dev, double sample_rate, double center_freq);
+
+    static void read_callback(unsigned char *buf, uint32_t len, void *ctx);
+    void push(const unsigned char *buf, uint32_t len);
+
+    rtlsdr_dev *_dev;
+    double _sample_rate;
+    std::atomic<double> _center_freq;
+    std::vector<double> _gains;
+
+    std::thread _thread;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::vector<uint8_t> _ring;   // guarded by _mtx, a power of two bytes
+    uint64_t _write_pos;          // bytes ever written and read, guarded by _mtx
+    uint64_t _read_pos;
+    std::atomic<uint64_t> _dropped;
+};
+
+} // namespace blocks
+} // namespace gr
+
+#endif
@@ -12,33 +12,321 @@ extern "C" {
 #define STATION_NAME_MAX_LEN 10
 #define STATION_GENRE_MAX_LEN 30
 
+#define RTL_SETTLE_HIST_BINS 32
+#define RTL_SETTLE_HIST_BIN_MS 10
+
+#define RTL_LOW_LATENCY_BUFFER_MS 10
+
+#define RTL_DEVICE_LABEL_MAX_LEN 64
+
+#define RTL_MULTI_STATION_SAMPLE_RATE 2400000
+
+#define RTL_RDS_MAX_AF 25
+#define RTL_RDS_TEXT_MAX_LEN 65
+
+#define RTL_PERF_NAME_MAX_LEN 48
+
 // Opaque context to pass to C
 typedef struct rtl_ctx rtl_ctx_t;
 
+// Opaque handle to a shared memory PCM ring, see rtl_add_pcm_ringbuffer_sink
+typedef struct rtl_pcm_ring rtl_pcm_ring_t;
+
+typedef enum rtl_pcm_format {
+    RTL_PCM_FLOAT32 = 0,
+    RTL_PCM_S16
+} rtl_pcm_format_t;
+
+typedef enum rtl_audio_codec {
+    RTL_CODEC_FLAC = 0,   // lossless, about half the size of 16 bit WAV
+    RTL_CODEC_OPUS        // lossy Ogg Opus, 64 kbit/s is a tenth of 16 bit stereo WAV
+} rtl_audio_codec_t;
+
+// Bits of station_info_t::metrics
+typedef enum rtl_station_metric {
+    RTL_METRIC_RSSI = 1 << 0,
+    RTL_METRIC_CNR = 1 << 1,
+    RTL_METRIC_SNR = 1 << 2,
+    RTL_METRIC_PILOT = 1 << 3,
+    RTL_METRIC_RDS = 1 << 4
+} rtl_station_metric_t;
+
 typedef struct __attribute__((packed))
 station_info {
     char name[STATION_NAME_MAX_LEN];
     char genre[STATION_GENRE_MAX_LEN];
     double frequency;
+    unsigned int metrics;   // rtl_station_metric_t bits of the measurements below that were made
+    float rssi_dbfs;        // channel power before demodulation, dB relative to the ADC's full scale
+    float cnr_db;           // channel power over the band's noise floor (wideband scan)
+    float snr_db;           // demodulated: a full deviation tone over the noise in 15 kHz of audio
+    float pilot_snr_db;     // 19 kHz stereo pilot over the noise beside it, about 0 for mono
+    float rds_bler;         // share of RDS groups lost to block errors, 0 to 1
+    float quality;          // 0 to 100 from the SNR (or CNR) and the RDS error rate, for ranking
 } station_info_t;
 
+typedef enum rtl_scan_mode {
+    RTL_SCAN_SEQUENTIAL = 0,   // retune to every channel and decode RDS (slow, fills name/genre)
+    RTL_SCAN_WIDEBAND          // FFT power estimate over wide windows (fast, frequency only).
+                               // Sequential while virtual tuners are running.  Mutes the
+                               // audio while it runs.
+} rtl_scan_mode_t;
+
+typedef enum rtl_latency_profile {
+    RTL_LATENCY_DEFAULT = 0,   // GNU Radio's own buffer sizes, most headroom against audio underruns
+    RTL_LATENCY_LOW            // every buffer in the audio chain holds about RTL_LOW_LATENCY_BUFFER_MS
+} rtl_latency_profile_t;
+
+// The blocks of a tuner's flowgraph, in groups that can be scheduled separately
+typedef enum rtl_block_group {
+    RTL_GROUP_FRONT_END = 0,   // RTL source or replay, retune tagger, IQ recorder, channelizers
+    RTL_GROUP_DEMOD,           // FM receivers, including the stereo decoder, and the signal probes
+    RTL_GROUP_AUDIO,           // 48 kHz resamplers, mutes and the audio sinks
+    RTL_GROUP_RDS,             // RDS receivers, down to psk_demod and the decoder
+    RTL_NUM_BLOCK_GROUPS
+} rtl_block_group_t;
+
+// How the threads of a group's blocks are scheduled.  GNU Radio runs every block on a thread of its
+// own, the settings apply to each of them.
+//
+// Recommended on a 4 core SoC that runs the UI on cores 0 and 1:
+//   RTL_GROUP_FRONT_END  core 2        priority 0
+//   RTL_GROUP_DEMOD      core 2        priority 0
+//   RTL_GROUP_AUDIO      core 3        priority 10   max_noutput_items 480 (10 ms at 48 kHz)
+//   RTL_GROUP_RDS        cores 0 and 1 priority 0
+// The audio path then never waits behind the demodulator or the UI for a time slice, and small work
+// calls keep it from handing the sink bursts.  RDS can fall behind on a busy UI core without
+// anything being heard.  Check the result with rtl_get_latency and rtl_get_perf_stats.
+typedef struct rtl_group_sched {
+    const int* cpu_cores;      // CPUs to pin the group to, NULL for rtl_tuner_options_t::cpu_cores
+    unsigned int num_cpu_cores;
+    int priority;              // SCHED_FIFO real-time priority 1-99, 0 for the normal scheduler.
+                               // Needs CAP_SYS_NICE or an rtprio limit, rtl_start_fm returns -2
+                               // if the threads could not be switched.
+    int max_noutput_items;     // most items a block handles per work() call, 0 for no limit
+} rtl_group_sched_t;
+
+typedef struct rtl_latency_stats {
+    double last_ms;      // most recent antenna to audio sink measurement
+    double mean_ms;
+    double min_ms;
+    double max_ms;
+    unsigned int num_measurements;
+} rtl_latency_stats_t;
+
+typedef struct rtl_device_info {
+    unsigned int index;                     // device_index to pass to rtl_create_tuner_ex
+    char label[RTL_DEVICE_LABEL_MAX_LEN];   // e.g. "Generic RTL2832U OEM :: 00000001"
+    int in_use;                             // non-zero if a tuner in this process has it open
+} rtl_device_info_t;
+
+typedef enum rtl_iq_format {
+    RTL_IQ_CU8 = 0,    // what the dongle delivers, 2 bytes a sample
+    RTL_IQ_CF32        // complex float, 8 bytes a sample
+} rtl_iq_format_t;
+
+typedef struct rtl_tuner_options {
+    const int* cpu_cores;       // CPUs to pin this tuner's flowgraph to, NULL to leave it unpinned
+    unsigned int num_cpu_cores;
+    unsigned int sample_rate;   // RTL sample rate, 0 for 1 MS/s.  RTL_MULTI_STATION_SAMPLE_RATE gives
+                                // virtual tuners 11 channels around the tuned frequency instead of 5.
+    const char* station_cache_path;  // file that keeps found stations and their RDS data across runs,
+                                     // NULL for none.  rtl_get_fm_stations starts out with its contents.
+    const char* filter_cache_path;   // file the designed filter taps are kept in, NULL to design them
+                                     // on every start.  Written the first time, loaded afterwards.
+    const char* record_path;         // records the dongle's IQ to <path>.sigmf-data with SigMF metadata
+                                     // (rate, frequency per retune) in <path>.sigmf-meta, NULL for none
+    rtl_iq_format_t record_format;
+    const char* replay_path;         // plays <path>.sigmf-data instead of opening a dongle, NULL for
+                                     // live.  The recording sets the sample rate; it can't be retuned
+                                     // or scanned, and the flowgraph finishes at its end unless repeated.
+    int replay_realtime;             // non-zero paces the replay to its sample rate, 0 runs as fast as
+                                     // the flowgraph takes it, e.g. to benchmark
+    int replay_repeat;               // non-zero starts the replay over at the end
+    int replay_adc_model;            // non-zero plays the recording through a model of the RTL's 8 bit
+                                     // ADC, so RTL_GAIN_SOFTWARE_AGC can be tried on it.  gain is taken
+                                     // as the gain it was recorded at; the AGC's gains scale the samples
+                                     // relative to it, clip and quantize them a USB transfer late.
+    int cu8_front_end;               // non-zero opens the dongle through librtlsdr and channel filters
+                                     // its 8 bit samples in 16 bit fixed point, for low-power hardware.
+                                     // Only the quadrature rate is ever converted to float.  gain and
+                                     // gain_mode apply; if_gain, bb_gain and the DC/IQ correction don't.
+                                     // Recordings are of the channel at the quadrature rate, and there
+                                     // are no wideband scans or virtual tuners.  Ignored when replaying.
+} rtl_tuner_options_t;
+
+typedef enum rtl_gain_mode {
+    RTL_GAIN_MANUAL = 0,       // gain, if_gain and bb_gain as given, never changed
+    RTL_GAIN_DONGLE_AGC,       // the tuner chip's own AGC
+    RTL_GAIN_SOFTWARE_AGC      // starts at gain and steps it to keep the ADC out of clipping without
+                               // wasting its 8 bits.  The gain found for a channel is kept and set
+                               // straight away the next time it is tuned.
+} rtl_gain_mode_t;
+
+// Rates and gains of a tuner's flowgraph.  The RTL rate is decimated in one filter pass to the
+// quadrature rate (the highest rate up to max_quadrature_rate that divides it), FM demodulated there
+// and decimated by audio_decimation to the MPX rate that stereo and RDS are decoded from.  The MPX
+// rate must be at least 120 kHz.  Lower rates cost less CPU: e.g. 250000 / 250000 / 2 for low-end
+// hardware, RTL_MULTI_STATION_SAMPLE_RATE for virtual tuners on a desktop.  The fm_sweep cases of
+// rtl_bench measure the CPU a range of configs takes, mono and stereo, on the machine it runs on.
+typedef struct rtl_tuner_config {
+    unsigned int sample_rate;          // RTL sample rate
+    unsigned int max_quadrature_rate;  // highest FM demodulator rate
+    double channel_bw;                 // channel filter bandwidth, Hz
+    unsigned int audio_decimation;     // quadrature rate to MPX rate
+    int stereo;                        // non-zero for stereo audio, mono costs less
+    double initial_freq_mhz;
+    int gain_mode;                     // an rtl_gain_mode_t
+    double gain;                       // RF gain, dB, the starting point of the software AGC
+    double if_gain;                    // dB
+    double bb_gain;                    // dB
+    double freq_corr_ppm;              // crystal correction
+} rtl_tuner_config_t;
+
+typedef struct rtl_startup_stats {
+    double create_ms;                  // time spent in rtl_create_tuner_ex
+    double device_open_ms;             // of which opening the dongle
+    double flowgraph_ms;               // of which designing filters and building the flowgraph
+    double filter_design_ms;           // of which designing filters that weren't cached
+    unsigned int filters_cached;       // filter designs taken from the cache while creating
+    unsigned int filters_designed;     // filter designs computed while creating
+    double start_to_first_sample_ms;   // rtl_start_fm to the first sample out of the dongle, 0 until then
+    double create_to_first_sample_ms;  // rtl_create_tuner_ex to the first sample, 0 until then
+    double start_to_first_audio_ms;    // rtl_start_fm to the first audio reaching the sinks, 0 until then
+    unsigned int resumes;              // rtl_resume calls that restarted the tuner
+    double pause_ms;                   // time the most recent rtl_pause took
+    double resume_ms;                  // time the most recent rtl_resume took
+    double resume_to_first_audio_ms;   // the most recent rtl_resume to the first audio, 0 until then
+} rtl_startup_stats_t;
+
+// How long adding and removing sinks on a running tuner held up the audio
+typedef struct rtl_reconfig_stats {
+    unsigned int count;     // sinks added or removed since the tuner was created
+    double last_ms;         // the audio path's pause for the most recent one
+    double max_ms;
+    double total_ms;
+} rtl_reconfig_stats_t;
+
+// State of the software AGC, see RTL_GAIN_SOFTWARE_AGC
+typedef struct rtl_agc_stats {
+    int enabled;                // 0 in the other gain modes and when replaying without the ADC model
+    double gain_db;             // tuner gain now
+    double peak_dbfs;           // 99.9th percentile of the ADC samples in the last window
+    double clip_percent;        // ADC samples at full scale in the last window
+    unsigned int gain_changes;  // steps taken since the tuner was created
+    unsigned int presets;       // channels with a gain kept for them
+} rtl_agc_stats_t;
+
+// GNU Radio's performance counters of one block of a tuner's flowgraph.  Only items_read and
+// items_written are kept up when the counters are off, see rtl_set_perf_counters.
+typedef struct rtl_perf {
+    char name[RTL_PERF_NAME_MAX_LEN];     // e.g. "fir_filter_ccf3"
+    char parent[RTL_PERF_NAME_MAX_LEN];   // hier block it is part of, "" for the tuner's own blocks
+    unsigned long long items_read;        // from input 0 since the tuner was started
+    unsigned long long items_written;     // to output 0 since the tuner was started
+    double work_time_total_ms;            // time spent in work()
+    double work_time_avg_us;              // per work() call
+    double busy_percent;                  // work time per wall clock time, near 100 the block can't keep up
+    double noutput_items_avg;             // items the scheduler asked for per call
+    double nproduced_avg;                 // items produced per call
+    double throughput_avg;                // items per second
+    float input_buffer_full;              // fullest input buffer, 0 to 1.  Near 0 it's waiting on upstream.
+    float output_buffer_full;             // fullest output buffer, 0 to 1.  Near 1 the scheduler is holding
+                                          // the block back for a slower block downstream.
+} rtl_perf_t;
+
+// Bits of the changed_fields mask passed to rtl_rds_callback_t
+typedef enum rtl_rds_field {
+    RTL_RDS_PI = 1 << 0,
+    RTL_RDS_PS = 1 << 1,
+    RTL_RDS_PTY = 1 << 2,
+    RTL_RDS_RADIOTEXT = 1 << 3,
+    RTL_RDS_RTPLUS = 1 << 4,
+    RTL_RDS_CLOCK = 1 << 5,
+    RTL_RDS_AF = 1 << 6,
+    RTL_RDS_FLAGS = 1 << 7     // traffic program, traffic announcement, music/speech
+} rtl_rds_field_t;
+
+typedef struct rtl_rds_info {
+    unsigned int pi;                        // 0 until decoded
+    char callsign[8];
+    char ps[9];                             // program service name
+    unsigned int pty;                       // program type code
+    char pty_name[32];
+    int traffic_program;
+    int traffic_announcement;
+    int music;
+    char radiotext[RTL_RDS_TEXT_MAX_LEN];
+    unsigned int rtplus_type[2];            // RT+ content types, 1 = item title, 4 = item artist, 0 = none
+    char rtplus_text[2][RTL_RDS_TEXT_MAX_LEN];
+    long long clock_time;                   // UTC seconds since the epoch from the station's clock, 0 if none
+    int clock_offset_min;                   // local time offset the station sent with it
+    unsigned int num_af;
+    unsigned int af_khz[RTL_RDS_MAX_AF];    // alternative frequencies of the tuned station
+} rtl_rds_info_t;
+
+// Called on the flowgraph's message thread whenever decoded RDS data changes.  Must return quickly,
+// rtl_get_rds_info may be called from it.
+typedef void (*rtl_rds_callback_t)(rtl_ctx_t* tuner, unsigned int changed_fields, void* user_data);
+
+unsigned int rtl_get_devices(rtl_device_info_t* devices_out, unsigned int max_devices);
+
 rtl_ctx_t* rtl_create_tuner();
+rtl_ctx_t* rtl_create_tuner_ex(unsigned int device_index, const rtl_tuner_options_t* options);
+void rtl_get_default_tuner_config(rtl_tuner_config_t* config_out);
+rtl_ctx_t* rtl_create_tuner_with_config(unsigned int device_index, const rtl_tuner_options_t* options, const rtl_tuner_config_t* config);
 void rtl_destroy_tuner(rtl_ctx_t* this_tuner);
+void rtl_get_startup_stats(rtl_ctx_t* this_tuner, rtl_startup_stats_t* stats_out);
+void rtl_set_perf_counters(rtl_ctx_t* this_tuner, int enabled);
+unsigned int rtl_get_perf_stats(rtl_ctx_t* this_tuner, rtl_perf_t* stats_out, unsigned int max_blocks);
+void rtl_reset_perf_stats(rtl_ctx_t* this_tuner);
 
 void rtl_add_audio_sink(rtl_ctx_t* this_tuner, const char* device, int sampling_rate);
 void rtl_remove_audio_sink(rtl_ctx_t* this_tuner);
 void rtl_add_wav_sink(rtl_ctx_t* this_tuner, const char* file_name, int sampling_rate);
+int rtl_add_encoded_sink(rtl_ctx_t* this_tuner, const char* base_path, rtl_audio_codec_t codec, unsigned int bitrate, unsigned int segment_seconds);
+void rtl_get_reconfig_stats(rtl_ctx_t* this_tuner, rtl_reconfig_stats_t* stats_out);
 
-void rtl_start_fm(rtl_ctx_t* this_tuner);
+rtl_pcm_ring_t* rtl_add_pcm_ringbuffer_sink(rtl_ctx_t* this_tuner, const char* shm_name, unsigned int capacity_frames, rtl_pcm_format_t format, int sampling_rate);
+rtl_pcm_ring_t* rtl_pcm_open(const char* shm_name);
+void rtl_pcm_close(rtl_pcm_ring_t* ring);
+unsigned int rtl_pcm_channels(rtl_pcm_ring_t* ring);
+unsigned int rtl_pcm_acquire(rtl_pcm_ring_t* ring, const void** frames_out, unsigned int max_frames);
+void rtl_pcm_release(rtl_pcm_ring_t* ring, unsigned int num_frames);
+
+int rtl_start_fm(rtl_ctx_t* this_tuner);
 void rtl_stop_fm(rtl_ctx_t* this_tuner);
 void rtl_wait(rtl_ctx_t* tuner);
+void rtl_pause(rtl_ctx_t* this_tuner);
+int rtl_resume(rtl_ctx_t* this_tuner);
+
+void rtl_set_latency_profile(rtl_ctx_t* this_tuner, rtl_latency_profile_t profile);
+int rtl_set_group_sched(rtl_ctx_t* this_tuner, rtl_block_group_t group, const rtl_group_sched_t* sched);
+unsigned int rtl_get_latency(rtl_ctx_t* this_tuner, rtl_latency_stats_t* stats_out);
 
 unsigned int rtl_get_fm_stations(rtl_ctx_t* this_tuner, station_info_t* stations_out);
+void rtl_rank_stations(station_info_t* stations, unsigned int num_stations);
+void rtl_set_scan_mode(rtl_ctx_t* this_tuner, rtl_scan_mode_t mode);
+void rtl_request_scan(rtl_ctx_t* this_tuner);
+void rtl_set_scan_interval(rtl_ctx_t* this_tuner, unsigned int interval_ms);
+unsigned int rtl_get_scan_interval(rtl_ctx_t* this_tuner);
+double rtl_get_last_scan_time(rtl_ctx_t* this_tuner);
+unsigned int rtl_get_settle_histogram(rtl_ctx_t* this_tuner, unsigned int* counts_out, unsigned int max_bins);
+
+int rtl_add_virtual_tuner(rtl_ctx_t* this_tuner, double freq);
+void rtl_remove_virtual_tuner(rtl_ctx_t* this_tuner, int virtual_id);
+int rtl_get_virtual_tuner_station(rtl_ctx_t* this_tuner, int virtual_id, station_info_t* station_out);
+float rtl_get_virtual_tuner_signal_str(rtl_ctx_t* this_tuner, int virtual_id);
 
 void rtl_set_fm(rtl_ctx_t* this_tuner, double freq);
 double rtl_get_fm(rtl_ctx_t* this_tuner);
 
 float rtl_get_signal_str(rtl_ctx_t* tuner);
+void rtl_get_station_quality(rtl_ctx_t* this_tuner, station_info_t* station_out);
+void rtl_get_agc_stats(rtl_ctx_t* this_tuner, rtl_agc_stats_t* stats_out);
+
+void rtl_get_rds_info(rtl_ctx_t* this_tuner, rtl_rds_info_t* info_out);
+void rtl_set_rds_callback(rtl_ctx_t* this_tuner, rtl_rds_callback_t callback, void* user_data);
 
 #ifdef __cplusplus
 }
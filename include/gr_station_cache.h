@@ -0,0 +1,89 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Tim Rice (trice2@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_STATION_CACHE_H
+#define INCLUDED_GR_RUNTIME_STATION_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gr
+{
+namespace rds
+{
+
+const uint32_t STATION_CACHE_MAGIC = 0x53544e43;  // "STNC"
+const uint32_t STATION_CACHE_VERSION = 1;
+
+// One per channel of the band, in channel order.  Strings are NUL terminated.
+struct station_cache_entry {
+    uint32_t pi;            // RDS program identifier, 0 until one was decoded
+    uint32_t found;         // non-zero if the most recent scan found a station here
+    float level;            // audio SNR in dB found by that scan, or dB above the noise floor if
+                            // it was a wideband scan
+    uint32_t reserved;
+    double frequency;       // MHz
+    double last_seen;       // wall clock seconds since the epoch a scan last found it, 0 if never
+    char callsign[16];
+    char genre[32];
+};
+static_assert(sizeof(station_cache_entry) == 80, "station cache entries are a fixed on-disk layout");
+
+struct station_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_channels;
+    uint32_t entry_size;
+    double band_start_mhz;
+    double spacing_mhz;
+    double last_scan;       // wall clock seconds since the epoch the last scan completed, 0 if never
+    uint64_t reserved;
+};
+static_assert(sizeof(station_cache_header) == 48, "the station cache header is a fixed on-disk layout");
+
+// What the scanner and rds_sink learned about every channel, kept in a memory mapped file so it
+// outlives the process and loads without parsing.  The file is a station_cache_header followed by
+// num_channels station_cache_entry, in the host's byte order.  A file with another layout or band
+// plan is started over.
+class station_cache
+{
+public:
+    typedef std::shared_ptr<station_cache> sptr;
+
+    static sptr open(
+        const std::string &path,
+        double band_start_mhz,
+        double spacing_mhz,
+        unsigned int num_channels);
+
+    ~station_cache();
+
+    int channel_of(double freq_mhz) const;
+    bool lookup(int channel, station_cache_entry &entry);
+    std::vector<station_cache_entry> found_stations(double &last_scan);
+
+    void update_pi(int channel, uint32_t pi, const char *callsign);
+    void update_genre(int channel, const char *genre);
+    void record_scan(const std::vector<int> &channels, const std::vector<float> &levels, double completed);
+
+private:
+    station_cache(void *mapping, size_t mapping_len);
+
+    std::mutex _mtx;
+    void *_mapping;
+    size_t _mapping_len;
+    station_cache_header *_hdr;
+    station_cache_entry *_entries;
+};
+
+} // namespace rds
+} // namespace gr
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_STEREO_DEMOD_H
+#define INCLUDED_GR_RUNTIME_STEREO_DEMOD_H
+
+#include <cstdint>
+#include <vector>
+
+#include <gnuradio/analog/api.h>
+#include <gnuradio/sync_block.h>
+
+namespace gr
+{
+namespace analog
+{
+
+// Takes the MPX signal and the 19 kHz pilot reference from a PLL and produces, per sample:
+//   out 0: L+R (the MPX itself)
+//   out 1: L-R, brought down from the 38 kHz subcarrier
+//   out 2: the 57 kHz RDS subcarrier mixed down to complex baseband
+// Both subcarriers are harmonics of the pilot, so the mixers only cost a couple of complex multiplies.
+// L-R is blended towards mono as the pilot gets weak: the MPX is mixed with the PLL reference and
+// low-passed, the in-phase part is the pilot the PLL locked to and the quadrature part only noise.
+// Below BLEND_MONO_DB of pilot over that noise L-R is muted, above BLEND_STEREO_DB it is passed in
+// full.  A station without a pilot, or a PLL that isn't locked, so plays mono instead of the noise
+// of the 38 kHz band.  An "rx_freq" retune tag starts the blend over from mono.
+class ANALOG_API stereo_demod : public sync_block
+{
+public:
+    typedef boost::shared_ptr<stereo_demod> sptr;
+
+    static sptr make(double sample_rate);
+
+    ~stereo_demod();
+
+    int work(
+        int noutput_items,
+        gr_vector_const_void_star &input_items,
+        gr_vector_void_star &output_items);
+
+private:
+    stereo_demod(void) {}
+    stereo_demod(double sample_rate);
+
+    void restart();
+    void update_blend();
+
+    float _pilot_alpha;
+    float _noise_alpha;
+    float _blend_step;
+    uint64_t _settle;
+    uint64_t _n;
+    gr_complex _pilot1;                 // MPX * reference, after the first and second one pole
+    gr_complex _pilot2;
+    float _noise;                       // mean of the quadrature part's power
+    float _blend_gain;                  // L-R gain applied, moves towards _blend_target
+    float _blend_target;
+    std::vector<tag_t> _tags;
+};
+
+} // namespace analog
+} // namespace gr
+
+#endif
@@ -0,0 +1,77 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_TAP_CACHE_H
+#define INCLUDED_GR_RUNTIME_TAP_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gnuradio/gr_complex.h>
+#include <gnuradio/filter/api.h>
+#include <gnuradio/filter/firdes.h>
+
+namespace gr
+{
+namespace filter
+{
+
+const uint32_t TAP_CACHE_MAGIC = 0x54415043;  // "TAPC"
+const uint32_t TAP_CACHE_VERSION = 1;
+
+// Process-wide cache in front of firdes.  Every filter in the library is designed through it, so a
+// second tuner or virtual tuner with the same rates reuses the taps instead of designing them
+// again.  The designs can be written to a file and loaded on the next start, so a cold start skips
+// the window designs altogether.  The returned references stay valid for the life of the process.
+class FILTER_API tap_cache
+{
+public:
+    static const std::vector<float>& low_pass(
+        double gain,
+        double sampling_freq,
+        double cutoff_freq,
+        double transition_width,
+        firdes::win_type window = firdes::WIN_HAMMING,
+        double beta = 6.76);
+
+    static const std::vector<float>& low_pass_2(
+        double gain,
+        double sampling_freq,
+        double cutoff_freq,
+        double transition_width,
+        double attenuation_dB,
+        firdes::win_type window = firdes::WIN_HAMMING,
+        double beta = 6.76);
+
+    static const std::vector<gr_complex>& complex_band_pass(
+        double gain,
+        double sampling_freq,
+        double low_cutoff_freq,
+        double high_cutoff_freq,
+        double transition_width,
+        firdes::win_type window = firdes::WIN_HAMMING,
+        double beta = 6.76);
+
+    static const std::vector<float>& root_raised_cosine(
+        double gain,
+        double sampling_freq,
+        double symbol_rate,
+        double alpha,
+        int ntaps);
+
+    static bool load(const std::string &path);
+    static bool save(const std::string &path);
+    static bool modified();
+
+    static void get_stats(unsigned int &hits, unsigned int &misses, double &design_ms);
+};
+
+} // namespace filter
+} // namespace gr
+
+#endif
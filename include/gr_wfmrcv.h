@@ -13,21 +13,27 @@
 #include <gnuradio/analog/quadrature_demod_cf.h>
 #include <gnuradio/filter/fir_filter_fff.h>
 
-#include "gr_fm_deemph.h" 
+#include "gr_block_list.h"
+#include "gr_fm_deemph.h"
+#include "gr_fm_demod_fused.h"
 
 namespace gr
 {
 namespace analog
 {
 
-class ANALOG_API wfmrcv : public hier_block2
+// Mono wideband FM receiver.  Both outputs run at quad_rate / audio_decimation:
+//   out 0: de-emphasized mono audio
+//   out 1: raw MPX (the low-passed discriminator output), for rds_receiver and the stereo decoder
+class ANALOG_API wfmrcv : public hier_block2, public gr::block_list
 {
 public:
     typedef boost::shared_ptr<wfmrcv> sptr;
 
     static sptr make(
         float quad_rate,
-        float audio_decimation);
+        float audio_decimation,
+        bool fused = false);
 
     ~wfmrcv();
 
@@ -35,16 +41,19 @@ private:
     wfmrcv(void) {}
     wfmrcv(
         float quad_rate,
-        float audio_decimation);
+        float audio_decimation,
+        bool fused);
 
     void init_block(
         float quad_rate,
-        float audio_decimation);
+        float audio_decimation,
+        bool fused);
 
     quadrature_demod_cf::sptr fm_demod;
     fm_deemph::sptr deemph;
     std::vector<float> audio_coeffs;
     gr::filter::fir_filter_fff::sptr audio_filter;
+    fm_demod_fused_cf::sptr fused_demod;
 };
 
 } // namespace analog
@@ -0,0 +1,64 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#ifndef INCLUDED_GR_RUNTIME_WFMRCV_STEREO_H
+#define INCLUDED_GR_RUNTIME_WFMRCV_STEREO_H
+
+#include <gnuradio/analog/api.h>
+#include <gnuradio/hier_block2.h>
+#include <gnuradio/analog/pll_refout_cc.h>
+#include <gnuradio/filter/fir_filter_fcc.h>
+
+#include "gr_block_list.h"
+#include "gr_wfmrcv.h"
+#include "gr_stereo_demod.h"
+
+namespace gr
+{
+namespace analog
+{
+
+// Stereo version of wfmrcv, built on its MPX output.  A PLL locks to the 19 kHz pilot and its harmonics demodulate L-R
+// from 38 kHz and bring RDS down from 57 kHz.  L-R is blended towards mono when the pilot is weak
+// or the PLL isn't locked, see stereo_demod.  All outputs run at quad_rate / audio_decimation:
+//   out 0: mono audio, the same signal wfmrcv produces
+//   out 1: left audio
+//   out 2: right audio
+//   out 3: RDS subcarrier at complex baseband, for rds_receiver::make(true)
+//   out 4: raw MPX, as out 1 of wfmrcv
+class ANALOG_API wfmrcv_stereo : public hier_block2, public gr::block_list
+{
+public:
+    typedef boost::shared_ptr<wfmrcv_stereo> sptr;
+
+    static sptr make(
+        float quad_rate,
+        float audio_decimation);
+
+    ~wfmrcv_stereo();
+
+private:
+    wfmrcv_stereo(void) {}
+    wfmrcv_stereo(
+        float quad_rate,
+        float audio_decimation);
+
+    void init_block(
+        float quad_rate,
+        float audio_decimation);
+
+    wfmrcv::sptr mono;
+    std::vector<gr_complex> pilot_coeffs;
+    gr::filter::fir_filter_fcc::sptr pilot_filter;
+    pll_refout_cc::sptr pilot_pll;
+    stereo_demod::sptr demod;
+};
+
+} // namespace analog
+} // namespace gr
+
+#endif
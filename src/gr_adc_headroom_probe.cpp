@@ -0,0 +1,162 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <gnuradio/io_signature.h>
+
+#include "gr_adc_headroom_probe.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+// Share of the samples allowed above the reported peak
+const double PEAK_TAIL = 0.001;
+
+adc_headroom_probe::~adc_headroom_probe()
+{
+}
+
+// Drops the window in progress, so the next one only has samples from after e.g. a gain change.
+// Windows completed after this returns start holdoff_samples into the stream after the reset, which
+// callers size to cover the samples the dongle and the flowgraph still hold from before it.
+// @param holdoff_samples Samples to let go by before starting the next window, strided or not
+// @return seq of the last window completed before the reset, later ones only have new samples
+uint64_t adc_headroom_probe::reset(uint64_t holdoff_samples)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    _restart = true;
+    _restart_holdoff = holdoff_samples;
+    return _last.seq;
+}
+
+// Blocks until a window newer than after_seq has completed
+// @param after_seq seq of the last window the caller has seen, 0 for none
+// @param timeout_ms How long to wait
+// @param window_out Receives the newest window
+// @return false if none arrived within timeout_ms
+bool adc_headroom_probe::wait_for_window(uint64_t after_seq, unsigned int timeout_ms, headroom_window &window_out)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    if (!_window_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+            [this, after_seq] { return _last.seq > after_seq; })) {
+        return false;
+    }
+    window_out = _last;
+    return true;
+}
+
+void adc_headroom_probe::complete_window()
+{
+    unsigned int tail = (unsigned int)(_count * PEAK_TAIL);
+    unsigned int above = 0;
+    unsigned int bin = HIST_BINS - 1;
+    while (bin > 0 && above + _hist[bin] <= tail) {
+        above += _hist[bin];
+        --bin;
+    }
+    bool published = false;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        // After a reset() that came in during this call the window is from before it
+        if (!_restart) {
+            _last.peak = float(bin + 1) / HIST_BINS;
+            _last.clip_fraction = float(_hist[HIST_BINS - 1]) / _count;
+            ++_last.seq;
+            published = true;
+        }
+    }
+    if (published) {
+        _window_cv.notify_all();
+    }
+    _count = 0;
+    memset(_hist, 0, sizeof(_hist));
+}
+
+int adc_headroom_probe::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)output_items;
+    if (_restart.exchange(false)) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _count = 0;
+        memset(_hist, 0, sizeof(_hist));
+        _holdoff = _restart_holdoff;
+        _skip = 0;
+    }
+
+    unsigned int n = _skip;
+    if (_holdoff > 0) {
+        uint64_t drop = std::min<uint64_t>(_holdoff, noutput_items);
+        _holdoff -= drop;
+        if (_holdoff > 0) {
+            return noutput_items;
+        }
+        n = (unsigned int)drop;
+    }
+    if (_cu8) {
+        // 2 * x - 255 is -255..255, so the bins are 256 / HIST_BINS apart
+        const uint8_t *in = (const uint8_t *)input_items[0];
+        for (; n < (unsigned int)noutput_items; n += _stride) {
+            int level = std::max(abs(2 * in[2 * n] - 255), abs(2 * in[2 * n + 1] - 255));
+            ++_hist[level * HIST_BINS / 256];
+            if (++_count == _window_samples) {
+                complete_window();
+            }
+        }
+    }
+    else {
+        const gr_complex *in = (const gr_complex *)input_items[0];
+        for (; n < (unsigned int)noutput_items; n += _stride) {
+            float level = std::max(fabsf(in[n].real()), fabsf(in[n].imag()));
+            ++_hist[std::min((unsigned int)(level * HIST_BINS), HIST_BINS - 1)];
+            if (++_count == _window_samples) {
+                complete_window();
+            }
+        }
+    }
+    _skip = n - noutput_items;
+    return noutput_items;
+}
+
+adc_headroom_probe::adc_headroom_probe(bool cu8, unsigned int stride, unsigned int window_samples)
+    : sync_block(
+        "adc_headroom_probe",
+        io_signature::make(1, 1, cu8 ? 2 * sizeof(uint8_t) : sizeof(gr_complex)),
+        io_signature::make(0, 0, 0)),
+    _cu8(cu8),
+    _stride(std::max(stride, 1u)),
+    _window_samples(std::max(window_samples, 1u)),
+    _skip(0),
+    _count(0),
+    _holdoff(0),
+    _restart(false),
+    _restart_holdoff(0)
+{
+    memset(_hist, 0, sizeof(_hist));
+    _last.seq = 0;
+    _last.peak = 0.0f;
+    _last.clip_fraction = 0.0f;
+}
+
+// @param cu8 true for rtl_cu8_source's items, false for complex floats
+// @param stride Looks at one sample in this many
+// @param window_samples Samples looked at per window
+adc_headroom_probe::sptr adc_headroom_probe::make(bool cu8, unsigned int stride, unsigned int window_samples)
+{
+    return gnuradio::get_initial_sptr(new adc_headroom_probe(cu8, stride, window_samples));
+}
+
+} // namespace blocks
+} // namespace gr
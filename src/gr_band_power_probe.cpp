@@ -0,0 +1,191 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <chrono>
+#include <cmath>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/fft/window.h>
+
+#include "gr_band_power_probe.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace fft
+{
+
+band_power_probe::~band_power_probe()
+{
+}
+
+// Turns spectrum accumulation on or off.  While disabled the probe just consumes its input,
+// so it costs next to nothing when no scan is running.
+void band_power_probe::set_enabled(bool enabled)
+{
+    _restart = true;
+    _enabled = enabled;
+}
+
+// Throws away the accumulated spectrum, e.g. after the tuner has been moved to a new window
+void band_power_probe::reset()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    std::fill(_power_sum.begin(), _power_sum.end(), 0.0f);
+    _num_frames = 0;
+    _restart = true;
+}
+
+// Blocks until at least num_frames FFT frames have been accumulated since the last reset()
+// @return false if the frames did not arrive within timeout_ms
+bool band_power_probe::wait_for_frames(unsigned int num_frames, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    return _frame_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [this, num_frames] { return _num_frames >= num_frames; });
+}
+
+// Prepares wait_for_retune() to wait for the retune tag of freq_hz.  Call before retuning.
+void band_power_probe::arm_retune(double freq_hz)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    _armed_freq_hz = freq_hz;
+    _retune_seen = false;
+}
+
+// Blocks until the first sample at the frequency given to arm_retune() has reached the probe.
+// Accumulation is restarted at that sample.
+// @return false if the retune tag did not arrive within timeout_ms
+bool band_power_probe::wait_for_retune(unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    return _frame_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [this] { return _retune_seen; });
+}
+
+// Gets the average power per FFT bin since the last reset(), with DC in the middle bin
+// (i.e. index fft_size / 2 is the tuner center frequency)
+std::vector<float> band_power_probe::get_spectrum()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    std::vector<float> spectrum(_power_sum);
+    if (_num_frames > 0) {
+        for (float &bin : spectrum) {
+            bin /= _num_frames;
+        }
+    }
+    return spectrum;
+}
+
+unsigned int band_power_probe::fft_size() const
+{
+    return _fft_size;
+}
+
+void band_power_probe::accumulate_frame()
+{
+    _fft->execute();
+    const gr_complex *out = _fft->get_outbuf();
+    unsigned int half = _fft_size / 2;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_restart) {
+            // Frame started before a reset(), it may contain samples from the previous window
+            return;
+        }
+        for (unsigned int i = 0; i < _fft_size; ++i) {
+            // fftshift while accumulating so the spectrum runs from -fs/2 to +fs/2
+            _power_sum[(i + half) % _fft_size] += std::norm(out[i]);
+        }
+        ++_num_frames;
+    }
+    _frame_cv.notify_all();
+}
+
+void band_power_probe::handle_retune(const tag_t &tag)
+{
+    _fill = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (std::abs(pmt::to_double(tag.value) - _armed_freq_hz) > 1.0) {
+            return;
+        }
+        std::fill(_power_sum.begin(), _power_sum.end(), 0.0f);
+        _num_frames = 0;
+        _retune_seen = true;
+    }
+    _frame_cv.notify_all();
+}
+
+void band_power_probe::accumulate(const gr_complex *in, int num_items)
+{
+    gr_complex *fft_in = _fft->get_inbuf();
+    for (int i = 0; i < num_items; ++i) {
+        fft_in[_fill] = in[i] * _window[_fill];
+        if (++_fill == _fft_size) {
+            accumulate_frame();
+            _fill = 0;
+        }
+    }
+}
+
+int band_power_probe::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)output_items;
+    if (!_enabled) {
+        return noutput_items;
+    }
+    if (_restart.exchange(false)) {
+        _fill = 0;
+    }
+
+    const gr_complex *in = (const gr_complex *)input_items[0];
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, blocks::retune_tagger_cc::retune_key());
+    int done = 0;
+    for (const tag_t &tag : _tags) {
+        int tag_index = int(tag.offset - first);
+        accumulate(in + done, tag_index - done);
+        handle_retune(tag);
+        done = tag_index;
+    }
+    accumulate(in + done, noutput_items - done);
+    return noutput_items;
+}
+
+void band_power_probe::init_block(unsigned int fft_size)
+{
+    _fft_size = fft_size;
+    _window = window::blackmanharris(fft_size);
+    _fft.reset(new fft_complex(fft_size, true, 1));
+    _fill = 0;
+    _enabled = false;
+    _restart = false;
+    _power_sum.assign(fft_size, 0.0f);
+    _num_frames = 0;
+    _armed_freq_hz = 0.0;
+    _retune_seen = false;
+}
+
+band_power_probe::band_power_probe(unsigned int fft_size)
+    : sync_block(
+        "band_power_probe",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::make(0, 0, 0))
+{
+    init_block(fft_size);
+}
+
+band_power_probe::sptr band_power_probe::make(unsigned int fft_size)
+{
+    return gnuradio::get_initial_sptr(new band_power_probe(fft_size));
+}
+
+} // namespace fft
+} // namespace gr
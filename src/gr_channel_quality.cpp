@@ -0,0 +1,219 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <gnuradio/io_signature.h>
+
+#include "gr_channel_quality.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace analog
+{
+
+const double PILOT_FREQ = 19e3;
+const double NOISE_OFFSET = 2e3;         // noise is measured this far either side of the pilot
+const double DETECTOR_BW = 25.0;         // noise bandwidth of each tone detector, Hz
+const double DETECTOR_SETTLE = 6.0;      // pole time constants before the detectors' output is used
+const unsigned int POWER_DECIM = 16;     // MPX samples per update of the detector powers
+const double POWER_TAU_S = 0.2;          // the powers become a one pole average after this long
+const double AUDIO_BW = 15e3;            // bandwidth the SNR is quoted in
+const double FULL_DEVIATION_POWER = 0.5; // a sine at +-1.0
+const double MIN_POWER = 1e-20;          // floor for the logarithms
+
+channel_quality::~channel_quality()
+{
+}
+
+// Starts all the measurements over, e.g. after a retune whose tag has already gone by
+void channel_quality::reset()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    _restart = true;
+    _metrics = channel_metrics();
+}
+
+// Blocks until at least seconds of MPX have been measured since the last restart
+// @return false if they didn't arrive within timeout_ms
+bool channel_quality::wait_for_mpx(double seconds, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    return _mpx_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [this, seconds] { return _metrics.mpx_seconds >= seconds; });
+}
+
+void channel_quality::get_metrics(channel_metrics &metrics_out)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    metrics_out = _metrics;
+}
+
+void channel_quality::restart_iq()
+{
+    _rssi_n = 0;
+    _rssi_sum = 0.0;
+}
+
+void channel_quality::restart_mpx()
+{
+    _mpx_n = 0;
+    _power_n = 0;
+    for (tone_detector &tone : _tones) {
+        tone.phasor = gr_complex(1.0f, 0.0f);
+        tone.acc1 = gr_complex(0.0f, 0.0f);
+        tone.acc = gr_complex(0.0f, 0.0f);
+        tone.power = 0.0;
+    }
+}
+
+void channel_quality::measure_iq(const gr_complex *in, int num_items)
+{
+    for (int i = 0; i < num_items; ++i) {
+        _rssi_sum += std::norm(in[i]);
+    }
+    _rssi_n += num_items;
+}
+
+void channel_quality::measure_mpx(const float *in, int num_items)
+{
+    uint64_t settle = uint64_t(DETECTOR_SETTLE / _detector_alpha);
+    double power_alpha = POWER_DECIM / (POWER_TAU_S * _mpx_rate);
+    for (int i = 0; i < num_items; ++i) {
+        for (tone_detector &tone : _tones) {
+            tone.acc1 += _detector_alpha * (in[i] * tone.phasor - tone.acc1);
+            tone.acc += _detector_alpha * (tone.acc1 - tone.acc);
+            tone.phasor *= tone.step;
+        }
+        if (++_mpx_n % POWER_DECIM != 0 || _mpx_n < settle) {
+            continue;
+        }
+        // A plain mean to begin with, so the first estimates aren't dragged towards 0
+        double alpha = std::max(1.0 / ++_power_n, power_alpha);
+        for (tone_detector &tone : _tones) {
+            tone.power += alpha * (std::norm(tone.acc) - tone.power);
+        }
+    }
+    // Keeps the phasors on the unit circle
+    for (tone_detector &tone : _tones) {
+        tone.phasor /= std::abs(tone.phasor);
+    }
+}
+
+// Turns the running sums into the metrics other threads read
+void channel_quality::publish()
+{
+    channel_metrics metrics;
+    metrics.rssi_dbfs = _rssi_n > 0 ? 10.0 * log10(std::max(_rssi_sum / _rssi_n, MIN_POWER)) : 0.0;
+    metrics.mpx_seconds = _mpx_n / _mpx_rate;
+    metrics.snr_db = 0.0;
+    metrics.pilot_snr_db = 0.0;
+    if (_power_n > 0) {
+        // The detectors keep _detector_gain of white noise's power, which gives the noise density
+        // around the pilot.  FM noise rises with f^2, so the 0-15 kHz audio only has the integral of
+        // density * (f / 19 kHz)^2 over it, (15k)^3 / (3 * (19k)^2) Hz worth of the pilot's density.
+        double noise_bin = std::max((_tones[0].power + _tones[2].power) / 2.0, MIN_POWER);
+        double noise_density = noise_bin / _detector_gain / (_mpx_rate / 2.0);
+        double noise_audio = noise_density * AUDIO_BW * AUDIO_BW * AUDIO_BW / (3.0 * PILOT_FREQ * PILOT_FREQ);
+        double pilot = std::max(_tones[1].power - noise_bin, MIN_POWER);
+        metrics.snr_db = 10.0 * log10(FULL_DEVIATION_POWER / noise_audio);
+        metrics.pilot_snr_db = 10.0 * log10(pilot / noise_bin);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_restart) {
+            // reset() came in during this call, these sums are from before it
+            return;
+        }
+        _metrics = metrics;
+    }
+    _mpx_cv.notify_all();
+}
+
+// Either input is worked on as soon as it has samples, whatever the other one has
+void channel_quality::forecast(int noutput_items, gr_vector_int &ninput_items_required)
+{
+    (void)noutput_items;
+    std::fill(ninput_items_required.begin(), ninput_items_required.end(), 0);
+}
+
+int channel_quality::general_work(
+    int noutput_items,
+    gr_vector_int &ninput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)noutput_items;
+    (void)output_items;
+    if (_restart.exchange(false)) {
+        restart_iq();
+        restart_mpx();
+    }
+
+    const gr_complex *iq = (const gr_complex *)input_items[0];
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + ninput_items[0], blocks::retune_tagger_cc::retune_key());
+    int done = 0;
+    for (const tag_t &tag : _tags) {
+        int tag_index = int(tag.offset - first);
+        measure_iq(iq + done, tag_index - done);
+        restart_iq();
+        done = tag_index;
+    }
+    measure_iq(iq + done, ninput_items[0] - done);
+    consume(0, ninput_items[0]);
+
+    const float *mpx = (const float *)input_items[1];
+    first = nitems_read(1);
+    get_tags_in_range(_tags, 1, first, first + ninput_items[1], blocks::retune_tagger_cc::retune_key());
+    done = 0;
+    for (const tag_t &tag : _tags) {
+        int tag_index = int(tag.offset - first);
+        measure_mpx(mpx + done, tag_index - done);
+        restart_mpx();
+        done = tag_index;
+    }
+    measure_mpx(mpx + done, ninput_items[1] - done);
+    consume(1, ninput_items[1]);
+
+    publish();
+    return 0;
+}
+
+channel_quality::channel_quality(double mpx_rate)
+    : block(
+        "channel_quality",
+        io_signature::makev(2, 2, std::vector<int>{sizeof(gr_complex), sizeof(float)}),
+        io_signature::make(0, 0, 0)),
+    _mpx_rate(mpx_rate),
+    _restart(false)
+{
+    // Two one poles in a row pass alpha^4 (1 + p^2) / (1 - p^2)^3 of white noise's power, p = 1 - alpha.
+    // About alpha / 4, which over the rate / 2 of the MPX band is a noise bandwidth of alpha * rate / 8.
+    _detector_alpha = float(8.0 * DETECTOR_BW / mpx_rate);
+    double p2 = (1.0 - _detector_alpha) * (1.0 - _detector_alpha);
+    _detector_gain = pow(_detector_alpha, 4) * (1.0 + p2) / pow(1.0 - p2, 3);
+    const double freqs[3] = {PILOT_FREQ - NOISE_OFFSET, PILOT_FREQ, PILOT_FREQ + NOISE_OFFSET};
+    for (unsigned int i = 0; i < 3; ++i) {
+        double w = 2.0 * M_PI * freqs[i] / mpx_rate;
+        _tones[i].step = gr_complex(float(cos(w)), float(-sin(w)));
+    }
+    restart_iq();
+    restart_mpx();
+    _metrics = channel_metrics();
+}
+
+// @param mpx_rate Rate of the MPX, input 1.  The RSSI doesn't depend on the rate of input 0.
+channel_quality::sptr channel_quality::make(double mpx_rate)
+{
+    return gnuradio::get_initial_sptr(new channel_quality(mpx_rate));
+}
+
+} // namespace analog
+} // namespace gr
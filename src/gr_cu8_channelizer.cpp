@@ -0,0 +1,246 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <gnuradio/io_signature.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CU8_X86_KERNELS
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "gr_cu8_channelizer.h"
+#include "gr_fm_channelizer.h"
+
+namespace gr
+{
+namespace filter
+{
+
+// The dot product works on this many taps at a time
+const unsigned int TAP_BLOCK = 16;
+
+// 2 * x - 255 puts a cu8 sample in -255..255 without losing the half LSB offset of the RTL's zero
+const int SAMPLE_MAX = 255;
+
+// The dot products below are the sum of x[j] * h[j] for j < n, n a multiple of TAP_BLOCK.  The tap
+// scaling keeps every partial sum inside 32 bits.
+
+static int32_t dot_s16_scalar(const int16_t *x, const int16_t *h, unsigned int n)
+{
+    int32_t acc = 0;
+    for (unsigned int j = 0; j < n; ++j) {
+        acc += int32_t(x[j]) * h[j];
+    }
+    return acc;
+}
+
+#if defined(CU8_X86_KERNELS)
+// The x86 kernels are compiled for their instruction set whatever the build targets, the one to use
+// is picked at runtime.  SSE2 is in every x86-64.
+__attribute__((target("sse2")))
+static int32_t dot_s16_sse2(const int16_t *x, const int16_t *h, unsigned int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (unsigned int j = 0; j < n; j += 8) {
+        __m128i xv = _mm_loadu_si128((const __m128i *)(x + j));
+        __m128i hv = _mm_loadu_si128((const __m128i *)(h + j));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(xv, hv));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_s16_avx2(const int16_t *x, const int16_t *h, unsigned int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (unsigned int j = 0; j < n; j += TAP_BLOCK) {
+        __m256i xv = _mm256_loadu_si256((const __m256i *)(x + j));
+        __m256i hv = _mm256_loadu_si256((const __m256i *)(h + j));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(xv, hv));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+#elif defined(__ARM_NEON)
+static int32_t dot_s16_neon(const int16_t *x, const int16_t *h, unsigned int n)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    for (unsigned int j = 0; j < n; j += 8) {
+        int16x8_t xv = vld1q_s16(x + j);
+        int16x8_t hv = vld1q_s16(h + j);
+        acc = vmlal_s16(acc, vget_low_s16(xv), vget_low_s16(hv));
+        acc = vmlal_s16(acc, vget_high_s16(xv), vget_high_s16(hv));
+    }
+#if defined(__aarch64__)
+    return vaddvq_s32(acc);
+#else
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#endif
+}
+#endif
+
+// @param kernel A kernel, or cu8_kernel::AUTO
+// @return true if this build has the kernel and the CPU runs it
+bool cu8_channelizer::kernel_available(cu8_kernel kernel)
+{
+    switch (kernel) {
+    case cu8_kernel::AUTO:
+    case cu8_kernel::SCALAR:
+        return true;
+#if defined(CU8_X86_KERNELS)
+    case cu8_kernel::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case cu8_kernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#elif defined(__ARM_NEON)
+    case cu8_kernel::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+// @return the fastest kernel this build and CPU have
+static cu8_kernel best_kernel()
+{
+    const cu8_kernel order[] = {cu8_kernel::AVX2, cu8_kernel::NEON, cu8_kernel::SSE2};
+    for (cu8_kernel kernel : order) {
+        if (cu8_channelizer::kernel_available(kernel)) {
+            return kernel;
+        }
+    }
+    return cu8_kernel::SCALAR;
+}
+
+static cu8_channelizer::dot_s16_fn kernel_function(cu8_kernel kernel)
+{
+    switch (kernel) {
+#if defined(CU8_X86_KERNELS)
+    case cu8_kernel::SSE2:
+        return dot_s16_sse2;
+    case cu8_kernel::AVX2:
+        return dot_s16_avx2;
+#elif defined(__ARM_NEON)
+    case cu8_kernel::NEON:
+        return dot_s16_neon;
+#endif
+    default:
+        return dot_s16_scalar;
+    }
+}
+
+cu8_channelizer::~cu8_channelizer()
+{
+}
+
+int cu8_channelizer::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    const uint8_t *in = (const uint8_t *)input_items[0];
+    gr_complex *out = (gr_complex *)output_items[0];
+    unsigned int decim = decimation();
+    unsigned int ntaps = _taps_rev.size();
+    unsigned int hist = ntaps - 1;
+    unsigned int ninput = noutput_items * decim;
+
+    // Split into I and Q so both filters read contiguous int16s
+    _i.resize(hist + ninput);
+    _q.resize(hist + ninput);
+    int16_t *i_new = &_i[hist];
+    int16_t *q_new = &_q[hist];
+    for (unsigned int n = 0; n < ninput; ++n) {
+        i_new[n] = int16_t(2 * in[2 * n] - SAMPLE_MAX);
+        q_new[n] = int16_t(2 * in[2 * n + 1] - SAMPLE_MAX);
+    }
+
+    // Output k ends on input k * decim, like fir_filter_ccf
+    for (int k = 0; k < noutput_items; ++k) {
+        int32_t i_acc = _dot(&_i[k * decim], &_taps_rev[0], ntaps);
+        int32_t q_acc = _dot(&_q[k * decim], &_taps_rev[0], ntaps);
+        out[k] = gr_complex(i_acc * _out_scale, q_acc * _out_scale);
+    }
+
+    memmove(&_i[0], &_i[ninput], hist * sizeof(int16_t));
+    memmove(&_q[0], &_q[ninput], hist * sizeof(int16_t));
+    return noutput_items;
+}
+
+cu8_channelizer::cu8_channelizer(
+    double samp_rate,
+    unsigned int decimation,
+    double channel_bw,
+    cu8_kernel kernel)
+    : sync_decimator(
+        "cu8_channelizer",
+        io_signature::make(1, 1, 2 * sizeof(uint8_t)),
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        decimation)
+{
+    if (!kernel_available(kernel)) {
+        throw std::runtime_error("cu8_channelizer kernel is not supported by this build or CPU.");
+    }
+    _kernel = kernel == cu8_kernel::AUTO ? best_kernel() : kernel;
+    _dot = kernel_function(_kernel);
+
+    const std::vector<float> &taps = fm_channelizer::design_taps(samp_rate, decimation, channel_bw);
+
+    // Largest scale that keeps every tap in an int16 and the accumulator in an int32 for any input,
+    // with a factor of two to spare for the rounding
+    double max_tap = 0.0;
+    double sum_taps = 0.0;
+    for (float tap : taps) {
+        max_tap = std::max(max_tap, double(fabs(tap)));
+        sum_taps += fabs(tap);
+    }
+    if (max_tap == 0.0) {
+        throw std::runtime_error("cu8_channelizer needs a non-zero channel filter.");
+    }
+    double scale = std::min(INT16_MAX / max_tap, double(1 << 30) / (SAMPLE_MAX * sum_taps));
+
+    unsigned int padded = (taps.size() + TAP_BLOCK - 1) / TAP_BLOCK * TAP_BLOCK;
+    _taps_rev.assign(padded - taps.size(), 0);
+    for (auto it = taps.rbegin(); it != taps.rend(); ++it) {
+        _taps_rev.push_back(int16_t(lround(*it * scale)));
+    }
+    // The samples are 2 * (x - 127.5), so a further 1 / 256 gives about gr-osmosdr's (x - 127.4) / 128
+    _out_scale = float(1.0 / (scale * 256.0));
+    _i.assign(padded - 1, 0);
+    _q.assign(padded - 1, 0);
+}
+
+// @return the dot product kernel in use, never cu8_kernel::AUTO
+cu8_kernel cu8_channelizer::kernel() const
+{
+    return _kernel;
+}
+
+// @param kernel Dot product to use, AUTO for the fastest one the CPU runs.  Throws if the build or
+//               the CPU doesn't have it, see kernel_available.
+cu8_channelizer::sptr cu8_channelizer::make(
+    double samp_rate,
+    unsigned int decimation,
+    double channel_bw,
+    cu8_kernel kernel)
+{
+    return gnuradio::get_initial_sptr(new cu8_channelizer(samp_rate, decimation, channel_bw, kernel));
+}
+
+} // namespace filter
+} // namespace gr
@@ -0,0 +1,501 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <FLAC/stream_encoder.h>
+#include <opusenc.h>
+
+#include <gnuradio/io_signature.h>
+
+#include "gr_encoded_audio_sink.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+// Encoded data is collected and written in pieces of this size, at this alignment
+const size_t WRITE_CHUNK_BYTES = 1 << 20;
+const size_t WRITE_ALIGNMENT = 4096;
+
+// How often the encoder thread empties the queue
+const int ENCODER_POLL_MS = 20;
+
+const unsigned int FLAC_COMPRESSION_LEVEL = 5;
+const float FLAC_SCALE = 32767.0f;
+
+// Encodes interleaved float frames into one file at a time
+class audio_encoder
+{
+public:
+    audio_encoder(unsigned int channels, unsigned int sample_rate)
+        : _channels(channels),
+        _sample_rate(sample_rate),
+        _fd(-1),
+        _buf(NULL),
+        _buf_len(0)
+    {
+    }
+
+    virtual ~audio_encoder()
+    {
+        free(_buf);
+    }
+
+    virtual const char *extension() const = 0;
+
+    // @param path The file to write, replaced if it exists
+    // @return false if it could not be created or the encoder could not be set up
+    bool open(const std::string &path)
+    {
+        if (_buf == NULL && posix_memalign((void **)&_buf, WRITE_ALIGNMENT, WRITE_CHUNK_BYTES) != 0) {
+            _buf = NULL;
+            return false;
+        }
+        _fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+        if (_fd < 0) {
+            return false;
+        }
+        _buf_len = 0;
+        if (!begin()) {
+            ::close(_fd);
+            _fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const float *frames, size_t num_frames)
+    {
+        return _fd >= 0 && encode(frames, num_frames);
+    }
+
+    // Writes out what is collected so far, e.g. when the flowgraph stops
+    bool flush()
+    {
+        if (_fd < 0 || _buf_len == 0) {
+            return true;
+        }
+        bool ok = write_all(_buf, _buf_len);
+        _buf_len = 0;
+        return ok;
+    }
+
+    // Finishes the stream and closes the file
+    bool close()
+    {
+        if (_fd < 0) {
+            return true;
+        }
+        bool ok = end();
+        ok = flush() && ok;
+        ok = (::close(_fd) == 0) && ok;
+        _fd = -1;
+        return ok;
+    }
+
+protected:
+    virtual bool begin() = 0;
+    virtual bool encode(const float *frames, size_t num_frames) = 0;
+    virtual bool end() = 0;
+
+    // Takes encoded data from the codec.  Only whole chunks go to the file until flush().
+    bool append(const uint8_t *data, size_t len)
+    {
+        bool ok = true;
+        while (len > 0) {
+            size_t n = std::min(len, WRITE_CHUNK_BYTES - _buf_len);
+            memcpy(_buf + _buf_len, data, n);
+            _buf_len += n;
+            data += n;
+            len -= n;
+            if (_buf_len == WRITE_CHUNK_BYTES) {
+                ok = write_all(_buf, _buf_len) && ok;
+                _buf_len = 0;
+            }
+        }
+        return ok;
+    }
+
+    unsigned int _channels;
+    unsigned int _sample_rate;
+
+private:
+    bool write_all(const uint8_t *data, size_t len)
+    {
+        while (len > 0) {
+            ssize_t n = ::write(_fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    int _fd;
+    uint8_t *_buf;
+    size_t _buf_len;
+};
+
+// 16 bit FLAC.  The stream isn't seekable, so STREAMINFO goes out without the total length; players
+// work that out from the frames.
+class flac_encoder : public audio_encoder
+{
+public:
+    flac_encoder(unsigned int channels, unsigned int sample_rate)
+        : audio_encoder(channels, sample_rate),
+        _encoder(NULL)
+    {
+    }
+
+    ~flac_encoder()
+    {
+        if (_encoder != NULL) {
+            FLAC__stream_encoder_delete(_encoder);
+        }
+    }
+
+    const char *extension() const
+    {
+        return ".flac";
+    }
+
+protected:
+    bool begin()
+    {
+        _encoder = FLAC__stream_encoder_new();
+        if (_encoder == NULL) {
+            return false;
+        }
+        FLAC__stream_encoder_set_channels(_encoder, _channels);
+        FLAC__stream_encoder_set_bits_per_sample(_encoder, 16);
+        FLAC__stream_encoder_set_sample_rate(_encoder, _sample_rate);
+        FLAC__stream_encoder_set_compression_level(_encoder, FLAC_COMPRESSION_LEVEL);
+        if (FLAC__stream_encoder_init_stream(_encoder, write_callback, NULL, NULL, NULL, this) !=
+            FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+            FLAC__stream_encoder_delete(_encoder);
+            _encoder = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    bool encode(const float *frames, size_t num_frames)
+    {
+        size_t num_samples = num_frames * _channels;
+        _samples.resize(num_samples);
+        for (size_t i = 0; i < num_samples; ++i) {
+            float value = std::max(-1.0f, std::min(1.0f, frames[i]));
+            _samples[i] = FLAC__int32(value * FLAC_SCALE);
+        }
+        return FLAC__stream_encoder_process_interleaved(_encoder, _samples.data(), num_frames);
+    }
+
+    bool end()
+    {
+        bool ok = FLAC__stream_encoder_finish(_encoder);
+        FLAC__stream_encoder_delete(_encoder);
+        _encoder = NULL;
+        return ok;
+    }
+
+private:
+    static FLAC__StreamEncoderWriteStatus write_callback(
+        const FLAC__StreamEncoder *encoder,
+        const FLAC__byte buffer[],
+        size_t bytes,
+        unsigned samples,
+        unsigned current_frame,
+        void *client_data)
+    {
+        (void)encoder;
+        (void)samples;
+        (void)current_frame;
+        flac_encoder *self = (flac_encoder *)client_data;
+        return self->append(buffer, bytes) ? FLAC__STREAM_ENCODER_WRITE_STATUS_OK : FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+
+    FLAC__StreamEncoder *_encoder;
+    std::vector<FLAC__int32> _samples;
+};
+
+// Ogg Opus through libopusenc, which resamples to Opus' 48 kHz itself if it has to
+class opus_encoder : public audio_encoder
+{
+public:
+    opus_encoder(unsigned int channels, unsigned int sample_rate, unsigned int bitrate)
+        : audio_encoder(channels, sample_rate),
+        _bitrate(bitrate),
+        _comments(NULL),
+        _encoder(NULL)
+    {
+    }
+
+    ~opus_encoder()
+    {
+        if (_encoder != NULL) {
+            ope_encoder_destroy(_encoder);
+        }
+        if (_comments != NULL) {
+            ope_comments_destroy(_comments);
+        }
+    }
+
+    const char *extension() const
+    {
+        return ".opus";
+    }
+
+protected:
+    bool begin()
+    {
+        OpusEncCallbacks callbacks = {write_callback, close_callback};
+        int error = OPE_OK;
+        _comments = ope_comments_create();
+        if (_comments == NULL) {
+            return false;
+        }
+        _encoder = ope_encoder_create_callbacks(&callbacks, this, _comments, _sample_rate, _channels, 0, &error);
+        if (_encoder == NULL || error != OPE_OK) {
+            ope_comments_destroy(_comments);
+            _comments = NULL;
+            return false;
+        }
+        if (_bitrate > 0) {
+            ope_encoder_ctl(_encoder, OPUS_SET_BITRATE(opus_int32(_bitrate)));
+        }
+        return true;
+    }
+
+    bool encode(const float *frames, size_t num_frames)
+    {
+        return ope_encoder_write_float(_encoder, frames, int(num_frames)) == OPE_OK;
+    }
+
+    bool end()
+    {
+        bool ok = ope_encoder_drain(_encoder) == OPE_OK;
+        ope_encoder_destroy(_encoder);
+        ope_comments_destroy(_comments);
+        _encoder = NULL;
+        _comments = NULL;
+        return ok;
+    }
+
+private:
+    static int write_callback(void *user_data, const unsigned char *ptr, opus_int32 len)
+    {
+        opus_encoder *self = (opus_encoder *)user_data;
+        return self->append(ptr, len) ? 0 : 1;
+    }
+
+    static int close_callback(void *user_data)
+    {
+        (void)user_data;
+        return 0;
+    }
+
+    unsigned int _bitrate;
+    OggOpusComments *_comments;
+    OggOpusEnc *_encoder;
+};
+
+static std::string segment_path(const std::string &base_path, const audio_encoder &encoder, bool segmented, unsigned int segment)
+{
+    if (!segmented) {
+        return base_path + encoder.extension();
+    }
+    char index[16];
+    snprintf(index, sizeof(index), "-%04u", segment);
+    return base_path + index + encoder.extension();
+}
+
+encoded_audio_sink::~encoded_audio_sink()
+{
+    stop();
+    _encoder->close();
+}
+
+// @param base_path Where to write, without the extension
+// @param codec FLAC or Opus
+// @param channels Number of inputs, 1 or 2
+// @param sample_rate Rate of the inputs
+// @param bitrate Opus bitrate in bits/s, 0 for the encoder's choice.  Not used for FLAC.
+// @param segment_seconds Starts a new file this often, 0 for one file
+encoded_audio_sink::sptr encoded_audio_sink::make(
+    const std::string &base_path,
+    audio_codec codec,
+    unsigned int channels,
+    unsigned int sample_rate,
+    unsigned int bitrate,
+    unsigned int segment_seconds)
+{
+    if (channels < 1 || channels > 2 || sample_rate == 0) {
+        throw std::runtime_error("encoded_audio_sink takes 1 or 2 channels at a non-zero rate");
+    }
+    std::unique_ptr<audio_encoder> encoder;
+    if (codec == audio_codec::OPUS) {
+        encoder.reset(new opus_encoder(channels, sample_rate, bitrate));
+    }
+    else {
+        encoder.reset(new flac_encoder(channels, sample_rate));
+    }
+    std::string path = segment_path(base_path, *encoder, segment_seconds > 0, 0);
+    if (!encoder->open(path)) {
+        throw std::runtime_error("Could not start recording to " + path + ": " + strerror(errno));
+    }
+    return gnuradio::get_initial_sptr(new encoded_audio_sink(
+        std::move(encoder), base_path, channels, sample_rate, segment_seconds));
+}
+
+encoded_audio_sink::encoded_audio_sink(
+    std::unique_ptr<audio_encoder> encoder,
+    const std::string &base_path,
+    unsigned int channels,
+    unsigned int sample_rate,
+    unsigned int segment_seconds)
+    : sync_block("encoded_audio_sink",
+        io_signature::make(channels, channels, sizeof(float)),
+        io_signature::make(0, 0, 0)),
+    _encoder(std::move(encoder)),
+    _base_path(base_path),
+    _channels(channels),
+    _segment_frames(uint64_t(segment_seconds) * sample_rate),
+    _frames_in_segment(0),
+    _segment(0),
+    _write_pos(0),
+    _read_pos(0),
+    _dropped(0),
+    _stop_thread(false)
+{
+    _queue_frames = 1;
+    while (_queue_frames < QUEUE_SECONDS * sample_rate) {
+        _queue_frames <<= 1;
+    }
+    _queue.resize(_queue_frames * channels);
+}
+
+// Starts the encoder thread.  Called again after every rtl lock()/unlock() reconfiguration, the
+// file carries on where it was.
+bool encoded_audio_sink::start()
+{
+    _stop_thread = false;
+    _thread = std::thread(&encoded_audio_sink::encoder_thread, this);
+    return true;
+}
+
+// Encodes what's still queued and puts it on disk, but leaves the file open for a restart.  It's
+// finished when the block is destroyed.
+bool encoded_audio_sink::stop()
+{
+    if (_thread.joinable()) {
+        _stop_thread = true;
+        _thread.join();
+    }
+    drain();
+    _encoder->flush();
+    uint64_t dropped = _dropped.load();
+    if (dropped > 0) {
+        printf("Warning: encoded_audio_sink - dropped %llu frames, the encoder fell behind\n", (unsigned long long)dropped);
+    }
+    return true;
+}
+
+// @return frames lost because the encoder fell more than QUEUE_SECONDS behind
+uint64_t encoded_audio_sink::dropped_frames() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+void encoded_audio_sink::encoder_thread()
+{
+    while (!_stop_thread.load(std::memory_order_relaxed)) {
+        drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds(ENCODER_POLL_MS));
+    }
+}
+
+// Encodes everything in the queue, in at most two pieces where it wraps
+void encoded_audio_sink::drain()
+{
+    uint64_t read = _read_pos.load(std::memory_order_relaxed);
+    uint64_t write = _write_pos.load(std::memory_order_acquire);
+    while (read < write) {
+        size_t start = read & (_queue_frames - 1);
+        size_t n = std::min(size_t(write - read), _queue_frames - start);
+        encode(&_queue[start * _channels], n);
+        read += n;
+        _read_pos.store(read, std::memory_order_release);
+    }
+}
+
+// Passes frames to the encoder, starting a new file at each segment boundary
+void encoded_audio_sink::encode(const float *frames, size_t num_frames)
+{
+    while (num_frames > 0) {
+        size_t n = num_frames;
+        if (_segment_frames > 0) {
+            n = std::min(n, size_t(_segment_frames - _frames_in_segment));
+        }
+        if (!_encoder->write(frames, n)) {
+            _dropped += n;
+        }
+        frames += n * _channels;
+        num_frames -= n;
+        _frames_in_segment += n;
+
+        if (_segment_frames > 0 && _frames_in_segment == _segment_frames) {
+            _encoder->close();
+            ++_segment;
+            _frames_in_segment = 0;
+            std::string path = segment_path(_base_path, *_encoder, true, _segment);
+            if (!_encoder->open(path)) {
+                printf("Error: encoded_audio_sink - could not start %s: %s\n", path.c_str(), strerror(errno));
+            }
+        }
+    }
+}
+
+int encoded_audio_sink::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)output_items;
+    uint64_t write = _write_pos.load(std::memory_order_relaxed);
+    uint64_t read = _read_pos.load(std::memory_order_acquire);
+    size_t space = _queue_frames - size_t(write - read);
+    size_t n = std::min(size_t(noutput_items), space);
+    _dropped += noutput_items - n;
+
+    for (size_t i = 0; i < n; ++i) {
+        float *frame = &_queue[((write + i) & (_queue_frames - 1)) * _channels];
+        for (unsigned int c = 0; c < _channels; ++c) {
+            frame[c] = ((const float *)input_items[c])[i];
+        }
+    }
+    _write_pos.store(write + n, std::memory_order_release);
+    return noutput_items;
+}
+
+} // namespace blocks
+} // namespace gr
@@ -0,0 +1,100 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <cmath>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/filter/fir_filter_ccf.h>
+#include <gnuradio/filter/fft_filter_ccf.h>
+
+#include "gr_fm_channelizer.h"
+#include "gr_tap_cache.h"
+
+namespace gr
+{
+namespace filter
+{
+
+// Above this many taps the FFT filter is cheaper per output than the direct form FIR
+const unsigned int FFT_FILTER_MIN_TAPS = 64;
+
+fm_channelizer::~fm_channelizer()
+{
+}
+
+// Picks the smallest decimation that brings samp_rate down to at most max_quad_rate.
+// Decimations that give a quadrature rate which is a whole multiple of rate_step are preferred,
+// so the audio resampler further down gets an exact ratio.
+// @return the decimation, at least 1
+unsigned int fm_channelizer::choose_decimation(double samp_rate, double max_quad_rate, double rate_step)
+{
+    unsigned int min_dec = std::max(1u, (unsigned int)ceil(samp_rate / max_quad_rate - 1e-9));
+    for (unsigned int dec = min_dec; dec < 4 * min_dec; ++dec) {
+        double quad_rate = samp_rate / dec;
+        if (fabs(quad_rate / rate_step - round(quad_rate / rate_step)) < 1e-9) {
+            return dec;
+        }
+    }
+    return min_dec;
+}
+
+const std::vector<float>& fm_channelizer::taps() const
+{
+    return _taps;
+}
+
+// Designs the channel filter, shared with cu8_channelizer
+// @param samp_rate Input rate
+// @param decimation Input rate to quadrature rate
+// @param channel_bw Width of the channel kept
+const std::vector<float>& fm_channelizer::design_taps(double samp_rate, unsigned int decimation, double channel_bw)
+{
+    if (decimation < 1) {
+        throw std::runtime_error("Channelizer decimation must be at least 1.");
+    }
+    double quad_rate = samp_rate / decimation;
+    double cutoff = channel_bw / 2.0;
+    if (cutoff >= quad_rate / 2.0) {
+        throw std::runtime_error("Channel bandwidth must be below the quadrature rate.");
+    }
+    // Let the transition band run all the way to the quadrature Nyquist rate: nothing that
+    // aliases back after decimation can land inside the channel
+    double transition = quad_rate / 2.0 - cutoff;
+    return tap_cache::low_pass(1.0, samp_rate, cutoff, transition, firdes::WIN_HAMMING);
+}
+
+void fm_channelizer::init_block(double samp_rate, unsigned int decimation, double channel_bw)
+{
+    _taps = design_taps(samp_rate, decimation, channel_bw);
+
+    gr::basic_block_sptr filt;
+    if (_taps.size() >= FFT_FILTER_MIN_TAPS) {
+        filt = fft_filter_ccf::make(decimation, _taps);
+    }
+    else {
+        filt = fir_filter_ccf::make(decimation, _taps);
+    }
+    connect(self(), 0, filt, 0);
+    connect(filt, 0, self(), 0);
+    add_inner_blocks({filt});
+}
+
+fm_channelizer::fm_channelizer(double samp_rate, unsigned int decimation, double channel_bw)
+    : hier_block2(
+        "fm_channelizer",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::make(1, 1, sizeof(gr_complex)))
+{
+    init_block(samp_rate, decimation, channel_bw);
+}
+
+fm_channelizer::sptr fm_channelizer::make(double samp_rate, unsigned int decimation, double channel_bw)
+{
+    return gnuradio::get_initial_sptr(new fm_channelizer(samp_rate, decimation, channel_bw));
+}
+
+} // namespace filter
+} // namespace gr
@@ -5,13 +5,67 @@
 //
 // Author: Jason Anderson (jander10@jaguarlandrover.com)
 
+#include <algorithm>
+#include <gnuradio/io_signature.h>
+
 #include "gr_fm_deemph.h"
+#include "gr_retune_tagger.h"
 
 namespace gr
 {
 namespace analog
 {
 
+deemph_ff::~deemph_ff()
+{
+}
+
+int deemph_ff::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    const float *in = (const float *)input_items[0];
+    float *out = (float *)output_items[0];
+
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, blocks::retune_tagger_cc::retune_key());
+    std::sort(_tags.begin(), _tags.end(), tag_t::offset_compare);
+    std::vector<tag_t>::const_iterator tag = _tags.begin();
+    for (int i = 0; i < noutput_items; ++i) {
+        for (; tag != _tags.end() && tag->offset == first + i; ++tag) {
+            _prev_in = 0.0;
+            _prev_out = 0.0;
+        }
+        double y = _b0 * in[i] + _b1 * _prev_in - _a1 * _prev_out;
+        _prev_in = in[i];
+        _prev_out = y;
+        out[i] = float(y);
+    }
+    return noutput_items;
+}
+
+deemph_ff::deemph_ff(const std::vector<double> &btaps, const std::vector<double> &ataps)
+    : sync_block(
+        "deemph_ff",
+        io_signature::make(1, 1, sizeof(float)),
+        io_signature::make(1, 1, sizeof(float))),
+    _prev_in(0.0),
+    _prev_out(0.0)
+{
+    if (btaps.size() != 2 || ataps.size() != 2) {
+        throw std::runtime_error("deemph_ff only supports a first order IIR.");
+    }
+    _b0 = btaps[0] / ataps[0];
+    _b1 = btaps[1] / ataps[0];
+    _a1 = ataps[1] / ataps[0];
+}
+
+deemph_ff::sptr deemph_ff::make(const std::vector<double> &btaps, const std::vector<double> &ataps)
+{
+    return gnuradio::get_initial_sptr(new deemph_ff(btaps, ataps));
+}
+
 fm_deemph::~fm_deemph()
 {
 }
@@ -21,11 +75,11 @@ fm_deemph::sptr fm_deemph::make(float audio_rate)
     return gnuradio::get_initial_sptr(new fm_deemph(audio_rate));
 }
 
-fm_deemph::fm_deemph(float audio_rate)
-    : hier_block2(
-        "fm_deemph",
-        io_signature::make(1, 1, sizeof(float)),
-        io_signature::make(1, 1, sizeof(float)))
+// Designs the 75 us de-emphasis as a first order IIR (bilinear transform, prewarped at the corner)
+// @param audio_rate Sample rate the filter runs at
+// @param btaps Receives the feed-forward taps
+// @param ataps Receives the feedback taps, in iir_filter_ffd's non-oldstyle sign convention
+void fm_deemph::design(float audio_rate, std::vector<double> &btaps, std::vector<double> &ataps)
 {
     double tau = 75.0e-6;
     double w_c = 1.0 / tau;
@@ -35,23 +89,32 @@ fm_deemph::fm_deemph(float audio_rate)
     double p1 = (1.0 + k) / (1.0 - k);
     double b0 = -k / (1.0 - k);
 
-    std::vector<double> ataps;
-    std::vector<double> btaps;
+    btaps.clear();
+    ataps.clear();
 
     btaps.push_back(b0 * 1.0);
     btaps.push_back(b0 * -z1);
 
     ataps.push_back(1.0);
     ataps.push_back(-p1);
+}
+
+fm_deemph::fm_deemph(float audio_rate)
+    : hier_block2(
+        "fm_deemph",
+        io_signature::make(1, 1, sizeof(float)),
+        io_signature::make(1, 1, sizeof(float)))
+{
+    std::vector<double> ataps;
+    std::vector<double> btaps;
+    design(audio_rate, btaps, ataps);
 
-    iirfilt = gr::filter::iir_filter_ffd::make(
-        btaps,
-        ataps,
-        false);
+    iirfilt = deemph_ff::make(btaps, ataps);
 
     connect(self(), 0, iirfilt, 0);
 
     connect(iirfilt, 0, self(), 0);
+    add_inner_blocks({iirfilt});
 }
 
 } // namespace analog
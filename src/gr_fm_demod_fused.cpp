@@ -0,0 +1,139 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/math.h>
+#include <volk/volk.h>
+
+#include "gr_fm_demod_fused.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace analog
+{
+
+fm_demod_fused_cf::~fm_demod_fused_cf()
+{
+}
+
+// Clears the discriminator and de-emphasis history, as if first were the first input sample
+void fm_demod_fused_cf::restart(const gr_complex &first)
+{
+    _last = first;
+    std::fill(_disc.begin(), _disc.end(), 0.0f);
+    _prev_in = 0.0;
+    _prev_out = 0.0;
+}
+
+int fm_demod_fused_cf::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    const gr_complex *in = (const gr_complex *)input_items[0];
+    float *out = (float *)output_items[0];
+    float *mpx = output_items.size() > 1 ? (float *)output_items[1] : NULL;
+    unsigned int decim = decimation();
+    unsigned int ntaps = _taps_rev.size();
+    unsigned int hist = ntaps - 1;
+    unsigned int ninput = noutput_items * decim;
+
+    // Outputs are only produced up to a retune, the next call then starts over from the new
+    // frequency's samples.  That is at most decim - 1 samples after the tagged one.
+    if (_restart_pending) {
+        restart(in[0]);
+        _restart_pending = false;
+    }
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + ninput, blocks::retune_tagger_cc::retune_key());
+    std::sort(_tags.begin(), _tags.end(), tag_t::offset_compare);
+    for (const tag_t &tag : _tags) {
+        unsigned int tag_index = tag.offset - first;
+        if (tag_index == 0) {
+            restart(in[0]);
+            continue;
+        }
+        noutput_items = (tag_index + decim - 1) / decim;
+        ninput = noutput_items * decim;
+        _restart_pending = true;
+        break;
+    }
+
+    // Discriminator, same arithmetic as quadrature_demod_cf
+    _prod.resize(ninput);
+    _disc.resize(hist + ninput);
+    _prod[0] = in[0] * std::conj(_last);
+    if (ninput > 1) {
+        volk_32fc_x2_multiply_conjugate_32fc(&_prod[1], &in[1], &in[0], ninput - 1);
+    }
+    for (unsigned int i = 0; i < ninput; ++i) {
+        _disc[hist + i] = _gain * gr::fast_atan2f(_prod[i].imag(), _prod[i].real());
+    }
+    _last = in[ninput - 1];
+
+    // Low-pass at the kept phases only: output k ends on input k * decim, like fir_filter_fff
+    for (int k = 0; k < noutput_items; ++k) {
+        float filtered;
+        volk_32f_x2_dot_prod_32f(&filtered, &_disc[k * decim], &_taps_rev[0], ntaps);
+        if (mpx) {
+            mpx[k] = filtered;
+        }
+
+        double deemph = _b0 * filtered + _b1 * _prev_in - _a1 * _prev_out;
+        _prev_in = filtered;
+        _prev_out = deemph;
+        out[k] = float(deemph);
+    }
+
+    memmove(&_disc[0], &_disc[ninput], hist * sizeof(float));
+    return noutput_items;
+}
+
+fm_demod_fused_cf::fm_demod_fused_cf(
+    float gain,
+    unsigned int decimation,
+    const std::vector<float> &taps,
+    const std::vector<double> &btaps,
+    const std::vector<double> &ataps)
+    : sync_decimator(
+        "fm_demod_fused_cf",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::make(1, 2, sizeof(float)),
+        decimation),
+    _gain(gain),
+    _taps_rev(taps.rbegin(), taps.rend()),
+    _last(0, 0),
+    _restart_pending(false),
+    _prev_in(0.0),
+    _prev_out(0.0)
+{
+    if (taps.empty()) {
+        throw std::runtime_error("fm_demod_fused_cf needs at least one low-pass tap.");
+    }
+    if (btaps.size() != 2 || ataps.size() != 2) {
+        throw std::runtime_error("fm_demod_fused_cf only supports a first order IIR.");
+    }
+    _b0 = btaps[0] / ataps[0];
+    _b1 = btaps[1] / ataps[0];
+    _a1 = ataps[1] / ataps[0];
+    _disc.assign(taps.size() - 1, 0.0f);
+}
+
+fm_demod_fused_cf::sptr fm_demod_fused_cf::make(
+    float gain,
+    unsigned int decimation,
+    const std::vector<float> &taps,
+    const std::vector<double> &btaps,
+    const std::vector<double> &ataps)
+{
+    return gnuradio::get_initial_sptr(new fm_demod_fused_cf(gain, decimation, taps, btaps, ataps));
+}
+
+} // namespace analog
+} // namespace gr
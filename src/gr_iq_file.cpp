@@ -0,0 +1,454 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gnuradio/io_signature.h>
+
+#include "gr_iq_file.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+// Same conversion as the rtl backend of gr-osmosdr, so a replayed CU8 recording matches live samples
+const float CU8_OFFSET = 127.4f;
+const float CU8_SCALE = 1.0f / 128.0f;
+
+// Longest stretch a paced replay hands out at once
+const double REPLAY_CHUNK_S = 0.01;
+
+std::string iq_data_path(const std::string &base_path)
+{
+    return base_path + ".sigmf-data";
+}
+
+std::string iq_meta_path(const std::string &base_path)
+{
+    return base_path + ".sigmf-meta";
+}
+
+static const char *datatype_name(iq_format format)
+{
+    return format == iq_format::CU8 ? "cu8" : "cf32_le";
+}
+
+static size_t sample_size(iq_format format)
+{
+    return format == iq_format::CU8 ? 2 : sizeof(gr_complex);
+}
+
+iq_recorder_c::~iq_recorder_c()
+{
+    write_meta();
+    close(_fd);
+}
+
+// @param base_path Where to write, without the .sigmf-data/.sigmf-meta extension
+// @param format Sample format in the file
+// @param sample_rate Rate of the stream
+// @param center_freq Frequency the dongle is tuned to when recording starts, Hz
+iq_recorder_c::sptr iq_recorder_c::make(
+    const std::string &base_path,
+    iq_format format,
+    double sample_rate,
+    double center_freq)
+{
+    int fd = ::open(iq_data_path(base_path).c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not create " + iq_data_path(base_path) + ": " + strerror(errno));
+    }
+    return gnuradio::get_initial_sptr(new iq_recorder_c(fd, base_path, format, sample_rate, center_freq));
+}
+
+// The tag offsets start over with a restarted flowgraph, e.g. after rtl_resume, the file doesn't
+bool iq_recorder_c::start()
+{
+    _run_start = _recorded;
+    return true;
+}
+
+// Keeps the metadata on disk in step with the data when the flowgraph stops
+bool iq_recorder_c::stop()
+{
+    write_meta();
+    return true;
+}
+
+// Rewrites the .sigmf-meta file, replaced with a rename so it is never seen half written
+// @return false if it could not be written
+bool iq_recorder_c::write_meta()
+{
+    std::string path = iq_meta_path(_base_path);
+    std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"global\": {\n");
+    fprintf(file, "    \"core:datatype\": \"%s\",\n", datatype_name(_format));
+    fprintf(file, "    \"core:sample_rate\": %.17g,\n", _sample_rate);
+    fprintf(file, "    \"core:version\": \"1.0.0\",\n");
+    fprintf(file, "    \"core:recorder\": \"gt_rtl_radio\"\n");
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"captures\": [\n");
+    for (size_t i = 0; i < _captures.size(); ++i) {
+        fprintf(file, "    {\"core:sample_start\": %llu, \"core:frequency\": %.17g}%s\n",
+                (unsigned long long)_captures[i].sample_start,
+                _captures[i].frequency,
+                i + 1 < _captures.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"annotations\": []\n");
+    fprintf(file, "}\n");
+    bool ok = fclose(file) == 0;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+int iq_recorder_c::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)output_items;
+    const gr_complex *in = (const gr_complex *)input_items[0];
+
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, retune_tagger_cc::retune_key());
+    std::sort(_tags.begin(), _tags.end(), tag_t::offset_compare);
+    for (const tag_t &tag : _tags) {
+        iq_capture capture = {_run_start + tag.offset, pmt::to_double(tag.value)};
+        if (!_captures.empty() && _captures.back().sample_start == capture.sample_start) {
+            _captures.back() = capture;
+        }
+        else {
+            _captures.push_back(capture);
+        }
+    }
+
+    const void *data = in;
+    size_t len = noutput_items * sample_size(_format);
+    if (_format == iq_format::CU8) {
+        _cu8_buf.resize(len);
+        const float *samples = (const float *)in;
+        for (size_t i = 0; i < len; ++i) {
+            float value = roundf(samples[i] / CU8_SCALE + CU8_OFFSET);
+            _cu8_buf[i] = (uint8_t)std::min(255.0f, std::max(0.0f, value));
+        }
+        data = _cu8_buf.data();
+    }
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (len > 0) {
+        ssize_t written = ::write(_fd, bytes, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error: iq_recorder_c - write to %s failed: %s\n", iq_data_path(_base_path).c_str(), strerror(errno));
+            break;
+        }
+        bytes += written;
+        len -= written;
+    }
+    _recorded += noutput_items;
+    return noutput_items;
+}
+
+iq_recorder_c::iq_recorder_c(
+    int fd,
+    const std::string &base_path,
+    iq_format format,
+    double sample_rate,
+    double center_freq)
+    : sync_block(
+        "iq_recorder_c",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::make(0, 0, 0)),
+    _fd(fd),
+    _base_path(base_path),
+    _format(format),
+    _sample_rate(sample_rate),
+    _recorded(0),
+    _run_start(0)
+{
+    iq_capture capture = {0, center_freq};
+    _captures.push_back(capture);
+    write_meta();
+}
+
+// Just enough JSON for the metadata iq_recorder_c writes: the number after "key": at or past from
+// @return the position after the number, std::string::npos if the key isn't there
+static size_t find_number(const std::string &json, size_t from, const char *key, double &value_out)
+{
+    size_t pos = json.find(std::string("\"") + key + "\"", from);
+    if (pos == std::string::npos) {
+        return pos;
+    }
+    pos = json.find(':', pos);
+    if (pos == std::string::npos) {
+        return pos;
+    }
+    const char *start = json.c_str() + pos + 1;
+    char *end;
+    value_out = strtod(start, &end);
+    if (end == start) {
+        return std::string::npos;
+    }
+    return pos + 1 + (end - start);
+}
+
+static std::string find_string(const std::string &json, const char *key)
+{
+    size_t pos = json.find(std::string("\"") + key + "\"");
+    if (pos == std::string::npos || (pos = json.find(':', pos)) == std::string::npos ||
+        (pos = json.find('"', pos)) == std::string::npos) {
+        return "";
+    }
+    size_t end = json.find('"', pos + 1);
+    return end == std::string::npos ? "" : json.substr(pos + 1, end - pos - 1);
+}
+
+iq_replay_source_c::~iq_replay_source_c()
+{
+    munmap((void *)_mapping, _mapping_len);
+}
+
+// @param base_path Recording to play, without the .sigmf-data/.sigmf-meta extension
+// @param realtime Pace the samples to the recorded rate, otherwise as fast as they are taken
+// @param repeat Start over at the end, otherwise the flowgraph finishes there
+iq_replay_source_c::sptr iq_replay_source_c::make(const std::string &base_path, bool realtime, bool repeat)
+{
+    std::ifstream meta_file(iq_meta_path(base_path));
+    if (!meta_file) {
+        throw std::runtime_error("Could not open " + iq_meta_path(base_path));
+    }
+    std::stringstream meta_stream;
+    meta_stream << meta_file.rdbuf();
+    std::string meta = meta_stream.str();
+
+    iq_format format;
+    std::string datatype = find_string(meta, "core:datatype");
+    if (datatype == "cu8") {
+        format = iq_format::CU8;
+    }
+    else if (datatype == "cf32_le") {
+        format = iq_format::CF32;
+    }
+    else {
+        throw std::runtime_error("Unsupported SigMF datatype \"" + datatype + "\" in " + iq_meta_path(base_path));
+    }
+    double sample_rate = 0.0;
+    if (find_number(meta, 0, "core:sample_rate", sample_rate) == std::string::npos || sample_rate <= 0.0) {
+        throw std::runtime_error("No sample rate in " + iq_meta_path(base_path));
+    }
+    std::vector<iq_capture> captures;
+    size_t pos = meta.find("\"captures\"");
+    while (pos != std::string::npos) {
+        double start, freq;
+        pos = find_number(meta, pos, "core:sample_start", start);
+        if (pos == std::string::npos) {
+            break;
+        }
+        pos = find_number(meta, pos, "core:frequency", freq);
+        if (pos == std::string::npos) {
+            break;
+        }
+        iq_capture capture = {(uint64_t)start, freq};
+        captures.push_back(capture);
+    }
+    std::sort(captures.begin(), captures.end(), [](const iq_capture &a, const iq_capture &b) {
+        return a.sample_start < b.sample_start;
+    });
+
+    int fd = ::open(iq_data_path(base_path).c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + iq_data_path(base_path) + ": " + strerror(errno));
+    }
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= off_t(sample_size(format))) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + iq_data_path(base_path));
+    }
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    return gnuradio::get_initial_sptr(
+        new iq_replay_source_c(mapping, st.st_size, format, sample_rate, captures, realtime, repeat));
+}
+
+double iq_replay_source_c::sample_rate() const
+{
+    return _sample_rate;
+}
+
+// @return the frequency of the capture being played, Hz
+double iq_replay_source_c::center_freq() const
+{
+    return _center_freq;
+}
+
+uint64_t iq_replay_source_c::num_samples() const
+{
+    return _num_samples;
+}
+
+// Plays the recording as if through the RTL's 8 bit ADC at a different gain, so the software AGC
+// can be run on it: the samples are scaled by gain_db, clipped at full scale and quantized the way
+// the dongle would.  The change reaches the samples delay_samples after this call, like a gain
+// change on the dongle landing in the USB transfer after the one being filled.
+// @param gain_db Gain relative to the one the recording was made at
+// @param delay_samples Samples still played at the old gain
+void iq_replay_source_c::set_adc_gain(double gain_db, uint64_t delay_samples)
+{
+    std::lock_guard<std::mutex> lock(_adc_mtx);
+    float scale = float(pow(10.0, gain_db / 20.0));
+    if (!_adc_model) {
+        _adc_model = true;
+        _adc_scale = scale;
+    }
+    _adc_next_scale = scale;
+    _adc_switch_at = _adc_written + delay_samples;
+}
+
+bool iq_replay_source_c::start()
+{
+    {
+        // The item counts start over with the flowgraph
+        std::lock_guard<std::mutex> lock(_adc_mtx);
+        _adc_scale = _adc_next_scale;
+        _adc_switch_at = 0;
+        _adc_written = 0;
+    }
+    _start_time = std::chrono::steady_clock::now();
+    _samples_since_start = 0;
+    return true;
+}
+
+int iq_replay_source_c::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)input_items;
+    gr_complex *out = (gr_complex *)output_items[0];
+
+    if (_pos >= _num_samples) {
+        if (!_repeat) {
+            return WORK_DONE;
+        }
+        _pos = 0;
+        _next_capture = 0;
+    }
+    uint64_t n = std::min<uint64_t>(noutput_items, _num_samples - _pos);
+    if (_realtime) {
+        n = std::min<uint64_t>(n, std::max(1.0, _sample_rate * REPLAY_CHUNK_S));
+        std::this_thread::sleep_until(_start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>((_samples_since_start + n) / _sample_rate)));
+    }
+
+    for (; _next_capture < _captures.size() && _captures[_next_capture].sample_start < _pos + n; ++_next_capture) {
+        const iq_capture &capture = _captures[_next_capture];
+        _center_freq = capture.frequency;
+        // The first capture is where the recording started, not a retune
+        if (capture.sample_start >= _pos && (_next_capture > 0 || _pos > 0 || _samples_since_start > 0)) {
+            add_item_tag(0, nitems_written(0) + (capture.sample_start - _pos),
+                retune_tagger_cc::retune_key(), pmt::from_double(capture.frequency), pmt::mp(alias()));
+        }
+    }
+
+    if (_format == iq_format::CF32) {
+        memcpy(out, (const gr_complex *)_mapping + _pos, n * sizeof(gr_complex));
+    }
+    else {
+        const uint8_t *in = (const uint8_t *)_mapping + 2 * _pos;
+        float *samples = (float *)out;
+        for (uint64_t i = 0; i < 2 * n; ++i) {
+            samples[i] = (in[i] - CU8_OFFSET) * CU8_SCALE;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_adc_mtx);
+        if (_adc_model) {
+            uint64_t first = nitems_written(0);
+            if (_adc_switch_at < first) {
+                _adc_scale = _adc_next_scale;
+            }
+            float *samples = (float *)out;
+            for (uint64_t i = 0; i < 2 * n; ++i) {
+                if (first + i / 2 == _adc_switch_at) {
+                    _adc_scale = _adc_next_scale;
+                }
+                float value = roundf(samples[i] * _adc_scale / CU8_SCALE + CU8_OFFSET);
+                samples[i] = (std::min(std::max(value, 0.0f), 255.0f) - CU8_OFFSET) * CU8_SCALE;
+            }
+            _adc_written = first + n;
+        }
+    }
+    _pos += n;
+    _samples_since_start += n;
+    return n;
+}
+
+iq_replay_source_c::iq_replay_source_c(
+    const void *mapping,
+    size_t mapping_len,
+    iq_format format,
+    double sample_rate,
+    const std::vector<iq_capture> &captures,
+    bool realtime,
+    bool repeat)
+    : sync_block(
+        "iq_replay_source_c",
+        io_signature::make(0, 0, 0),
+        io_signature::make(1, 1, sizeof(gr_complex))),
+    _mapping(mapping),
+    _mapping_len(mapping_len),
+    _format(format),
+    _sample_rate(sample_rate),
+    _captures(captures),
+    _realtime(realtime),
+    _repeat(repeat),
+    _num_samples(mapping_len / sample_size(format)),
+    _pos(0),
+    _next_capture(0),
+    _center_freq(captures.empty() ? 0.0 : captures[0].frequency),
+    _samples_since_start(0),
+    _adc_model(false),
+    _adc_scale(1.0f),
+    _adc_next_scale(1.0f),
+    _adc_switch_at(0),
+    _adc_written(0)
+{
+}
+
+} // namespace blocks
+} // namespace gr
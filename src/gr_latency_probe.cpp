@@ -0,0 +1,116 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <gnuradio/io_signature.h>
+
+#include "gr_latency_probe.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+latency_probe_f::~latency_probe_f()
+{
+}
+
+// Every stamp of a restarted flowgraph counts, whatever stamps came before the stop
+bool latency_probe_f::start()
+{
+    _last_stamp = 0;
+    return true;
+}
+
+// Gets the latency of the stamps seen since the last reset()
+// @return the number of stamps the statistics are over
+unsigned int latency_probe_f::get_stats(double &last_ms, double &mean_ms, double &min_ms, double &max_ms)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    last_ms = _last_ms;
+    mean_ms = _count > 0 ? _sum_ms / _count : 0.0;
+    min_ms = _count > 0 ? _min_ms : 0.0;
+    max_ms = _max_ms;
+    return _count;
+}
+
+// @return retune_tagger_cc::timestamp_now() of the first audio since the last reset(), 0 until then
+uint64_t latency_probe_f::first_sample_time() const
+{
+    return _first_sample;
+}
+
+// Also starts the wait for the first audio over
+void latency_probe_f::reset()
+{
+    _first_sample = 0;
+    std::lock_guard<std::mutex> lock(_mtx);
+    _last_ms = 0.0;
+    _sum_ms = 0.0;
+    _min_ms = 0.0;
+    _max_ms = 0.0;
+    _count = 0;
+}
+
+int latency_probe_f::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)input_items;
+    (void)output_items;
+    if (_first_sample.load(std::memory_order_relaxed) == 0 && noutput_items > 0) {
+        _first_sample = retune_tagger_cc::timestamp_now();
+    }
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, retune_tagger_cc::timestamp_key());
+    if (_tags.empty()) {
+        return noutput_items;
+    }
+
+    uint64_t now = retune_tagger_cc::timestamp_now();
+    for (const tag_t &tag : _tags) {
+        uint64_t stamp = pmt::to_uint64(tag.value);
+        if (stamp <= _last_stamp) {
+            continue;
+        }
+        _last_stamp = stamp;
+        double latency_ms = (now - stamp) / 1e6;
+
+        std::lock_guard<std::mutex> lock(_mtx);
+        _last_ms = latency_ms;
+        _sum_ms += latency_ms;
+        _min_ms = _count > 0 ? std::min(_min_ms, latency_ms) : latency_ms;
+        _max_ms = std::max(_max_ms, latency_ms);
+        ++_count;
+    }
+    return noutput_items;
+}
+
+latency_probe_f::latency_probe_f()
+    : sync_block(
+        "latency_probe_f",
+        io_signature::make(1, 1, sizeof(float)),
+        io_signature::make(0, 0, 0)),
+    _last_stamp(0),
+    _first_sample(0),
+    _last_ms(0.0),
+    _sum_ms(0.0),
+    _min_ms(0.0),
+    _max_ms(0.0),
+    _count(0)
+{
+}
+
+latency_probe_f::sptr latency_probe_f::make()
+{
+    return gnuradio::get_initial_sptr(new latency_probe_f());
+}
+
+} // namespace blocks
+} // namespace gr
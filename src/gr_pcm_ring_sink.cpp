@@ -0,0 +1,221 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gnuradio/io_signature.h>
+
+#include "gr_pcm_ring_sink.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+const unsigned int MAX_PCM_CHANNELS = 2;
+
+pcm_ring::pcm_ring(const std::string &shm_name, void *mapping, size_t mapping_len, bool owner)
+    : _shm_name(shm_name),
+    _mapping(mapping),
+    _mapping_len(mapping_len),
+    _owner(owner),
+    _hdr((pcm_ring_header *)mapping),
+    _data((uint8_t *)mapping + ((pcm_ring_header *)mapping)->data_offset)
+{
+}
+
+pcm_ring::~pcm_ring()
+{
+    munmap(_mapping, _mapping_len);
+    if (_owner) {
+        shm_unlink(_shm_name.c_str());
+    }
+}
+
+// Creates (or replaces) the shared memory object and lays out an empty ring in it
+// @param shm_name POSIX shared memory name, e.g. "/rtl_pcm0"
+// @param capacity_frames Ring size, rounded up to a power of two
+// @return the ring, or an empty pointer if the shared memory could not be set up
+pcm_ring::sptr pcm_ring::create(
+    const std::string &shm_name,
+    unsigned int channels,
+    pcm_format format,
+    unsigned int sample_rate,
+    unsigned int capacity_frames)
+{
+    if (channels < 1 || channels > MAX_PCM_CHANNELS || capacity_frames < 1) {
+        return sptr();
+    }
+    unsigned int capacity = 1;
+    while (capacity < capacity_frames) {
+        capacity <<= 1;
+    }
+    uint32_t bytes_per_sample = format == pcm_format::S16 ? sizeof(int16_t) : sizeof(float);
+    uint32_t data_offset = (sizeof(pcm_ring_header) + 63) & ~63u;
+    size_t len = data_offset + size_t(capacity) * channels * bytes_per_sample;
+
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        return sptr();
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, len) == 0) {
+        mapping = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(shm_name.c_str());
+        return sptr();
+    }
+
+    pcm_ring_header *hdr = new (mapping) pcm_ring_header;
+    hdr->version = PCM_RING_VERSION;
+    hdr->channels = channels;
+    hdr->format = uint32_t(format);
+    hdr->sample_rate = sample_rate;
+    hdr->capacity = capacity;
+    hdr->bytes_per_frame = channels * bytes_per_sample;
+    hdr->data_offset = data_offset;
+    hdr->write_pos = 0;
+    hdr->read_pos = 0;
+    hdr->overruns = 0;
+    // Last, so a consumer that opens the ring early never sees a half written header
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr->magic = PCM_RING_MAGIC;
+
+    return sptr(new pcm_ring(shm_name, mapping, len, true));
+}
+
+// Attaches to a ring created by pcm_ring::create(), possibly in another process
+// @return the ring, or an empty pointer if it does not exist or is not a ring of this version
+pcm_ring::sptr pcm_ring::open(const std::string &shm_name)
+{
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return sptr();
+    }
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(pcm_ring_header)) {
+        mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return sptr();
+    }
+    const pcm_ring_header *hdr = (const pcm_ring_header *)mapping;
+    if (hdr->magic != PCM_RING_MAGIC || hdr->version != PCM_RING_VERSION ||
+        hdr->data_offset + size_t(hdr->capacity) * hdr->bytes_per_frame > size_t(st.st_size)) {
+        munmap(mapping, st.st_size);
+        return sptr();
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sptr(new pcm_ring(shm_name, mapping, st.st_size, false));
+}
+
+const pcm_ring_header &pcm_ring::header() const
+{
+    return *_hdr;
+}
+
+// Producer side: interleaves and stores up to num_frames frames.  Never blocks.
+// @param channel_data One pointer per channel to num_frames float samples
+// @return the number of frames stored, the rest were dropped
+size_t pcm_ring::write(const float *const *channel_data, size_t num_frames)
+{
+    uint64_t w = _hdr->write_pos.load(std::memory_order_relaxed);
+    uint64_t r = _hdr->read_pos.load(std::memory_order_acquire);
+    size_t space = _hdr->capacity - size_t(w - r);
+    size_t n = std::min(num_frames, space);
+    if (n < num_frames) {
+        _hdr->overruns.fetch_add(num_frames - n, std::memory_order_relaxed);
+    }
+
+    uint32_t mask = _hdr->capacity - 1;
+    uint32_t channels = _hdr->channels;
+    if (_hdr->format == uint32_t(pcm_format::S16)) {
+        for (size_t i = 0; i < n; ++i) {
+            int16_t *frame = (int16_t *)(_data + ((w + i) & mask) * _hdr->bytes_per_frame);
+            for (uint32_t c = 0; c < channels; ++c) {
+                float sample = std::max(-1.0f, std::min(1.0f, channel_data[c][i]));
+                frame[c] = int16_t(lrintf(sample * 32767.0f));
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < n; ++i) {
+            float *frame = (float *)(_data + ((w + i) & mask) * _hdr->bytes_per_frame);
+            for (uint32_t c = 0; c < channels; ++c) {
+                frame[c] = channel_data[c][i];
+            }
+        }
+    }
+    _hdr->write_pos.store(w + n, std::memory_order_release);
+    return n;
+}
+
+// Consumer side: points data at the oldest unread frames inside the ring
+// @return how many frames can be read contiguously there, at most max_frames
+size_t pcm_ring::acquire(const void **data, size_t max_frames)
+{
+    uint64_t w = _hdr->write_pos.load(std::memory_order_acquire);
+    uint64_t r = _hdr->read_pos.load(std::memory_order_relaxed);
+    uint32_t index = uint32_t(r & (_hdr->capacity - 1));
+    size_t n = std::min(std::min(size_t(w - r), size_t(_hdr->capacity - index)), max_frames);
+    *data = _data + size_t(index) * _hdr->bytes_per_frame;
+    return n;
+}
+
+// Consumer side: hands num_frames acquired frames back to the producer
+void pcm_ring::release(size_t num_frames)
+{
+    uint64_t w = _hdr->write_pos.load(std::memory_order_acquire);
+    uint64_t r = _hdr->read_pos.load(std::memory_order_relaxed);
+    _hdr->read_pos.store(r + std::min(num_frames, size_t(w - r)), std::memory_order_release);
+}
+
+pcm_ring_sink::~pcm_ring_sink()
+{
+}
+
+int pcm_ring_sink::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)output_items;
+    const float *channel_data[MAX_PCM_CHANNELS];
+    for (size_t c = 0; c < input_items.size() && c < MAX_PCM_CHANNELS; ++c) {
+        channel_data[c] = (const float *)input_items[c];
+    }
+    _ring->write(channel_data, noutput_items);
+    return noutput_items;
+}
+
+pcm_ring_sink::pcm_ring_sink(pcm_ring::sptr ring)
+    : sync_block(
+        "pcm_ring_sink",
+        io_signature::make(ring->header().channels, ring->header().channels, sizeof(float)),
+        io_signature::make(0, 0, 0)),
+    _ring(ring)
+{
+}
+
+pcm_ring_sink::sptr pcm_ring_sink::make(pcm_ring::sptr ring)
+{
+    return gnuradio::get_initial_sptr(new pcm_ring_sink(ring));
+}
+
+} // namespace blocks
+} // namespace gr
@@ -0,0 +1,194 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <gnuradio/io_signature.h>
+
+#include "gr_power_probe.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace analog
+{
+
+power_probe_f::~power_probe_f()
+{
+}
+
+// @return mean squared magnitude of the most recently completed window
+float power_probe_f::level() const
+{
+    return _level;
+}
+
+// Starts a new measurement: drops the windows collected so far and the partial window in progress
+void power_probe_f::reset()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    _level_sum = 0.0;
+    _level_sq_sum = 0.0;
+    _num_windows = 0;
+    _restart = true;
+}
+
+// Prepares wait_for_retune() to wait for the retune tag of freq_hz.  Call before retuning.
+void power_probe_f::arm_retune(double freq_hz)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    _armed_freq_hz = freq_hz;
+    _retune_seen = false;
+}
+
+// Blocks until the first sample at the frequency given to arm_retune() has reached the probe.
+// The measurement is restarted at that sample, so windows counted afterwards are all new.
+// @return false if the retune tag did not arrive within timeout_ms
+bool power_probe_f::wait_for_retune(unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    return _window_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [this] { return _retune_seen; });
+}
+
+// Blocks until at least num_windows windows have completed since the last reset()
+// @return false if the windows did not arrive within timeout_ms
+bool power_probe_f::wait_for_windows(unsigned int num_windows, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    return _window_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [this, num_windows] { return _num_windows >= num_windows; });
+}
+
+// @return mean of all windows completed since the last reset(), 0 if there are none
+double power_probe_f::mean_level()
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _num_windows > 0 ? _level_sum / _num_windows : 0.0;
+}
+
+// Gets the mean and the sample variance of the window levels completed since the last reset()
+// @return the number of windows the statistics are over
+unsigned int power_probe_f::get_stats(double &mean, double &variance)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    mean = _num_windows > 0 ? _level_sum / _num_windows : 0.0;
+    variance = _num_windows > 1
+        ? std::max((_level_sq_sum - _num_windows * mean * mean) / (_num_windows - 1), 0.0)
+        : 0.0;
+    return _num_windows;
+}
+
+unsigned int power_probe_f::window_size() const
+{
+    return _window_size;
+}
+
+void power_probe_f::complete_window()
+{
+    float level = float(_acc / _window_size);
+    _level = level;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_restart) {
+            // Window started before a reset(), don't let it count towards the new measurement
+            return;
+        }
+        _level_sum += level;
+        _level_sq_sum += double(level) * level;
+        ++_num_windows;
+    }
+    _window_cv.notify_all();
+    message_port_pub(pmt::mp("power"), pmt::from_double(level));
+}
+
+void power_probe_f::handle_retune(const tag_t &tag)
+{
+    _fill = 0;
+    _acc = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (std::abs(pmt::to_double(tag.value) - _armed_freq_hz) > 1.0) {
+            return;
+        }
+        _level_sum = 0.0;
+        _level_sq_sum = 0.0;
+        _num_windows = 0;
+        _retune_seen = true;
+    }
+    _window_cv.notify_all();
+}
+
+void power_probe_f::accumulate(const float *in, int num_items)
+{
+    for (int i = 0; i < num_items; ++i) {
+        _acc += in[i] * in[i];
+        if (++_fill == _window_size) {
+            complete_window();
+            _fill = 0;
+            _acc = 0.0;
+        }
+    }
+}
+
+int power_probe_f::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)output_items;
+    if (_restart.exchange(false)) {
+        _fill = 0;
+        _acc = 0.0;
+    }
+
+    const float *in = (const float *)input_items[0];
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, blocks::retune_tagger_cc::retune_key());
+    int done = 0;
+    for (const tag_t &tag : _tags) {
+        int tag_index = int(tag.offset - first);
+        accumulate(in + done, tag_index - done);
+        handle_retune(tag);
+        done = tag_index;
+    }
+    accumulate(in + done, noutput_items - done);
+    return noutput_items;
+}
+
+void power_probe_f::init_block(unsigned int window_size)
+{
+    _window_size = window_size;
+    _fill = 0;
+    _acc = 0.0;
+    _level = 0.0f;
+    _restart = false;
+    _level_sum = 0.0;
+    _level_sq_sum = 0.0;
+    _num_windows = 0;
+    _armed_freq_hz = 0.0;
+    _retune_seen = false;
+    message_port_register_out(pmt::mp("power"));
+}
+
+power_probe_f::power_probe_f(unsigned int window_size)
+    : sync_block(
+        "power_probe_f",
+        io_signature::make(1, 1, sizeof(float)),
+        io_signature::make(0, 0, 0))
+{
+    init_block(window_size);
+}
+
+power_probe_f::sptr power_probe_f::make(unsigned int window_size)
+{
+    return gnuradio::get_initial_sptr(new power_probe_f(window_size));
+}
+
+} // namespace analog
+} // namespace gr
@@ -5,7 +5,12 @@
 //
 // Author: Tim Rice (trice2@jaguarlandrover.com)
 
+#include <algorithm>
 #include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include <vector>
 #include <gnuradio/digital/constellation.h>
 #include <gnuradio/analog/agc2_cc.h>
@@ -18,13 +23,14 @@
 #include <gnuradio/blocks/unpack_k_bits_bb.h>
 
 #include "gr_psk_demod.h"
+#include "gr_tap_cache.h"
 
 namespace gr
 {
 namespace digital
 {
 
-std::vector<int> invert_code(std::vector<int> code) {
+static std::vector<int> invert_code(const std::vector<int> &code) {
     std::vector<std::pair<int,int>> ic;
     for (unsigned int i = 0; i < code.size(); ++i) {
         ic.push_back(std::make_pair(code[i], i));
@@ -69,26 +75,60 @@ psk_demod::~psk_demod()
 {
 }
 
-void psk_demod::init_block(psk_demod_params_t params)
+// Message port of the frequency and phase loops that puts them back to zero offset
+static pmt::pmt_t reset_port()
 {
-    if (ceil(log2(params.constellation_points)) != floor(log2(params.constellation_points))) {
-        throw std::runtime_error("Number of constellation points must be a power of two.");
+    static const pmt::pmt_t port = pmt::mp("reset");
+    return port;
+}
+
+// Puts the frequency and phase loops back to zero offset, so they acquire a new station from
+// scratch instead of pulling in from where the previous one left them.  Safe from any thread, the
+// loops are only posted a message and reset on their own threads between two work() calls.
+void psk_demod::reset()
+{
+    _freq_recov->_post(reset_port(), pmt::PMT_T);
+    _receiver->_post(reset_port(), pmt::PMT_T);
+}
+
+// Gray codes for the common arities, the first n entries are the code for n points
+static constexpr int gray_codes[16] = {0, 1, 3, 2, 6, 7, 5, 4, 12, 13, 15, 14, 10, 11, 9, 8};
+
+static std::vector<int> gray_code(unsigned int length)
+{
+    if (length <= sizeof(gray_codes) / sizeof(gray_codes[0])) {
+        return std::vector<int>(gray_codes, gray_codes + length);
     }
+    gray_code_generator gcg;
+    return gcg.get_gray_code(length);
+}
+
+// Everything init_block derives from the parameters alone.  The constellation is never modified once
+// built, so the instances share it along with the taps.
+struct psk_design {
+    constellation_psk::sptr constellation;
+    std::vector<int> pre_diff_code;
+    std::vector<int> symbol_map;        // map_bb table undoing the pre-differential code
+    std::vector<float> clock_sync_taps;
+};
+
+static std::shared_ptr<const psk_design> make_design(const psk_demod_params_t &params, int nfilts)
+{
+    auto design = std::make_shared<psk_design>();
     std::vector<gr_complex> points;
     for (int i = 0; i < params.constellation_points; ++i) {
         gr_complex j(0, 1);
         points.push_back(exp(2 * i * (float)M_PI * j / (float)params.constellation_points));
     }
 
-    std::vector<int> pre_diff_code;
     std::vector<int> post_diff_code;
     bool post_diff_code_none = true;
     if (params.mod_code == mod_code::GRAY_CODE) {
         if (params.differential) {
-            pre_diff_code = _gcg.get_gray_code(params.constellation_points);
+            design->pre_diff_code = gray_code(params.constellation_points);
         }
         else {
-            post_diff_code = _gcg.get_gray_code(params.constellation_points);
+            post_diff_code = gray_code(params.constellation_points);
             post_diff_code_none = false;
         }
     }
@@ -100,39 +140,87 @@ void psk_demod::init_block(psk_demod_params_t params)
         }
         points = points_inv;
     }
-    auto constellation = gr::digital::constellation_psk::make(points, pre_diff_code, params.constellation_points);
+    design->constellation = gr::digital::constellation_psk::make(points, design->pre_diff_code, params.constellation_points);
+    if (design->pre_diff_code.size() > 0) {
+        design->symbol_map = invert_code(design->constellation->pre_diff_code());
+    }
+    int ntaps = 11 * int(params.samples_per_symbol * nfilts);
+    design->clock_sync_taps = gr::filter::tap_cache::root_raised_cosine(nfilts, nfilts * params.samples_per_symbol, 1.0, params.excess_bw, ntaps);
+    return design;
+}
+
+// Designs are kept for the life of the process, keyed by the parameters they depend on.  A tuner
+// with virtual tuners builds one demodulator per station, all with the same parameters.
+static std::shared_ptr<const psk_design> get_design(const psk_demod_params_t &params, int nfilts)
+{
+    typedef std::tuple<int, int, int, float, float, int> design_key;
+    static std::mutex designs_mtx;
+    static std::map<design_key, std::shared_ptr<const psk_design>> designs;
+
+    design_key key(params.constellation_points, int(params.mod_code), params.differential != 0,
+                   params.samples_per_symbol, params.excess_bw, nfilts);
+    std::lock_guard<std::mutex> lock(designs_mtx);
+    auto it = designs.find(key);
+    if (it == designs.end()) {
+        it = designs.emplace(key, make_design(params, nfilts)).first;
+    }
+    return it->second;
+}
+
+void psk_demod::init_block(psk_demod_params_t params)
+{
+    if (ceil(log2(params.constellation_points)) != floor(log2(params.constellation_points))) {
+        throw std::runtime_error("Number of constellation points must be a power of two.");
+    }
     if (params.samples_per_symbol < 2) {
         throw std::runtime_error("samples per symbol must be >= 2");
     }
-    int arity = pow(2, constellation->bits_per_symbol());
     int nfilts = 32;
-    int ntaps = 11 * int(params.samples_per_symbol * nfilts);
+    auto design = get_design(params, nfilts);
+    auto constellation = design->constellation;
+    int arity = pow(2, constellation->bits_per_symbol());
     auto agc = gr::analog::agc2_cc::make(0.6e-1, 1e-3, 1, 1);
     int fll_ntaps = 55;
-    auto freq_recov = gr::digital::fll_band_edge_cc::make(params.samples_per_symbol, params.excess_bw, fll_ntaps, params.freq_bw);
-    auto taps = gr::filter::firdes::root_raised_cosine(nfilts, nfilts * params.samples_per_symbol, 1.0, params.excess_bw, ntaps);
-    auto time_recov = gr::digital::pfb_clock_sync_ccf::make(params.samples_per_symbol, params.timing_bw, taps, nfilts, nfilts / 2, 1.5);
+    _freq_recov = gr::digital::fll_band_edge_cc::make(params.samples_per_symbol, params.excess_bw, fll_ntaps, params.freq_bw);
+    auto time_recov = gr::digital::pfb_clock_sync_ccf::make(params.samples_per_symbol, params.timing_bw, design->clock_sync_taps, nfilts, nfilts / 2, 1.5);
     float fmin = -0.25;
     float fmax = 0.25;
-    auto receiver = gr::digital::constellation_receiver_cb::make(constellation->base(), params.phase_bw, fmin, fmax);
+    _receiver = gr::digital::constellation_receiver_cb::make(constellation->base(), params.phase_bw, fmin, fmax);
+    // The handlers belong to the blocks they reset, a raw pointer doesn't keep them alive
+    fll_band_edge_cc *freq_recov = _freq_recov.get();
+    _freq_recov->message_port_register_in(reset_port());
+    _freq_recov->set_msg_handler(reset_port(), [freq_recov](pmt::pmt_t) {
+        freq_recov->set_frequency(0.0f);
+        freq_recov->set_phase(0.0f);
+    });
+    constellation_receiver_cb *receiver = _receiver.get();
+    _receiver->message_port_register_in(reset_port());
+    _receiver->set_msg_handler(reset_port(), [receiver](pmt::pmt_t) {
+        receiver->set_frequency(0.0f);
+        receiver->set_phase(0.0f);
+    });
     auto unpack = gr::blocks::unpack_k_bits_bb::make(constellation->bits_per_symbol());
     connect(self(), 0, agc, 0);
-    connect(agc, 0, freq_recov, 0);
-    connect(freq_recov, 0, time_recov, 0);
-    connect(time_recov, 0, receiver, 0);
-    gr::basic_block_sptr last_block = receiver;
+    connect(agc, 0, _freq_recov, 0);
+    connect(_freq_recov, 0, time_recov, 0);
+    connect(time_recov, 0, _receiver, 0);
+    add_inner_blocks({agc, _freq_recov, time_recov, _receiver});
+    gr::basic_block_sptr last_block = _receiver;
     if (params.differential) {
         auto diffdec = gr::digital::diff_decoder_bb::make(arity);
         connect(last_block, 0, diffdec, 0);
+        add_inner_blocks({diffdec});
         last_block = diffdec;
     }
-    if (pre_diff_code.size() > 0) {
-        auto symbol_mapper = gr::digital::map_bb::make(invert_code(constellation->pre_diff_code()));
+    if (design->symbol_map.size() > 0) {
+        auto symbol_mapper = gr::digital::map_bb::make(design->symbol_map);
         connect(last_block, 0, symbol_mapper, 0);
+        add_inner_blocks({symbol_mapper});
         last_block = symbol_mapper;
     }
     connect(last_block, 0, unpack, 0);
     connect(unpack, 0, self(), 0);
+    add_inner_blocks({unpack});
 }
 
 psk_demod::psk_demod(psk_demod_params_t params)
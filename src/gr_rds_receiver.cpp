@@ -5,6 +5,9 @@
 //
 // Author: Tim Rice (trice2@jaguarlandrover.com)
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <gnuradio/filter/freq_xlating_fir_filter_fcf.h>
 #include <gnuradio/filter/pfb_arb_resampler_ccf.h>
 #include <gnuradio/filter/fir_filter_ccf.h>
@@ -12,9 +15,10 @@
 #include <gnuradio/blocks/keep_one_in_n.h>
 #include <gnuradio/digital/diff_decoder_bb.h>
 #include <rds/decoder.h>
-#include <rds/parser.h>
 
 #include "gr_rds_receiver.h"
+#include "gr_retune_watch.h"
+#include "gr_tap_cache.h"
 
 namespace gr
 {
@@ -25,22 +29,88 @@ rds_receiver::~rds_receiver()
 {
 }
 
-void rds_receiver::init_block()
+// Drops everything decoded from the previous station: the PSK loops and the station and partly
+// assembled text in rds_sink
+void rds_receiver::reset()
 {
-    int decimation = 1;
-    auto taps = filter::firdes::low_pass(2500.0, 250000, 2.6e3, 2e3, filter::firdes::WIN_HAMMING);
-    double center_freq = 57e3;
-    double sampling_freq = 250000;
-    auto filt = gr::filter::freq_xlating_fir_filter_fcf::make(decimation, taps, center_freq, sampling_freq);
+    _psk_demod->reset();
+    rds_sink->reset();
+}
+
+// Sets where the decoded stations are kept.  Each retune then points rds_sink at the entry of the
+// new channel.  Set it before the flowgraph is started.
+void rds_receiver::set_cache(gr::rds::station_cache::sptr cache)
+{
+    _cache = cache;
+}
 
-    float rate = 19000/250e3;
+// Prepares wait_for_retune() to wait for the retune tag of freq_hz.  Call before retuning.
+void rds_receiver::arm_retune(double freq_hz)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    _armed_freq_hz = freq_hz;
+    _retune_seen = false;
+}
+
+// Blocks until the first sample at the frequency given to arm_retune() has reached the decoder
+// and the state of the previous station is gone, so a reset() after this one isn't undone
+// @return false if the retune tag did not arrive within timeout_ms
+bool rds_receiver::wait_for_retune(unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    return _retune_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [this] { return _retune_seen; });
+}
+
+// Called on the retune watch's thread once the new frequency's samples reach the decoder
+void rds_receiver::handle_retune(double freq_hz)
+{
+    reset();
+    if (_cache) {
+        rds_sink->set_cache(_cache, _cache->channel_of(freq_hz / 1e6));
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (std::abs(freq_hz - _armed_freq_hz) > 1.0) {
+            return;
+        }
+        _retune_seen = true;
+    }
+    _retune_cv.notify_all();
+}
+
+// @param baseband_input true if the input is the RDS subcarrier already mixed down to complex
+//                       baseband (wfmrcv_stereo output 3), false for the float MPX signal
+//                       (wfmrcv output 1).  The MPX must not be de-emphasized, that costs the
+//                       57 kHz subcarrier about 25 dB.
+// @param sampling_freq Rate of the input, the audio rate out of wfmrcv
+void rds_receiver::init_block(bool baseband_input, double sampling_freq)
+{
+    auto &taps = filter::tap_cache::low_pass(2500.0, sampling_freq, 2.6e3, 2e3, filter::firdes::WIN_HAMMING);
+    // Either way the first block goes straight down to ~19.2 kHz and only evaluates the
+    // decimated outputs, the arbitrary resampler only has to trim that to 19 kHz
+    int decimation = std::max(1, int(round(sampling_freq / 19.2e3)));
+    double filt_rate = sampling_freq / decimation;
+    gr::basic_block_sptr filt;
+    if (baseband_input) {
+        // The pilot PLL already did the 57 kHz mix, so only the low pass is left
+        filt = gr::filter::fir_filter_ccf::make(decimation, taps);
+    }
+    else {
+        double center_freq = 57e3;
+        filt = gr::filter::freq_xlating_fir_filter_fcf::make(decimation, taps, center_freq, sampling_freq);
+    }
+    // Clears the PSK loops and rds_sink where the retuned samples start, on the decoder's threads
+    auto watch = gr::blocks::retune_watch_cc::make([this](double freq_hz) { handle_retune(freq_hz); });
+
+    float rate = 19000/filt_rate;
     unsigned int filter_size = 32;
     double atten = 100;
     double percent = 0.80;
     double halfband = 0.5 * rate;
     double bw = percent * halfband;
     double tb = (percent / 2.0) * halfband;
-    auto resamp_taps = filter::firdes::low_pass_2(filter_size, filter_size, bw, tb, atten, filter::firdes::WIN_HAMMING);
+    auto &resamp_taps = filter::tap_cache::low_pass_2(filter_size, filter_size, bw, tb, atten, filter::firdes::WIN_HAMMING);
     auto resampler = gr::filter::pfb_arb_resampler_ccf::make(rate, resamp_taps, filter_size);
 
     double gain = 1;
@@ -48,7 +118,7 @@ void rds_receiver::init_block()
     double symbol_rate = 2375;
     double alpha = 0.35;
     int ntaps = 100;
-    auto rrc_filt = gr::filter::firdes::root_raised_cosine(gain, sampling_freq_rrc, symbol_rate, alpha, ntaps);
+    auto &rrc_filt = gr::filter::tap_cache::root_raised_cosine(gain, sampling_freq_rrc, symbol_rate, alpha, ntaps);
     int decimation_fir = 2;
     auto fir_filt = gr::filter::fir_filter_ccf::make(decimation_fir, rrc_filt);
 
@@ -61,7 +131,7 @@ void rds_receiver::init_block()
     params.timing_bw = 6.28/100.0;
     params.phase_bw = 6.28/100.0;
     params.mod_code = gr::digital::mod_code::GRAY_CODE;
-    auto psk_demod = gr::digital::psk_demod::make(params);
+    _psk_demod = gr::digital::psk_demod::make(params);
 
     auto keep_one = gr::blocks::keep_one_in_n::make(sizeof(char), 2);
 
@@ -69,34 +139,36 @@ void rds_receiver::init_block()
 
     auto rds_decoder = gr::rds::decoder::make(false, false);
 
-    unsigned char pty_locale = 1; // 0 = Europe, 1 = North America
-    auto rds_parser = gr::rds::parser::make(false, false, pty_locale);
-
     rds_sink = gr::rds::rds_sink::make();
 
     connect(self(), 0, filt, 0);
-    connect(filt, 0, resampler, 0);
+    connect(filt, 0, watch, 0);
+    connect(watch, 0, resampler, 0);
     connect(resampler, 0, fir_filt, 0);
-    connect(fir_filt, 0, psk_demod, 0);
-    connect(psk_demod, 0, keep_one, 0);
+    connect(fir_filt, 0, _psk_demod, 0);
+    connect(_psk_demod, 0, keep_one, 0);
     connect(keep_one, 0, diff_decoder, 0);
     connect(diff_decoder, 0, rds_decoder, 0);
-    msg_connect(rds_decoder, "out", rds_parser, "in");
-    msg_connect(rds_parser, "out", rds_sink, "in");
+    // rds_sink decodes the raw groups itself, gr::rds::parser would format every field into a
+    // freshly allocated string first
+    msg_connect(rds_decoder, "out", rds_sink, "in");
+    add_inner_blocks({filt, watch, resampler, fir_filt, _psk_demod, keep_one, diff_decoder, rds_decoder, rds_sink});
 }
 
-rds_receiver::rds_receiver()
+rds_receiver::rds_receiver(bool baseband_input, double sampling_freq)
     : hier_block2(
         "rds_receiver",
-        io_signature::make(1, 1, sizeof(float)),
-        io_signature::make(0, 0, 0))
+        io_signature::make(1, 1, baseband_input ? sizeof(gr_complex) : sizeof(float)),
+        io_signature::make(0, 0, 0)),
+    _armed_freq_hz(0.0),
+    _retune_seen(false)
 {
-    init_block();
+    init_block(baseband_input, sampling_freq);
 }
 
-rds_receiver::sptr rds_receiver::make()
+rds_receiver::sptr rds_receiver::make(bool baseband_input, double sampling_freq)
 {
-    return gnuradio::get_initial_sptr(new rds_receiver());
+    return gnuradio::get_initial_sptr(new rds_receiver(baseband_input, sampling_freq));
 }
 
 } // namespace analog
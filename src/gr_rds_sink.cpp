@@ -5,6 +5,11 @@
 //
 // Author: Tim Rice (trice2@jaguarlandrover.com)
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "gr_rds_callsign.h"
 #include "gr_rds_sink.h"
 
 namespace gr
@@ -16,65 +21,358 @@ rds_sink::~rds_sink()
 {
 }
 
+// Starts a change: the back buffer gets a copy of the current snapshot to modify.  Call with
+// _write_mtx held and finish with publish().
+rds_snapshot &rds_sink::begin_update()
+{
+    uint32_t seq = _seq.load(std::memory_order_relaxed);
+    rds_snapshot &back = _snapshots[(seq + 1) & 1];
+    back = _snapshots[seq & 1];
+    back.seq = seq + 1;
+    return back;
+}
+
+void rds_sink::publish()
+{
+    _seq.fetch_add(1, std::memory_order_release);
+}
+
+// Copies the current state without locking or allocating
+void rds_sink::get_snapshot(rds_snapshot &snapshot_out) const
+{
+    uint32_t seq;
+    do {
+        seq = _seq.load(std::memory_order_acquire);
+        snapshot_out = _snapshots[seq & 1];
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (_seq.load(std::memory_order_relaxed) != seq);
+}
+
+// Forgets the current station in one step, a reader sees either all of it or none
 void rds_sink::reset()
 {
-    _curr_station.clear();
-    _curr_station_type.clear();
+    std::lock_guard<std::mutex> lock(_write_mtx);
+    rds_snapshot &back = begin_update();
+    uint32_t seq = back.seq;
+    memset(&back, 0, sizeof(back));
+    back.seq = seq;
+    clear_assembly();
+    publish();
+}
+
+// Sets where decoded PI and PTY are written back to, call whenever the tuner changes channel
+// @param cache The station cache, may be empty
+// @param channel Channel the decoded data belongs to, -1 for none
+void rds_sink::set_cache(station_cache::sptr cache, int channel)
+{
+    std::lock_guard<std::mutex> lock(_write_mtx);
+    _cache = cache;
+    _cache_channel = channel;
+}
+
+// @return the RDS program identifier of the current station, 0 until one was decoded
+unsigned int rds_sink::get_curr_pi()
+{
+    rds_snapshot snapshot;
+    get_snapshot(snapshot);
+    return snapshot.pi;
 }
 
 const std::string rds_sink::get_curr_station()
 {
-    return _curr_station;
+    rds_snapshot snapshot;
+    get_snapshot(snapshot);
+    return snapshot.callsign;
 }
 
 const std::string rds_sink::get_curr_station_type()
 {
-    return _curr_station_type;
+    rds_snapshot snapshot;
+    get_snapshot(snapshot);
+    return snapshot.pty;
+}
+
+// RBDS (North America) program type names
+static const char *const pty_names[32] = {
+    "None", "News", "Information", "Sports", "Talk", "Rock", "Classic Rock", "Adult Hits",
+    "Soft Rock", "Top 40", "Country", "Oldies", "Soft", "Nostalgia", "Jazz", "Classical",
+    "Rhythm and Blues", "Soft Rhythm and Blues", "Language", "Religious Music", "Religious Talk",
+    "Personality", "Public", "College", "Spanish Talk", "Spanish Music", "Hip Hop", "Unassigned",
+    "Unassigned", "Weather", "Emergency Test", "Emergency"
+};
+
+// Application ID of RadioText+ in 3A groups
+static const uint16_t RTPLUS_AID = 0x4BD7;
+
+// Days between the Modified Julian Date epoch and 1970-01-01
+static const int64_t MJD_UNIX_EPOCH = 40587;
+
+// RDS characters above 0x7f are the RDS character set rather than Latin-1, they are not mapped
+static char rds_char(unsigned int c)
+{
+    return (c >= 0x20 && c < 0x7f) ? char(c) : ' ';
+}
+
+void rds_sink::clear_assembly()
+{
+    memset(_ps_buf, ' ', sizeof(_ps_buf));
+    _ps_segments = 0;
+    memset(_rt_buf, ' ', sizeof(_rt_buf));
+    _rt_segments = 0;
+    _rt_ab = -1;
+    _rtplus_group = -1;
+    memset(_rtplus_raw, 0, sizeof(_rtplus_raw));
 }
 
-// NOTE: this formula is U.S.A.-sepcific, and it does not work in every case (there are a number of exceptions)
-// In reality, we would need to leverage some sort of database to reliably extract the callsign from the PI field.
-// We may be able to use the RT+ field for this info instead, but gr-rds doesn't currently parse it.
-std::string convert_to_callsign(const std::string& picode_str)
+// Group 0: two PS characters per group, plus the TA and M/S flags and, in 0A, two AF codes
+uint32_t rds_sink::decode_ps(rds_snapshot &back, const uint16_t *group, bool version_b)
 {
-    int picode = std::stoi(picode_str, 0, 16);
-    int code;
-    std::string csign = "";
-    if (picode > 4095 && picode < 39247) {
-        if (picode > 21671) {
-            csign += 'W';
-            code = picode - 21672;
+    uint32_t changed = 0;
+    uint8_t ta = (group[1] >> 4) & 1;
+    uint8_t music = (group[1] >> 3) & 1;
+    if (ta != back.traffic_announcement || music != back.music) {
+        back.traffic_announcement = ta;
+        back.music = music;
+        changed |= RDS_FIELD_FLAGS;
+    }
+
+    unsigned int segment = group[1] & 0x3;
+    _ps_buf[2 * segment] = rds_char(group[3] >> 8);
+    _ps_buf[2 * segment + 1] = rds_char(group[3] & 0xff);
+    _ps_segments |= 1 << segment;
+    // Start over once complete, so a station cycling its PS is followed
+    if (_ps_segments == 0xf) {
+        _ps_segments = 0;
+        if (memcmp(back.ps, _ps_buf, sizeof(_ps_buf)) != 0) {
+            memcpy(back.ps, _ps_buf, sizeof(_ps_buf));
+            back.ps[sizeof(_ps_buf)] = '\0';
+            changed |= RDS_FIELD_PS;
         }
-        else {
-            csign += 'K';
-            code = picode - 4096;
+    }
+
+    if (!version_b) {
+        changed |= decode_af(back, group[2] >> 8);
+        changed |= decode_af(back, group[2] & 0xff);
+    }
+    return changed;
+}
+
+// Method A AF codes: 1-204 are 87.6-107.9 MHz, the list length, filler and LF/MF codes are skipped
+uint32_t rds_sink::decode_af(rds_snapshot &back, unsigned int code)
+{
+    if (code < 1 || code > 204) {
+        return 0;
+    }
+    uint32_t khz = 87500 + 100 * code;
+    for (unsigned int i = 0; i < back.num_af; i++) {
+        if (back.af_khz[i] == khz) {
+            return 0;
         }
-        int call2 = code / 676;
-        code = code - (676 * call2);
-        int call3 = code / 26;
-        int call4 = code - (26 * call3);
-        csign += char(call2 + 65);
-        csign += char(call3 + 65);
-        csign += char(call4 + 65);
     }
-    return csign;
+    if (back.num_af >= RDS_MAX_AF) {
+        return 0;
+    }
+    back.af_khz[back.num_af++] = khz;
+    return RDS_FIELD_AF;
 }
 
-// TODO: there are a lot more RDS fields that we could access here
-void rds_sink::rds_rcv(pmt::pmt_t msg)
+// Group 2: RadioText, four characters per 2A group or two per 2B group.  The message is complete at
+// the carriage return or once every segment arrived.
+uint32_t rds_sink::decode_radiotext(rds_snapshot &back, const uint16_t *group, bool version_b)
+{
+    int ab = (group[1] >> 4) & 1;
+    if (ab != _rt_ab) {
+        memset(_rt_buf, ' ', sizeof(_rt_buf));
+        _rt_segments = 0;
+        _rt_ab = ab;
+    }
+
+    unsigned int segment = group[1] & 0xf;
+    unsigned int seg_len = version_b ? 2 : 4;
+    unsigned int max_len = 16 * seg_len;
+    char *seg = &_rt_buf[segment * seg_len];
+    uint16_t words[2] = {version_b ? group[3] : group[2], group[3]};
+    unsigned int end = max_len;
+    for (unsigned int i = 0; i < seg_len; i++) {
+        unsigned int c = (words[i / 2] >> ((i & 1) ? 0 : 8)) & 0xff;
+        if (c == 0x0d) {
+            end = segment * seg_len + i;
+        }
+        seg[i] = (c == 0x0d) ? '\0' : rds_char(c);
+    }
+    _rt_segments |= 1 << segment;
+
+    // Find the end if an earlier group carried it
+    for (unsigned int i = 0; i < max_len && end == max_len; i++) {
+        if (_rt_buf[i] == '\0') {
+            end = i;
+        }
+    }
+    uint32_t needed = (1 << ((end + seg_len - 1) / seg_len)) - 1;
+    if (end == 0 || (_rt_segments & needed) != needed) {
+        return 0;
+    }
+    _rt_segments = 0;
+    // Stations pad to the full length with spaces
+    while (end > 0 && _rt_buf[end - 1] == ' ') {
+        end--;
+    }
+    if (strlen(back.radiotext) == end && memcmp(back.radiotext, _rt_buf, end) == 0) {
+        return 0;
+    }
+    memcpy(back.radiotext, _rt_buf, end);
+    back.radiotext[end] = '\0';
+    return RDS_FIELD_RADIOTEXT | resolve_rtplus(back);
+}
+
+// RT+ group: item toggle and running bits, then two (content type, start, length) tags
+uint32_t rds_sink::decode_rtplus(rds_snapshot &back, const uint16_t *group)
+{
+    back.rtplus_running = (group[1] >> 3) & 1;
+    _rtplus_raw[0][0] = ((group[1] & 0x7) << 3) | (group[2] >> 13);
+    _rtplus_raw[0][1] = (group[2] >> 7) & 0x3f;
+    _rtplus_raw[0][2] = (group[2] >> 1) & 0x3f;
+    _rtplus_raw[1][0] = ((group[2] & 0x1) << 5) | (group[3] >> 11);
+    _rtplus_raw[1][1] = (group[3] >> 5) & 0x3f;
+    _rtplus_raw[1][2] = group[3] & 0x1f;
+    return resolve_rtplus(back);
+}
+
+// Cuts the RT+ tags out of the current RadioText
+uint32_t rds_sink::resolve_rtplus(rds_snapshot &back)
+{
+    uint32_t changed = 0;
+    size_t rt_len = strlen(back.radiotext);
+    for (unsigned int i = 0; i < 2; i++) {
+        rds_rtplus_tag tag;
+        memset(&tag, 0, sizeof(tag));
+        unsigned int start = _rtplus_raw[i][1];
+        // The length marker is the number of characters after the first
+        unsigned int len = _rtplus_raw[i][2] + 1;
+        if (_rtplus_raw[i][0] != 0 && start < rt_len) {
+            tag.content_type = _rtplus_raw[i][0];
+            len = std::min<size_t>(len, rt_len - start);
+            memcpy(tag.text, &back.radiotext[start], len);
+        }
+        if (memcmp(&tag, &back.rtplus[i], sizeof(tag)) != 0) {
+            back.rtplus[i] = tag;
+            changed = RDS_FIELD_RTPLUS;
+        }
+    }
+    return changed;
+}
+
+// Group 4A: Modified Julian Date, UTC hour and minute and the local offset in half hours
+uint32_t rds_sink::decode_clock(rds_snapshot &back, const uint16_t *group)
+{
+    int64_t mjd = (int64_t(group[1] & 0x3) << 15) | (group[2] >> 1);
+    unsigned int hour = ((group[2] & 0x1) << 4) | (group[3] >> 12);
+    unsigned int minute = (group[3] >> 6) & 0x3f;
+    int32_t offset_min = 30 * (group[3] & 0x1f);
+    if (group[3] & 0x20) {
+        offset_min = -offset_min;
+    }
+    if (mjd < MJD_UNIX_EPOCH || hour > 23 || minute > 59) {
+        return 0;
+    }
+    back.clock_time = (mjd - MJD_UNIX_EPOCH) * 86400 + hour * 3600 + minute * 60;
+    back.clock_offset_min = offset_min;
+    return RDS_FIELD_CLOCK;
+}
+
+// Decodes one group into the back buffer
+// @return The rds_field bits of everything that changed
+uint32_t rds_sink::decode_group(rds_snapshot &back, const uint16_t *group)
 {
-    if (pmt::is_tuple(msg)) {
-        long msg_type = pmt::to_long(pmt::tuple_ref(msg, 0));
-        std::string msg_val = pmt::symbol_to_string(pmt::tuple_ref(msg, 1));
-        switch(msg_type) {
-            case 0: // PI - Program identifier
-                _curr_station = convert_to_callsign(msg_val);
-                break;
-            case 2: // PTY - Program type
-                _curr_station_type = msg_val;
-                break;
+    uint32_t changed = 0;
+    unsigned int group_type = group[1] >> 12;
+    bool version_b = (group[1] >> 11) & 1;
+    ++back.group_counts[2 * group_type + version_b];
+
+    // The PI comes with every group, the call sign only needs working out when it changes
+    if (group[0] != back.pi) {
+        back.pi = group[0];
+        pi_to_callsign(back.pi, back.callsign);
+        changed |= RDS_FIELD_PI;
+        if (_cache) {
+            _cache->update_pi(_cache_channel, back.pi, back.callsign);
+        }
+    }
+
+    unsigned int pty = (group[1] >> 5) & 0x1f;
+    if (pty != back.pty_code || back.pty[0] == '\0') {
+        back.pty_code = pty;
+        snprintf(back.pty, sizeof(back.pty), "%s", pty_names[pty]);
+        changed |= RDS_FIELD_PTY;
+        if (_cache) {
+            _cache->update_genre(_cache_channel, back.pty);
         }
     }
+
+    uint8_t tp = (group[1] >> 10) & 1;
+    if (tp != back.traffic_program) {
+        back.traffic_program = tp;
+        changed |= RDS_FIELD_FLAGS;
+    }
+
+    if (int(2 * group_type + version_b) == _rtplus_group) {
+        return changed | decode_rtplus(back, group);
+    }
+    switch (group_type) {
+        case 0:
+            changed |= decode_ps(back, group, version_b);
+            break;
+        case 2:
+            changed |= decode_radiotext(back, group, version_b);
+            break;
+        case 3: // Open data application announcement
+            if (!version_b && group[3] == RTPLUS_AID) {
+                _rtplus_group = group[1] & 0x1f;
+            }
+            break;
+        case 4:
+            if (!version_b) {
+                changed |= decode_clock(back, group);
+            }
+            break;
+    }
+    return changed;
+}
+
+// Takes the raw groups from gr::rds::decoder: a (meta . blob) PDU of the four blocks as big-endian
+// 16-bit words followed by the four offset characters.  Everything is decoded into fixed buffers,
+// nothing here allocates.
+void rds_sink::rds_rcv(pmt::pmt_t msg)
+{
+    if (!pmt::is_pair(msg) || !pmt::is_blob(pmt::cdr(msg)) || pmt::blob_length(pmt::cdr(msg)) != 12) {
+        return;
+    }
+    const uint8_t *bytes = (const uint8_t *)pmt::blob_data(pmt::cdr(msg));
+    uint16_t group[4];
+    for (unsigned int i = 0; i < 4; i++) {
+        group[i] = (uint16_t(bytes[2 * i]) << 8) | bytes[2 * i + 1];
+    }
+
+    std::unique_lock<std::mutex> lock(_write_mtx);
+    rds_snapshot &back = begin_update();
+    uint32_t changed = decode_group(back, group);
+    publish();
+    rds_change_callback callback = _callback;
+    void *user_data = _callback_user_data;
+    lock.unlock();
+
+    if (changed && callback) {
+        callback(changed, user_data);
+    }
+}
+
+// @param callback Called after a group changed a field, nullptr to stop
+// @param user_data Handed back to the callback
+void rds_sink::set_change_callback(rds_change_callback callback, void *user_data)
+{
+    std::lock_guard<std::mutex> lock(_write_mtx);
+    _callback = callback;
+    _callback_user_data = user_data;
 }
 
 void rds_sink::init_block()
@@ -87,8 +385,11 @@ rds_sink::rds_sink()
     : gr::block(
         "rds_receiver",
         io_signature::make(0, 0, 0),
-        io_signature::make(0, 0, 0))
+        io_signature::make(0, 0, 0)),
+    _seq(0)
 {
+    memset(_snapshots, 0, sizeof(_snapshots));
+    clear_assembly();
     init_block();
 }
 
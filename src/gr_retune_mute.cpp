@@ -0,0 +1,122 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cmath>
+#include <gnuradio/io_signature.h>
+
+#include "gr_retune_mute.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+const double FADE_OUT_S = 0.005;
+const double FADE_IN_S = 0.010;
+const double MAX_MUTE_S = 1.0;    // open up even if the retune tag got lost
+
+retune_mute_ff::~retune_mute_ff()
+{
+}
+
+// Starts muting.  Call right before the source is retuned to freq_hz.
+void retune_mute_ff::arm(double freq_hz)
+{
+    _armed_freq_hz = freq_hz;
+    _arm_pending = true;
+}
+
+// Keeps the audio muted while held, whatever retune tags arrive and for however long, e.g. through a
+// scan that takes the tuner away from the station.  A retune armed before the release still waits
+// for its tag.
+void retune_mute_ff::hold(bool held)
+{
+    _held = held;
+}
+
+// Sets a function that is called from the block's thread with the new frequency in Hz when its
+// first sample reaches the block, e.g. to clear decoder state at the right moment.  Set it before
+// the flowgraph is started.
+void retune_mute_ff::set_open_callback(std::function<void(double)> callback)
+{
+    _open_callback = callback;
+}
+
+void retune_mute_ff::open()
+{
+    _waiting = false;
+    if (_open_callback) {
+        _open_callback(_target_freq_hz);
+    }
+}
+
+int retune_mute_ff::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    const float *in = (const float *)input_items[0];
+    float *out = (float *)output_items[0];
+
+    if (_arm_pending.exchange(false)) {
+        _target_freq_hz = _armed_freq_hz;
+        _waiting = true;
+        _muted = 0;
+    }
+
+    bool held = _held;
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, retune_tagger_cc::retune_key());
+    std::sort(_tags.begin(), _tags.end(), tag_t::offset_compare);
+    std::vector<tag_t>::const_iterator tag = _tags.begin();
+    for (int i = 0; i < noutput_items; ++i) {
+        for (; tag != _tags.end() && tag->offset == first + i; ++tag) {
+            if (_waiting && std::abs(pmt::to_double(tag->value) - _target_freq_hz) <= 1.0) {
+                open();
+            }
+        }
+        if (_waiting && !held && ++_muted > _max_muted) {
+            open();
+        }
+        _gain = _waiting || held ? std::max(0.0f, _gain - _fade_out_step) : std::min(1.0f, _gain + _fade_in_step);
+        out[i] = in[i] * _gain;
+    }
+    return noutput_items;
+}
+
+void retune_mute_ff::init_block(double sample_rate)
+{
+    _armed_freq_hz = 0.0;
+    _arm_pending = false;
+    _held = false;
+    _target_freq_hz = 0.0;
+    _waiting = false;
+    _muted = 0;
+    _max_muted = (unsigned int)(MAX_MUTE_S * sample_rate);
+    _gain = 1.0f;
+    _fade_out_step = float(1.0 / (FADE_OUT_S * sample_rate));
+    _fade_in_step = float(1.0 / (FADE_IN_S * sample_rate));
+}
+
+retune_mute_ff::retune_mute_ff(double sample_rate)
+    : sync_block(
+        "retune_mute_ff",
+        io_signature::make(1, 1, sizeof(float)),
+        io_signature::make(1, 1, sizeof(float)))
+{
+    init_block(sample_rate);
+}
+
+retune_mute_ff::sptr retune_mute_ff::make(double sample_rate)
+{
+    return gnuradio::get_initial_sptr(new retune_mute_ff(sample_rate));
+}
+
+} // namespace blocks
+} // namespace gr
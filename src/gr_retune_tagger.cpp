@@ -0,0 +1,126 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <chrono>
+#include <gnuradio/io_signature.h>
+
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+retune_tagger_cc::~retune_tagger_cc()
+{
+}
+
+// Same key the UHD and osmosdr sources use for their own retune tags
+pmt::pmt_t retune_tagger_cc::retune_key()
+{
+    static const pmt::pmt_t key = pmt::mp("rx_freq");
+    return key;
+}
+
+// Marks the sample holdoff after the next one through the block as the first one at freq_hz.  Call
+// right after the source's center frequency has been changed.  A retune before the tag went out
+// replaces it.
+// @param holdoff Samples still from the old frequency, at the rate of this block
+void retune_tagger_cc::tag_retune(double freq_hz, uint64_t holdoff)
+{
+    _freq_hz = freq_hz;
+    _holdoff = holdoff;
+    _pending = true;
+}
+
+pmt::pmt_t retune_tagger_cc::timestamp_key()
+{
+    static const pmt::pmt_t key = pmt::mp("rx_stamp");
+    return key;
+}
+
+// @return the clock the "rx_stamp" tags are in, nanoseconds of std::chrono::steady_clock
+uint64_t retune_tagger_cc::timestamp_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sets how many samples apart the "rx_stamp" tags are, 0 to stop stamping
+void retune_tagger_cc::set_timestamp_interval(unsigned int num_samples)
+{
+    _stamp_interval = num_samples;
+}
+
+// @return timestamp_now() of the first work call with samples, 0 until the source delivered any
+uint64_t retune_tagger_cc::first_sample_time() const
+{
+    return _first_sample;
+}
+
+// The item counts start over when a stopped flowgraph is started again, e.g. by rtl_resume
+bool retune_tagger_cc::start()
+{
+    _next_stamp = 0;
+    // A tag still due counts its holdoff from the first sample after the restart
+    if (_tag_due) {
+        _tag_due = false;
+        _pending = true;
+    }
+    return true;
+}
+
+int retune_tagger_cc::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    if (_first_sample.load(std::memory_order_relaxed) == 0 && noutput_items > 0) {
+        _first_sample = timestamp_now();
+    }
+    if (_pending.exchange(false)) {
+        _tag_due = true;
+        _tag_at = nitems_written(0) + _holdoff;
+        _tag_freq_hz = _freq_hz;
+    }
+    if (_tag_due && _tag_at < nitems_written(0) + noutput_items) {
+        add_item_tag(0, _tag_at, retune_key(), pmt::from_double(_tag_freq_hz), pmt::mp(alias()));
+        _tag_due = false;
+    }
+    unsigned int interval = _stamp_interval;
+    if (interval > 0 && nitems_written(0) >= _next_stamp) {
+        add_item_tag(0, nitems_written(0), timestamp_key(), pmt::from_uint64(timestamp_now()), pmt::mp(alias()));
+        _next_stamp = nitems_written(0) + interval;
+    }
+    memcpy(output_items[0], input_items[0], noutput_items * sizeof(gr_complex));
+    return noutput_items;
+}
+
+retune_tagger_cc::retune_tagger_cc()
+    : sync_block(
+        "retune_tagger_cc",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::make(1, 1, sizeof(gr_complex))),
+    _freq_hz(0.0),
+    _holdoff(0),
+    _pending(false),
+    _tag_due(false),
+    _tag_at(0),
+    _tag_freq_hz(0.0),
+    _stamp_interval(0),
+    _next_stamp(0),
+    _first_sample(0)
+{
+}
+
+retune_tagger_cc::sptr retune_tagger_cc::make()
+{
+    return gnuradio::get_initial_sptr(new retune_tagger_cc());
+}
+
+} // namespace blocks
+} // namespace gr
@@ -0,0 +1,63 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cstring>
+#include <gnuradio/io_signature.h>
+
+#include "gr_retune_watch.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+retune_watch_cc::~retune_watch_cc()
+{
+}
+
+int retune_watch_cc::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    const gr_complex *in = (const gr_complex *)input_items[0];
+    gr_complex *out = (gr_complex *)output_items[0];
+
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, retune_tagger_cc::retune_key());
+    std::sort(_tags.begin(), _tags.end(), tag_t::offset_compare);
+    for (const tag_t &tag : _tags) {
+        int tag_index = int(tag.offset - first);
+        if (tag_index > 0) {
+            // Only up to the retune this time, the callback runs at the start of the next call
+            noutput_items = tag_index;
+            break;
+        }
+        _callback(pmt::to_double(tag.value));
+    }
+    memcpy(out, in, noutput_items * sizeof(gr_complex));
+    return noutput_items;
+}
+
+retune_watch_cc::retune_watch_cc(std::function<void(double)> callback)
+    : sync_block(
+        "retune_watch_cc",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::make(1, 1, sizeof(gr_complex))),
+    _callback(callback)
+{
+}
+
+retune_watch_cc::sptr retune_watch_cc::make(std::function<void(double)> callback)
+{
+    return gnuradio::get_initial_sptr(new retune_watch_cc(callback));
+}
+
+} // namespace blocks
+} // namespace gr
@@ -0,0 +1,238 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <gnuradio/io_signature.h>
+#include <rtl-sdr.h>
+
+#include "gr_rtl_cu8_source.h"
+
+namespace gr
+{
+namespace blocks
+{
+
+// USB transfers queued with librtlsdr, the same as gr-osmosdr's defaults
+const uint32_t USB_BUFFERS = 16;
+const uint32_t USB_BUFFER_LEN = 16384;   // bytes, a multiple of 512
+
+// A work call waits this long for samples before giving the scheduler its thread back
+const unsigned int WORK_WAIT_MS = 100;
+
+rtl_cu8_source::~rtl_cu8_source()
+{
+    stop();
+    rtlsdr_close(_dev);
+}
+
+bool rtl_cu8_source::start()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _write_pos = 0;
+        _read_pos = 0;
+    }
+    rtlsdr_reset_buffer(_dev);
+    _thread = std::thread(rtlsdr_read_async, _dev, &rtl_cu8_source::read_callback, this, USB_BUFFERS, USB_BUFFER_LEN);
+    return true;
+}
+
+bool rtl_cu8_source::stop()
+{
+    if (_thread.joinable()) {
+        rtlsdr_cancel_async(_dev);
+        _thread.join();
+        // Wake a work call still waiting for samples
+        _cv.notify_all();
+    }
+    uint64_t dropped = _dropped.load();
+    if (dropped > 0) {
+        printf("Warning: rtl_cu8_source - dropped %llu samples, the flowgraph fell behind\n", (unsigned long long)dropped);
+    }
+    return true;
+}
+
+// @param freq New center frequency in Hz
+void rtl_cu8_source::set_center_freq(double freq)
+{
+    if (rtlsdr_set_center_freq(_dev, uint32_t(freq)) < 0) {
+        printf("Error: rtl_cu8_source::set_center_freq - could not tune to %f\n", freq);
+        return;
+    }
+    _center_freq = rtlsdr_get_center_freq(_dev);
+}
+
+// Sets the manual tuner gain, the tuner only has the steps of gains()
+// @param gain_db Wanted gain, the nearest step is set
+// @return the gain set, dB
+double rtl_cu8_source::set_gain(double gain_db)
+{
+    if (_gains.empty()) {
+        return 0.0;
+    }
+    double best = _gains[0];
+    for (double gain : _gains) {
+        if (fabs(gain - gain_db) < fabs(best - gain_db)) {
+            best = gain;
+        }
+    }
+    if (rtlsdr_set_tuner_gain(_dev, int(lround(best * 10.0))) < 0) {
+        printf("Error: rtl_cu8_source::set_gain - could not set %f dB\n", best);
+    }
+    return best;
+}
+
+// @return the tuner's gain steps in dB, lowest first
+const std::vector<double>& rtl_cu8_source::gains() const
+{
+    return _gains;
+}
+
+double rtl_cu8_source::center_freq() const
+{
+    return _center_freq.load();
+}
+
+double rtl_cu8_source::sample_rate() const
+{
+    return _sample_rate;
+}
+
+// @return samples in one USB transfer, the dongle hands them over a transfer at a time
+unsigned int rtl_cu8_source::transfer_samples() const
+{
+    return USB_BUFFER_LEN / 2;
+}
+
+// @return samples lost because the flowgraph fell more than the ring behind
+uint64_t rtl_cu8_source::dropped_samples() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+void rtl_cu8_source::read_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    ((rtl_cu8_source *)ctx)->push(buf, len);
+}
+
+// Called on the librtlsdr thread with every USB transfer
+void rtl_cu8_source::push(const unsigned char *buf, uint32_t len)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        size_t size = _ring.size();
+        size_t space = size - (_write_pos - _read_pos);
+        size_t copy = std::min(size_t(len), space) & ~size_t(1);
+        size_t offset = _write_pos & (size - 1);
+        size_t first = std::min(copy, size - offset);
+        memcpy(&_ring[offset], buf, first);
+        memcpy(&_ring[0], buf + first, copy - first);
+        _write_pos += copy;
+        if (copy < len) {
+            _dropped += (len - copy) / 2;
+        }
+    }
+    _cv.notify_one();
+}
+
+int rtl_cu8_source::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    (void)input_items;
+    uint8_t *out = (uint8_t *)output_items[0];
+
+    std::unique_lock<std::mutex> lock(_mtx);
+    _cv.wait_for(lock, std::chrono::milliseconds(WORK_WAIT_MS), [this] { return _write_pos != _read_pos; });
+    size_t size = _ring.size();
+    size_t copy = std::min(size_t(noutput_items) * 2, size_t(_write_pos - _read_pos));
+    size_t offset = _read_pos & (size - 1);
+    size_t first = std::min(copy, size - offset);
+    memcpy(out, &_ring[offset], first);
+    memcpy(out + first, &_ring[0], copy - first);
+    _read_pos += copy;
+    return copy / 2;
+}
+
+rtl_cu8_source::rtl_cu8_source(rtlsdr_dev *dev, double sample_rate, double center_freq)
+    : sync_block(
+        "rtl_cu8_source",
+        io_signature::make(0, 0, 0),
+        io_signature::make(1, 1, 2 * sizeof(uint8_t))),
+    _dev(dev),
+    _sample_rate(sample_rate),
+    _center_freq(center_freq),
+    _write_pos(0),
+    _read_pos(0),
+    _dropped(0)
+{
+    size_t ring_size = USB_BUFFER_LEN;
+    while (ring_size < 2 * sample_rate) {
+        ring_size *= 2;
+    }
+    _ring.resize(ring_size);
+
+    // librtlsdr counts in tenths of a dB
+    int num_gains = rtlsdr_get_tuner_gains(dev, NULL);
+    if (num_gains > 0) {
+        std::vector<int> gains(num_gains);
+        rtlsdr_get_tuner_gains(dev, &gains[0]);
+        for (int gain : gains) {
+            _gains.push_back(gain / 10.0);
+        }
+    }
+}
+
+// @param device_index Which dongle, in librtlsdr's order (the same as gr-osmosdr's rtl=)
+// @param sample_rate Requested rate, the dongle's actual rate is sample_rate()
+// @param center_freq Initial frequency in Hz
+// @param freq_corr_ppm Crystal correction
+// @param auto_gain true for the tuner's AGC, false for gain_db
+// @param gain_db Manual gain, set to the nearest the tuner supports
+rtl_cu8_source::sptr rtl_cu8_source::make(
+    unsigned int device_index,
+    double sample_rate,
+    double center_freq,
+    int freq_corr_ppm,
+    bool auto_gain,
+    double gain_db)
+{
+    rtlsdr_dev *dev = NULL;
+    if (rtlsdr_open(&dev, device_index) < 0) {
+        throw std::runtime_error("rtl_cu8_source could not open rtl device " + std::to_string(device_index));
+    }
+    if (rtlsdr_set_sample_rate(dev, uint32_t(sample_rate)) < 0 ||
+        rtlsdr_set_center_freq(dev, uint32_t(center_freq)) < 0) {
+        rtlsdr_close(dev);
+        throw std::runtime_error("rtl_cu8_source could not set the sample rate and frequency");
+    }
+    // librtlsdr returns an error when the correction is already the requested one
+    if (freq_corr_ppm != 0) {
+        rtlsdr_set_freq_correction(dev, freq_corr_ppm);
+    }
+
+    rtlsdr_set_tuner_gain_mode(dev, auto_gain ? 0 : 1);
+
+    sptr source = gnuradio::get_initial_sptr(new rtl_cu8_source(
+        dev,
+        rtlsdr_get_sample_rate(dev),
+        rtlsdr_get_center_freq(dev)));
+    if (!auto_gain) {
+        source->set_gain(gain_db);
+    }
+    return source;
+}
+
+} // namespace blocks
+} // namespace gr
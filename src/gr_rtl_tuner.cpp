@@ -9,52 +9,439 @@
 
 #include <chrono>
 #include <ctime>
+#include <pthread.h>
+#include <sched.h>
 
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <numeric>
+#include <algorithm>
+#include <set>
+#include <string>
 
 #include <iostream> // Debugging only
 
 #include "gnuradio/top_block.h"
+#include "gnuradio/block_detail.h"
+#include "gnuradio/high_res_timer.h"
+#include "gnuradio/prefs.h"
 #include "osmosdr/source.h"
-#include "gnuradio/filter/rational_resampler_base_ccc.h"
+#include "osmosdr/device.h"
 #include "gnuradio/filter/rational_resampler_base_fff.h"
-#include "gnuradio/filter/fir_filter_ccf.h"
 #include "gnuradio/filter/firdes.h"
 #include "gnuradio/audio/sink.h"
 #include "gnuradio/blocks/wavfile_sink.h"
+#include "gnuradio/blocks/copy.h"
 #include "gnuradio/hier_block2.h"
 #include "gnuradio/gr_complex.h"
 #include "gnuradio/analog/quadrature_demod_cf.h"
 #include "gnuradio/filter/iir_filter_ffd.h"
 #include "gnuradio/filter/fir_filter_fff.h"
-#include "gnuradio/analog/probe_avg_mag_sqrd_f.h"
+#include "gnuradio/filter/pfb_channelizer_ccf.h"
 #include "gr_wfmrcv.h"
+#include "gr_wfmrcv_stereo.h"
 #include "gr_rds_receiver.h"
+#include "gr_tap_cache.h"
+#include "gr_iq_file.h"
+#include "gr_band_power_probe.h"
+#include "gr_adc_headroom_probe.h"
+#include "gr_channel_quality.h"
+#include "gr_power_probe.h"
+#include "gr_retune_tagger.h"
+#include "gr_fm_channelizer.h"
+#include "gr_cu8_channelizer.h"
+#include "gr_rtl_cu8_source.h"
+#include "gr_pcm_ring_sink.h"
+#include "gr_encoded_audio_sink.h"
+#include "gr_latency_probe.h"
+#include "gr_retune_mute.h"
+#include "gr_station_cache.h"
+#include "gr_block_list.h"
 
 const unsigned int MAX_FM_STATIONS = 100;  // maximum number of poossible stations in FM band that we could find
+const double FM_BAND_START_MHZ = 87.9;     // lowest channel center in the (U.S.) FM band
+const double FM_CHANNEL_SPACING_MHZ = 0.2;
+const unsigned int FM_NUM_CHANNELS = 101;  // 87.9 MHz to 107.9 MHz inclusive
+const unsigned int BAND_PROBE_FFT_SIZE = 1024;
+const double POWER_PROBE_WINDOW_S = 0.01;      // demodulated samples per power probe window, the scanner counts in these
+const double LATENCY_STAMP_INTERVAL_S = 0.1;
+const unsigned int THREAD_START_TIMEOUT_MS = 100;   // for a started block thread to show up
+const double DEFAULT_SAMP_RATE = 1e6;
+const double AUDIO_OUT_RATE = 48e3;           // what the resamplers deliver to the sinks
+const double RDS_MIN_MPX_RATE = 120e3;        // the 57 kHz subcarrier and its 2.4 kHz sidebands need this
+const double VIRTUAL_MPX_RATE = 200e3;        // audio/MPX rate of every virtual tuner
+const double VIRTUAL_CHANNEL_CUTOFF = 90e3;   // PFB prototype filter, leaves the adjacent channel out
+const double VIRTUAL_CHANNEL_TRANSITION = 60e3;
+
+// Software AGC, see RTL_GAIN_SOFTWARE_AGC.  Between AGC_LOW_PEAK and AGC_HIGH_PEAK of full scale is
+// wider than any tuner's gain step, so the gain doesn't hunt.
+const unsigned int AGC_STRIDE = 8;             // ADC samples per sample the headroom probe looks at
+const unsigned int AGC_WINDOW = 2048;          // looked at samples per decision, 16 ms at 1 MS/s
+const unsigned int OSMOSDR_TRANSFER_SAMPLES = 131072;  // gr-osmosdr's rtl USB transfers, 256 KiB each
+const unsigned int GR_DEFAULT_BUFFER_BYTES = 65536;    // GNU Radio's buffers without a max_output_buffer
+const unsigned int AGC_WAIT_MS = 200;          // the AGC thread checks for shutdown this often
+const unsigned int AGC_SETTLE_TIMEOUT_MS = 500;   // how long the scanner waits for the gain of a new channel
+const float AGC_HIGH_PEAK = 0.9f;              // 99.9th percentile above this turns the gain down
+const float AGC_LOW_PEAK = 0.35f;              // and below this up, the ADC is wasting bits
+const float AGC_MAX_CLIP = 1e-4f;              // clipped share of the samples that turns the gain down
+const float AGC_HEAVY_CLIP = 1e-2f;            // ... by AGC_FAST_STEPS at once
+const int AGC_FAST_STEPS = 3;
+// Gains of the R820T, for the ADC model of a replay
+const double REPLAY_GAIN_STEPS[] = {
+    0.0, 0.9, 1.4, 2.7, 3.7, 7.7, 8.7, 12.5, 14.4, 15.7, 16.6, 19.7, 20.7, 22.9, 25.4,
+    28.0, 29.7, 32.8, 33.8, 36.4, 37.2, 38.6, 40.2, 42.1, 43.4, 43.9, 44.5, 48.0, 49.6};
+
+// Station quality
+const float QUALITY_FULL_SNR_DB = 40.0f;     // audio SNR that scores full marks
+const float QUALITY_SNR_WEIGHT = 0.7f;       // the rest of the score is the RDS groups received
+const float FM_IMPROVEMENT_DB = 15.0f;       // audio SNR over CNR well above the FM threshold, for wideband scans
+const double RDS_GROUP_RATE = 1187.5 / 104;  // groups/s, 104 bits each at 1187.5 bit/s
+const double RDS_BLER_MIN_S = 0.5;           // MPX needed before the group count means anything
+// MPX after a reset before the first group can come out: the RDS filters and carrier/symbol loops
+// settle in a few tens of ms, then gr-rds needs up to a group to find the block sync and the rest of
+// the group it found it in before it passes one on
+const double RDS_SYNC_ALLOWANCE_S = 2.0 / RDS_GROUP_RATE;
+
+// Dongles opened by a tuner in this process.  A dongle can only be opened once, so a second
+// tuner on the same device_index is refused instead of failing inside librtlsdr.
+static std::mutex device_pool_mtx;
+static std::set<unsigned int> devices_in_use;
+
+// One half of the double buffered station list
+struct station_list_buf {
+    station_info stations[MAX_FM_STATIONS];
+    unsigned int len = 0;
+    double completed = 0.0;  // wall clock time the scan finished, in seconds since the epoch
+    bool from_cache = false; // loaded from the station cache, no scan has run yet
+};
+
+// A station demodulated from one PFB channel of the capture, alongside the tuner's own audio path.
+// Virtual tuners only decode RDS and measure signal strength, they don't produce audio.
+struct virtual_tuner {
+    int id;
+    double freq;    // MHz
+    bool in_span;   // false while the tuned frequency is too far away to reach freq
+    int channel;    // PFB channel carrying freq, only meaningful while in_span
+    gr::analog::wfmrcv::sptr wfm;
+    gr::analog::power_probe_f::sptr probe;
+    gr::analog::rds_receiver::sptr rds;
+};
+
+// rtl_group_sched_t, kept by the tuner
+struct block_group_sched {
+    std::vector<int> cpu_cores;   // empty for the tuner's cpu_cores
+    int priority = 0;
+    int max_noutput_items = 0;
+};
+
+// Handle given to C for a PCM ring.  Keeps the shared memory mapped until rtl_pcm_close.
+struct rtl_pcm_ring {
+    gr::blocks::pcm_ring::sptr ring;
+};
 
 // Structure to hold smart pointers to flowgraph blocks for the rtl sdr tuner
 struct rtl_ctx {
     gr::top_block_sptr top_block;
-    osmosdr::source::sptr rtl_source;
-    gr::filter::rational_resampler_base_fff::sptr rresamp0;
-    gr::analog::probe_avg_mag_sqrd_f::sptr avg_magnitude;
+    unsigned int device_index;
+    bool owns_device = false;       // device_index is claimed in the device pool
+    std::vector<int> cpu_cores;   // empty means the flowgraph threads aren't pinned
+    osmosdr::source::sptr rtl_source;              // empty when replaying or with the cu8 front end
+    gr::blocks::rtl_cu8_source::sptr cu8_source;   // the cu8 front end, feeds channelizer
+    gr::blocks::iq_replay_source_c::sptr replay_source;
+    gr::basic_block_sptr source;                   // whichever of the three is open
+    gr::blocks::iq_recorder_c::sptr recorder;      // empty unless recording
+    gr::blocks::retune_tagger_cc::sptr retune_tagger;
+    gr::blocks::copy::sptr scan_gate;              // between retune_tagger and channelizer, empty with cu8_source
+    gr::basic_block_sptr channelizer;              // after retune_tagger, or before it with cu8_source
+    gr::basic_block_sptr wfm;
+    gr::filter::rational_resampler_base_fff::sptr rresamp0;    // mono or left audio at 48 kHz
+    gr::filter::rational_resampler_base_fff::sptr rresamp0_r;  // right audio at 48 kHz, stereo only
+    gr::blocks::retune_mute_ff::sptr audio_mute;               // after rresamp0, the sinks connect here
+    gr::blocks::retune_mute_ff::sptr audio_mute_r;             // after rresamp0_r
+    bool stereo;
+    gr::analog::power_probe_f::sptr avg_magnitude;
+    gr::analog::channel_quality::sptr quality;
     gr::analog::rds_receiver::sptr rds;
-    station_info station_list[MAX_FM_STATIONS];
-    unsigned int station_list_len;
-    std::mutex station_list_mtx;
+    gr::fft::band_power_probe::sptr band_probe;
+    gr::rds::station_cache::sptr station_cache;   // empty if the tuner has no cache file
+    gr::blocks::latency_probe_f::sptr latency_probe;
+    rtl_startup_stats_t startup_stats;
+    uint64_t create_time_ns = 0;   // retune_tagger_cc::timestamp_now() clock
+    uint64_t start_time_ns = 0;
+    uint64_t resume_time_ns = 0;
+    uint64_t first_audio_ns = 0;   // first audio after rtl_start_fm, kept once the tuner is paused
+
+    // rtl_pause and rtl_resume.  rtl_wait only waits on the flowgraph while it isn't paused.
+    std::mutex lifecycle_mtx;          // held through a whole pause, resume or stop
+    std::mutex run_mtx;                // paused and waiters
+    std::condition_variable run_cv;    // either of them changed
+    std::atomic<bool> paused{false};   // written under run_mtx, read unlocked by the scanner
+    unsigned int waiters = 0;          // threads inside top_block->wait() in rtl_wait
+    rtl_rds_callback_t rds_callback = NULL;
+    void* rds_callback_data = NULL;
+    double samp_rate;
+    double quad_rate;
+    double audio_rate;   // rate out of wfm, before the 48 kHz resamplers
+    rtl_latency_profile_t latency_profile = RTL_LATENCY_DEFAULT;
+    block_group_sched group_sched[RTL_NUM_BLOCK_GROUPS];
+    bool perf_counters = false;
+    uint64_t perf_start_ns = 0;   // start or last rtl_reset_perf_stats, for busy_percent
+    rtl_scan_mode_t scan_mode = RTL_SCAN_SEQUENTIAL;
+    // Software AGC, headroom_probe is empty unless it runs
+    gr::blocks::adc_headroom_probe::sptr headroom_probe;
+    std::thread agc_thread;
+    std::atomic<bool> agc_stop{false};
+    std::atomic<bool> agc_hold{false};       // wideband scans freeze the gain while they compare windows
+    std::mutex agc_mtx;                      // the gain and everything below
+    std::condition_variable agc_cv;          // agc_settled became true
+    std::vector<double> gain_steps;          // the tuner's gains, lowest first
+    unsigned int gain_index = 0;             // into gain_steps
+    bool agc_settled = false;                // the gain suits the tuned channel
+    uint64_t agc_stale_seq = 0;              // headroom windows up to this one are from before a change
+    double replay_gain_ref = 0.0;            // gain a replay with the ADC model was recorded at
+    int agc_channel = -1;                    // channel tuned, -1 off the channel grid
+    int gain_presets[FM_NUM_CHANNELS];       // gain_index found for each channel, -1 for none
+    rtl_agc_stats_t agc_stats = {};
+
+    std::mutex sink_mtx;         // sinks and reconfig_stats, held across a sink change
     gr::block_vector_t sinks;
+    rtl_reconfig_stats_t reconfig_stats = {};
+
+    // The scanner thread fills station_lists[(seq + 1) & 1] and then bumps station_list_seq, so
+    // readers always copy station_lists[seq & 1] and retry if the sequence moved while they copied
+    station_list_buf station_lists[2];
+    std::atomic<unsigned int> station_list_seq{0};
+
+    std::thread scan_thread;
+    std::mutex scan_mtx;
+    std::condition_variable scan_cv;
+    bool scan_requested = false;                   // guarded by scan_mtx
+    std::atomic<bool> scan_stop{false};
+    std::atomic<bool> scan_active{false};
+    std::atomic<unsigned int> scan_interval_ms{0};  // 0 means only scan when requested
+
+    // Time from a scanner retune until its first sample reached the probe, RTL_SETTLE_HIST_BIN_MS per bin
+    std::atomic<unsigned int> settle_hist[RTL_SETTLE_HIST_BINS] = {};
+
+    // Channelizer for the virtual tuners, created with the first one.  Its outputs are connected in
+    // the order of virtual_tuners and the channel map says which channel each output carries.
+    std::mutex virtual_mtx;
+    gr::filter::pfb_channelizer_ccf::sptr pfb;
+    unsigned int pfb_channels = 0;
+    std::vector<virtual_tuner> virtual_tuners;
+    int next_virtual_id = 0;
+    bool wideband_scan = false;   // the RTL runs at the scan's rate, which the PFB isn't designed for
 };
 
+// @param tuner The tuner context
+// @return the rate of the samples through retune_tagger
+double tagger_rate(const rtl_ctx_t* tuner)
+{
+    return tuner->cu8_source ? tuner->quad_rate : tuner->samp_rate;
+}
+
+void remap_virtual_tuners(rtl_ctx_t* tuner, double center_freq);
+gr::basic_block_vector_t tuner_blocks(rtl_ctx_t* tuner);
+void bound_block_buffers(gr::basic_block_sptr blk, int max_items);
+double latency_budget_s(rtl_ctx_t* tuner);
+void apply_block_sched(gr::basic_block_sptr blk, const block_group_sched& sched);
+bool apply_block_realtime(gr::basic_block_sptr blk, int priority);
+
+// @param freq Frequency in MHz
+// @return the FM channel freq is on, -1 between channels and outside the band
+int channel_on_grid(double freq)
+{
+    int channel = int(round((freq - FM_BAND_START_MHZ) / FM_CHANNEL_SPACING_MHZ));
+    if (channel < 0 || channel >= int(FM_NUM_CHANNELS) ||
+        fabs(FM_BAND_START_MHZ + channel * FM_CHANNEL_SPACING_MHZ - freq) > 1e-3) {
+        return -1;
+    }
+    return channel;
+}
+
+// Sets the tuner gain to one of its steps.  Call with agc_mtx held.
+// @param tuner The tuner context
+// @param index Into gain_steps
+void set_gain_step(rtl_ctx_t* tuner, unsigned int index)
+{
+    double gain = tuner->gain_steps[index];
+    if (tuner->cu8_source) {
+        gain = tuner->cu8_source->set_gain(gain);
+    }
+    else if (tuner->replay_source) {
+        tuner->replay_source->set_adc_gain(gain - tuner->replay_gain_ref, OSMOSDR_TRANSFER_SAMPLES);
+    }
+    else {
+        gain = tuner->rtl_source->set_gain(gain, 0);
+    }
+    tuner->gain_index = index;
+    tuner->agc_stats.gain_db = gain;
+}
+
+// Samples the headroom probe can still get from before a gain change: the USB transfer the dongle
+// was filling, and what the source's output buffer holds
+// @param tuner The tuner context
+uint64_t agc_holdoff_samples(rtl_ctx_t* tuner)
+{
+    uint64_t transfer = tuner->cu8_source ? tuner->cu8_source->transfer_samples() : OSMOSDR_TRANSFER_SAMPLES;
+    size_t item_size = tuner->cu8_source ? 2 * sizeof(uint8_t) : sizeof(gr_complex);
+    double budget_s = latency_budget_s(tuner);
+    uint64_t buffer = budget_s > 0.0 ? uint64_t(tuner->samp_rate * budget_s) : GR_DEFAULT_BUFFER_BYTES / item_size;
+    return transfer + buffer;
+}
+
+// Samples the retune tagger still passes from before a retune, at its own rate.  With the cu8 front
+// end the tagger is behind the channelizer, so that's the source's holdoff decimated plus what the
+// channelizer's output buffer holds.
+// @param tuner The tuner context
+uint64_t retune_holdoff_samples(rtl_ctx_t* tuner)
+{
+    uint64_t holdoff = agc_holdoff_samples(tuner);
+    if (!tuner->cu8_source) {
+        return holdoff;
+    }
+    double budget_s = latency_budget_s(tuner);
+    uint64_t buffer = budget_s > 0.0 ? uint64_t(tuner->quad_rate * budget_s) : GR_DEFAULT_BUFFER_BYTES / sizeof(gr_complex);
+    return uint64_t(holdoff * tuner->quad_rate / tuner->samp_rate) + buffer;
+}
+
+// Starts the headroom windows over after a gain change or retune.  Call with agc_mtx held.
+// @param tuner The tuner context
+void agc_restart_windows(rtl_ctx_t* tuner)
+{
+    tuner->agc_stale_seq = tuner->headroom_probe->reset(agc_holdoff_samples(tuner));
+}
+
+// Readies the software AGC for a retune.  A channel tuned before gets the gain found for it right
+// away, anywhere else the AGC steps from the current gain.
+// @param tuner The tuner context
+// @param freq New frequency in MHz
+void agc_retune(rtl_ctx_t* tuner, double freq)
+{
+    if (!tuner->headroom_probe) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(tuner->agc_mtx);
+        tuner->agc_channel = channel_on_grid(freq);
+        int preset = tuner->agc_channel >= 0 ? tuner->gain_presets[tuner->agc_channel] : -1;
+        if (preset >= 0 && unsigned(preset) != tuner->gain_index) {
+            set_gain_step(tuner, preset);
+            ++tuner->agc_stats.gain_changes;
+        }
+        tuner->agc_settled = preset >= 0;
+        agc_restart_windows(tuner);
+    }
+    tuner->agc_cv.notify_all();
+}
+
+// Blocks until the software AGC has found the gain for the tuned channel.  Returns at once without it.
+// @param tuner The tuner context
+// @param timeout_ms How long to wait
+// @return false if it was still stepping after timeout_ms
+bool wait_agc_settled(rtl_ctx_t* tuner, unsigned int timeout_ms)
+{
+    if (!tuner->headroom_probe) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(tuner->agc_mtx);
+    return tuner->agc_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [tuner] { return tuner->agc_settled; });
+}
+
+// @param window The headroom probe's latest window
+// @return how many gain steps it asks for, negative to turn the gain down
+int agc_steps_wanted(const gr::blocks::headroom_window& window)
+{
+    if (window.clip_fraction > AGC_HEAVY_CLIP) {
+        return -AGC_FAST_STEPS;
+    }
+    if (window.clip_fraction > AGC_MAX_CLIP || window.peak > AGC_HIGH_PEAK) {
+        return -1;
+    }
+    if (window.peak < AGC_LOW_PEAK) {
+        return 1;
+    }
+    return 0;
+}
+
+// Body of the software AGC thread.  Steps the gain after every headroom window that asks for it
+// and, once a window is happy with the gain, keeps it as the tuned channel's preset.
+// @param tuner The tuner context
+void agc_worker(rtl_ctx_t* tuner)
+{
+    uint64_t seen = 0;
+    gr::blocks::headroom_window window;
+    while (!tuner->agc_stop) {
+        if (!tuner->headroom_probe->wait_for_window(seen, AGC_WAIT_MS, window)) {
+            continue;
+        }
+        seen = window.seq;
+        bool now_settled = false;
+        {
+            std::lock_guard<std::mutex> lock(tuner->agc_mtx);
+            tuner->agc_stats.peak_dbfs = 20.0 * log10(window.peak);
+            tuner->agc_stats.clip_percent = 100.0 * window.clip_fraction;
+            if (window.seq <= tuner->agc_stale_seq) {
+                continue;
+            }
+            if (tuner->agc_hold) {
+                continue;
+            }
+            int last = int(tuner->gain_steps.size()) - 1;
+            int index = std::min(std::max(int(tuner->gain_index) + agc_steps_wanted(window), 0), last);
+            if (index != int(tuner->gain_index)) {
+                set_gain_step(tuner, index);
+                ++tuner->agc_stats.gain_changes;
+                agc_restart_windows(tuner);
+                continue;
+            }
+            // Happy, or at the end of the tuner's range
+            if (tuner->agc_channel >= 0) {
+                if (tuner->gain_presets[tuner->agc_channel] < 0) {
+                    ++tuner->agc_stats.presets;
+                }
+                tuner->gain_presets[tuner->agc_channel] = tuner->gain_index;
+            }
+            now_settled = !tuner->agc_settled;
+            tuner->agc_settled = true;
+        }
+        if (now_settled) {
+            tuner->agc_cv.notify_all();
+        }
+    }
+}
+
 // Sets the FM center frequency for the given tuner
 // Part of the external C API
 // @param tuner Pointer to the tuner context
 // @param freq Frequency in megahertz e.g. 105.9
 void rtl_set_fm(rtl_ctx_t* tuner, double freq)
 {
-    tuner->rtl_source->set_center_freq(freq * 1e6);
+    // Before anything is armed, a rejected retune leaves the audio, RDS and AGC as they were
+    if (tuner->replay_source) {
+        printf("Error: rtl_set_fm - a recording is playing, it cannot be retuned\n");
+        return;
+    }
+    // The old station's samples still in the buffers are faded out, and the new one fades in once
+    // its first sample reaches the sinks.  The RDS chain clears its state when the sample reaches it.
+    // The retune tag goes past the samples still on their way from the dongle, so everything that
+    // waits for it only sees the new frequency.
+    tuner->audio_mute->arm(freq * 1e6);
+    if (tuner->stereo) {
+        tuner->audio_mute_r->arm(freq * 1e6);
+    }
+    agc_retune(tuner, freq);
+    if (tuner->cu8_source) {
+        tuner->cu8_source->set_center_freq(freq * 1e6);
+    }
+    else {
+        tuner->rtl_source->set_center_freq(freq * 1e6);
+    }
+    tuner->retune_tagger->tag_retune(freq * 1e6, retune_holdoff_samples(tuner));
+    remap_virtual_tuners(tuner, freq);
 }
 
 // Gets the current center FM frequency that the tuner is set to
@@ -63,121 +450,765 @@ void rtl_set_fm(rtl_ctx_t* tuner, double freq)
 // @returns currently tuned frequency in MHz
 double rtl_get_fm(rtl_ctx_t* tuner)
 {
+    if (tuner->cu8_source) {
+        return tuner->cu8_source->center_freq() / 1e6;
+    }
+    if (!tuner->rtl_source) {
+        return tuner->replay_source->center_freq() / 1e6;
+    }
     return tuner->rtl_source->get_center_freq() / 1e6;
 }
 
+// Replaces the tuner's station list with the result of a scan.  Only the scanner thread publishes,
+// apart from the list loaded from the station cache before the scanner thread is started.
+// @param tuner Pointer to the tuner context
+// @param stations Stations found by the scan
+// @param num_stations Number of entries in stations
+// @param completed Wall clock time the scan finished, in seconds since the epoch
+// @param from_cache true if the list was loaded from the station cache
+void publish_stations(rtl_ctx_t* tuner, const station_info* stations, unsigned int num_stations, double completed, bool from_cache)
+{
+    unsigned int seq = tuner->station_list_seq.load(std::memory_order_relaxed);
+    station_list_buf& back = tuner->station_lists[(seq + 1) & 1];
+    memcpy(back.stations, stations, sizeof(station_info) * num_stations);
+    back.len = num_stations;
+    back.completed = completed;
+    back.from_cache = from_cache;
+    tuner->station_list_seq.store(seq + 1, std::memory_order_release);
+}
+
+// @return the wall clock time in seconds since the epoch
+double wall_time()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Stores the stations a full scan found in the station cache, if the tuner has one
+// @param tuner Pointer to the tuner context
+// @param stations Stations found by the scan
+// @param levels Signal level of every station, as the scan measured it
+// @param num_stations Number of entries in stations
+// @param completed Wall clock time the scan finished
+void cache_scan(rtl_ctx_t* tuner, const station_info* stations, const float* levels, unsigned int num_stations, double completed)
+{
+    if (!tuner->station_cache) {
+        return;
+    }
+    std::vector<int> channels;
+    for (unsigned int i = 0; i < num_stations; ++i) {
+        channels.push_back(tuner->station_cache->channel_of(stations[i].frequency));
+    }
+    tuner->station_cache->record_scan(channels, std::vector<float>(levels, levels + num_stations), completed);
+}
+
+// Fills in name and genre from the station cache where the scan didn't decode them
+// @param tuner Pointer to the tuner context
+// @param station Station to complete
+// @param pi PI the scan decoded, 0 if none.  Cached data is only used if it matches or nothing was decoded.
+void complete_from_cache(rtl_ctx_t* tuner, station_info& station, unsigned int pi)
+{
+    gr::rds::station_cache_entry entry;
+    if (!tuner->station_cache || !tuner->station_cache->lookup(tuner->station_cache->channel_of(station.frequency), entry)) {
+        return;
+    }
+    if (pi != 0 && pi != entry.pi) {
+        return;
+    }
+    if (station.name[0] == '\0') {
+        strncpy(station.name, entry.callsign, STATION_NAME_MAX_LEN);
+    }
+    if (station.genre[0] == '\0') {
+        strncpy(station.genre, entry.genre, STATION_GENRE_MAX_LEN);
+    }
+}
+
+// Adds the time a retune took until its first sample at the new frequency reached the probes to the
+// tuner's settle histogram.  That's after the retune holdoff, the samples still from before don't count.
+// @param tuner Pointer to the tuner context
+// @param retune_start Time just before the tuner was retuned
+void record_settle_time(rtl_ctx_t* tuner, std::chrono::steady_clock::time_point retune_start)
+{
+    long long settle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - retune_start).count();
+    unsigned int bin = std::min((unsigned int)(settle_ms / RTL_SETTLE_HIST_BIN_MS), RTL_SETTLE_HIST_BINS - 1u);
+    ++tuner->settle_hist[bin];
+}
+
+// Gets the histogram of how long scanner retunes took until the first sample at the new
+// frequency reached the measurement probes
+// Part of the external C API
+// @param tuner Pointer to the tuner context
+// @param counts_out Receives the number of retunes per RTL_SETTLE_HIST_BIN_MS wide bin, the last
+//                   bin also counts everything slower
+// @param max_bins Size of counts_out
+// @returns the number of bins copied
+unsigned int rtl_get_settle_histogram(rtl_ctx_t* tuner, unsigned int* counts_out, unsigned int max_bins)
+{
+    unsigned int num_bins = std::min(max_bins, (unsigned int)RTL_SETTLE_HIST_BINS);
+    for (unsigned int bin = 0; bin < num_bins; ++bin) {
+        counts_out[bin] = tuner->settle_hist[bin];
+    }
+    return num_bins;
+}
+
+// Scores a station for rtl_rank_stations: mostly on how clean its audio is, the rest on how much of
+// its RDS gets through
+// @param snr_db Audio SNR as channel_quality measures it
+// @param rds_bler Share of RDS groups lost, only used if have_rds
+// @return 0 to 100
+float station_quality(float snr_db, float rds_bler, bool have_rds)
+{
+    float snr_part = std::min(std::max(snr_db / QUALITY_FULL_SNR_DB, 0.0f), 1.0f);
+    if (!have_rds) {
+        return 100.0f * snr_part;
+    }
+    return 100.0f * (QUALITY_SNR_WEIGHT * snr_part + (1.0f - QUALITY_SNR_WEIGHT) * (1.0f - rds_bler));
+}
+
+// Fills in the metrics of the tuned station from channel_quality and the RDS decoded since they
+// were last reset.  gr-rds only passes on groups that decoded cleanly, so the block error rate is
+// counted from the groups missing against the 11.4 groups/s an RDS station sends.  The clock for
+// that starts RDS_SYNC_ALLOWANCE_S after the reset, no groups are lost before the decoder syncs.
+// @param tuner The tuner context
+// @param rds Snapshot of the tuner's RDS
+// @param station Receives the metrics
+void fill_station_metrics(rtl_ctx_t* tuner, const gr::rds::rds_snapshot& rds, station_info& station)
+{
+    gr::analog::channel_metrics metrics;
+    tuner->quality->get_metrics(metrics);
+    station.metrics = RTL_METRIC_RSSI;
+    station.rssi_dbfs = float(metrics.rssi_dbfs);
+    if (metrics.mpx_seconds <= 0.0) {
+        station.quality = 0.0f;
+        return;
+    }
+    station.metrics |= RTL_METRIC_SNR | RTL_METRIC_PILOT;
+    station.snr_db = float(metrics.snr_db);
+    station.pilot_snr_db = float(metrics.pilot_snr_db);
+    bool have_rds = false;
+    if (metrics.mpx_seconds >= RDS_BLER_MIN_S) {
+        uint64_t groups = 0;
+        for (unsigned int type = 0; type < gr::rds::RDS_GROUP_TYPES; ++type) {
+            groups += rds.group_counts[type];
+        }
+        // Without a single group there's no telling a station without RDS from a lossy one
+        if (groups > 0) {
+            double expected = (metrics.mpx_seconds - RDS_SYNC_ALLOWANCE_S) * RDS_GROUP_RATE;
+            station.rds_bler = float(std::max(0.0, 1.0 - groups / expected));
+            station.metrics |= RTL_METRIC_RDS;
+            have_rds = true;
+        }
+    }
+    station.quality = station_quality(station.snr_db, station.rds_bler, have_rds);
+}
+
 // Iterates through the FM band, measures signal strength of each station, and populates station list
 // Note: this is a long-running function and should be run in the background
 // @param tuner Pointer to the tuner context
-void scan_fm_stations(rtl_ctx_t* tuner) {
-    // TODO: these constants will likely need adjustments depending on the setup, should be sampled/benchmarked somehow
-    const unsigned int SWITCH_DELAY_MS = 1500; // time to wait between switching stations and measuring the signal strength
-    const unsigned int MEASURE_MS = 1500;      // time to sample the signal strength of each frequency (takes the highest sample)
-    const double POWER_THRESHOLD = 3.0;        // if the magnitude is above this threshold, it's not a valid staiton
+// @returns false if the scan was aborted by rtl_pause or rtl_destroy_tuner
+bool scan_fm_stations_sequential(rtl_ctx_t* tuner) {
+    // Instead of fixed settle and measure delays the scanner waits for the retune tag to reach the
+    // probe, drops a couple of windows for the tuner and IIR filters to settle, and then measures
+    // the SNR until it is clear of SNR_THRESHOLD_DB.  The tag is only placed once the samples queued
+    // from the previous channel have passed, see retune_holdoff_samples, so the guard doesn't have
+    // to cover them.
+    const unsigned int RETUNE_TIMEOUT_MS = 2000;  // give up on a frequency if the retune never shows up
+    const unsigned int WINDOW_TIMEOUT_MS = 1000;  // give up on a frequency if the flowgraph stops delivering samples
+    const unsigned int GUARD_WINDOWS = 2;         // windows dropped after the retune tag for the PLL and filters (20 ms)
+    const double SNR_MIN_S = 0.06;                // MPX needed before the SNR means anything
+    const double SNR_STEP_S = 0.03;               // measured for this much longer while the SNR is close
+    const double SNR_MAX_S = 0.3;                 // stop and decide on the SNR after this much MPX
+    const double SNR_THRESHOLD_DB = 15.0;         // audio SNR a station needs, noise is around 0 dB
+    const double SNR_MARGIN_DB = 5.0;             // SNRs this close to the threshold are measured longer
+    const unsigned int RDS_DWELL_MS = 1500;       // how long a found station is given to decode its PI and PTY
+    const unsigned int RDS_POLL_MS = 50;
     unsigned int found_stations = 0;
     station_info stations_out[MAX_FM_STATIONS];
+    float levels_out[MAX_FM_STATIONS];
     printf("Starting scan\n");
 
-    for (double freq = 87.9; freq <= 107.9; freq += 0.2) {
+    for (unsigned int channel = 0; channel < FM_NUM_CHANNELS && found_stations < MAX_FM_STATIONS; ++channel) {
+        if (tuner->scan_stop || tuner->paused) {
+            printf("Scan aborted\n");
+            return false;
+        }
+        double freq = FM_BAND_START_MHZ + channel * FM_CHANNEL_SPACING_MHZ;
+        tuner->avg_magnitude->arm_retune(freq * 1e6);
+        tuner->rds->arm_retune(freq * 1e6);
+        std::chrono::steady_clock::time_point retune_start = std::chrono::steady_clock::now();
         rtl_set_fm(tuner, freq);
-        std::this_thread::sleep_for(std::chrono::milliseconds(SWITCH_DELAY_MS));
+        if (!tuner->avg_magnitude->wait_for_retune(RETUNE_TIMEOUT_MS)) {
+            printf("\tRetune to %f never reached the probe, skipping\n", freq);
+            continue;
+        }
+        record_settle_time(tuner, retune_start);
+        // Channels scanned before start at their preset gain, so this only waits on the first scan
+        wait_agc_settled(tuner, AGC_SETTLE_TIMEOUT_MS);
+        if (!tuner->avg_magnitude->wait_for_windows(GUARD_WINDOWS, WINDOW_TIMEOUT_MS)) {
+            continue;
+        }
+        // The RDS chain resets itself on the retune, a reset before that wouldn't stick
+        if (!tuner->rds->wait_for_retune(RETUNE_TIMEOUT_MS)) {
+            printf("\tRetune to %f never reached the RDS decoder, skipping\n", freq);
+            continue;
+        }
         tuner->rds->rds_sink->reset();
-        double sample_sum = 0;
-        unsigned int num_samples = 0;
-        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
-        while (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count() < MEASURE_MS) {
-            sample_sum += tuner->avg_magnitude->level();
-            ++num_samples;
-        }
-        if (num_samples > 0) {
-            double sample_avg = sample_sum / num_samples;
-            if (sample_avg < POWER_THRESHOLD) {
-                std::string name = tuner->rds->rds_sink->get_curr_station();
-                std::string genre = tuner->rds->rds_sink->get_curr_station_type();
-                printf("\tFound station: %f, %s, %s\n", freq, name.c_str(), genre.c_str());
+        tuner->quality->reset();
+        std::chrono::steady_clock::time_point measure_start = std::chrono::steady_clock::now();
+
+        // Sleeps until enough MPX has been measured, so the result doesn't depend on how fast this
+        // thread can poll.  Clear stations and empty channels are decided after SNR_MIN_S.
+        bool is_station = false;
+        gr::analog::channel_metrics metrics;
+        double wanted = SNR_MIN_S;
+        while (tuner->quality->wait_for_mpx(wanted, WINDOW_TIMEOUT_MS)) {
+            tuner->quality->get_metrics(metrics);
+            if (fabs(metrics.snr_db - SNR_THRESHOLD_DB) > SNR_MARGIN_DB || metrics.mpx_seconds >= SNR_MAX_S) {
+                is_station = metrics.snr_db >= SNR_THRESHOLD_DB;
+                break;
+            }
+            wanted = metrics.mpx_seconds + SNR_STEP_S;
+        }
+        if (!is_station) {
+            continue;
+        }
+
+        // Stay until the PI is decoded.  If it matches the cached one the cache has the rest,
+        // otherwise stay for the PTY as well.  Whatever isn't decoded in time comes from the cache.
+        // Either way stay long enough to count the RDS groups for the block error rate.
+        gr::rds::station_cache_entry cached;
+        bool have_cached = tuner->station_cache && tuner->station_cache->lookup(tuner->station_cache->channel_of(freq), cached);
+        gr::rds::rds_snapshot rds;
+        tuner->rds->rds_sink->get_snapshot(rds);
+        while (!tuner->scan_stop && !tuner->paused && std::chrono::steady_clock::now() - measure_start < std::chrono::milliseconds(RDS_DWELL_MS)) {
+            bool counted = std::chrono::steady_clock::now() - measure_start >= std::chrono::duration<double>(RDS_BLER_MIN_S);
+            if (counted && rds.pi != 0 && (rds.pty[0] != '\0' || (have_cached && cached.pi == rds.pi))) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(RDS_POLL_MS));
+            tuner->rds->rds_sink->get_snapshot(rds);
+        }
+        station_info station;
+        memset(&station, 0, sizeof(station));
+        station.frequency = freq;
+        strncpy(station.name, rds.callsign, STATION_NAME_MAX_LEN);
+        strncpy(station.genre, rds.pty, STATION_GENRE_MAX_LEN);
+        complete_from_cache(tuner, station, rds.pi);
+        fill_station_metrics(tuner, rds, station);
+        printf("\tFound station: %f, %.*s, %.*s, SNR %.1f dB\n", freq, STATION_NAME_MAX_LEN, station.name,
+            STATION_GENRE_MAX_LEN, station.genre, station.snr_db);
+        levels_out[found_stations] = station.snr_db;
+        stations_out[found_stations++] = station;
+    }
+    double completed = wall_time();
+    publish_stations(tuner, stations_out, found_stations, completed, false);
+    cache_scan(tuner, stations_out, levels_out, found_stations, completed);
+    printf("Finished scan\n");
+    return true;
+}
+
+// Scans the FM band in a handful of wide windows instead of retuning to every channel.  The RTL is
+// switched to its maximum stable sample rate and the band_power_probe measures the power of every
+// channel inside the captured span from one averaged FFT.  Channels that stand far enough above the
+// band's noise floor are reported as stations.  RDS is not decoded, so name and genre are only
+// filled in for stations the station cache knows.  The audio is muted for the whole scan.
+// @param tuner Pointer to the tuner context
+// @returns false if the scan was aborted by rtl_pause or rtl_destroy_tuner
+bool scan_fm_stations_wideband(rtl_ctx_t* tuner) {
+    const double SCAN_SAMP_RATE = 2.4e6;           // highest rate the RTL2832 delivers without dropping samples
+    const unsigned int CHANNELS_PER_WINDOW = 10;   // 2 MHz of the 2.4 MHz span, the edges are eaten by the anti-alias filter
+    const unsigned int RETUNE_TIMEOUT_MS = 2000;   // give up on a window if the retune never shows up
+    const double GUARD_S = 0.003;                  // dropped after the retune tag for the tuner PLL to settle
+    const double FFT_S = 0.027;                    // averaged per window
+    const unsigned int FRAME_TIMEOUT_MS = 1000;    // give up on a window if the flowgraph stops delivering samples
+    const double CHANNEL_MEASURE_BW = 150e3;       // part of each 200 kHz channel that is integrated
+    const double NOISE_FLOOR_PERCENTILE = 0.25;    // most of the band is empty, so a low percentile tracks the noise
+    const double SNR_THRESHOLD_DB = 10.0;          // how far above the noise floor a channel has to be to be a station
+
+    double channel_power[FM_NUM_CHANNELS];
+    bool channel_measured[FM_NUM_CHANNELS];
+    std::fill(channel_power, channel_power + FM_NUM_CHANNELS, 0.0);
+    std::fill(channel_measured, channel_measured + FM_NUM_CHANNELS, false);
+
+    double prev_freq = rtl_get_fm(tuner);
+    printf("Starting wideband scan\n");
+
+    // Channel powers are compared across windows, so they all have to be at the same gain
+    tuner->agc_hold = true;
+    // The channelizer, wfmrcv and the audio after it are designed for samp_rate.  At the scan's
+    // rate they would play garbage at 2.4 times the CPU, and the audio sinks' pace would hold the
+    // source back so band_probe got gapped samples.  The audio is muted for the whole scan and the
+    // gate drops everything in front of the channelizer, the sinks underrun until it is over.
+    tuner->audio_mute->hold(true);
+    if (tuner->stereo) {
+        tuner->audio_mute_r->hold(true);
+    }
+    tuner->scan_gate->set_enabled(false);
+    tuner->rtl_source->set_sample_rate(SCAN_SAMP_RATE);
+    double scan_rate = tuner->rtl_source->get_sample_rate();
+    unsigned int fft_size = tuner->band_probe->fft_size();
+    double bin_hz = scan_rate / fft_size;
+    int half_bins = int(CHANNEL_MEASURE_BW / 2.0 / bin_hz);
+    // The retune tag is placed past the samples still queued from the previous window, a whole USB
+    // transfer and the source's buffer (retune_holdoff_samples).  Those are more than a window's
+    // frames, so without the holdoff whole spectra would land on the wrong channels.
+    unsigned int guard_frames = (unsigned int)ceil(GUARD_S * scan_rate / fft_size);
+    unsigned int fft_frames = (unsigned int)ceil(FFT_S * scan_rate / fft_size);
+    tuner->band_probe->set_enabled(true);
+
+    for (unsigned int first = 0; first < FM_NUM_CHANNELS && !tuner->scan_stop && !tuner->paused; first += CHANNELS_PER_WINDOW) {
+        // Center the window between two channels so the DC spike never lands on a channel
+        double center = FM_BAND_START_MHZ + (first + (CHANNELS_PER_WINDOW - 1) / 2.0) * FM_CHANNEL_SPACING_MHZ;
+        tuner->band_probe->arm_retune(center * 1e6);
+        std::chrono::steady_clock::time_point retune_start = std::chrono::steady_clock::now();
+        rtl_set_fm(tuner, center);
+        if (!tuner->band_probe->wait_for_retune(RETUNE_TIMEOUT_MS)) {
+            printf("\tRetune to %f never reached the probe, skipping window\n", center);
+            continue;
+        }
+        record_settle_time(tuner, retune_start);
+        if (!tuner->band_probe->wait_for_frames(guard_frames, FRAME_TIMEOUT_MS)) {
+            continue;
+        }
+        tuner->band_probe->reset();
+        if (!tuner->band_probe->wait_for_frames(fft_frames, FRAME_TIMEOUT_MS)) {
+            printf("\tNo samples at %f, skipping window\n", center);
+            continue;
+        }
+        std::vector<float> spectrum = tuner->band_probe->get_spectrum();
+
+        unsigned int last = std::min(first + CHANNELS_PER_WINDOW, FM_NUM_CHANNELS);
+        for (unsigned int channel = first; channel < last; ++channel) {
+            double offset_hz = (FM_BAND_START_MHZ + channel * FM_CHANNEL_SPACING_MHZ - center) * 1e6;
+            int center_bin = int(fft_size / 2) + int(round(offset_hz / bin_hz));
+            int lo = std::max(center_bin - half_bins, 0);
+            int hi = std::min(center_bin + half_bins, int(fft_size) - 1);
+            double power = 0.0;
+            for (int bin = lo; bin <= hi; ++bin) {
+                power += spectrum[bin];
+            }
+            channel_power[channel] = power / (hi - lo + 1);
+            channel_measured[channel] = true;
+        }
+    }
+
+    tuner->band_probe->set_enabled(false);
+    tuner->rtl_source->set_sample_rate(tuner->samp_rate);
+    tuner->agc_hold = false;
+    // The mute is armed for prev_freq before it lets go, so it stays shut until the samples at
+    // samp_rate are back
+    rtl_set_fm(tuner, prev_freq);
+    tuner->scan_gate->set_enabled(true);
+    tuner->audio_mute->hold(false);
+    if (tuner->stereo) {
+        tuner->audio_mute_r->hold(false);
+    }
+    if (tuner->scan_stop || tuner->paused) {
+        printf("Wideband scan aborted\n");
+        return false;
+    }
+
+    std::vector<double> measured;
+    for (unsigned int channel = 0; channel < FM_NUM_CHANNELS; ++channel) {
+        if (channel_measured[channel]) {
+            measured.push_back(channel_power[channel]);
+        }
+    }
+    unsigned int found_stations = 0;
+    station_info stations_out[MAX_FM_STATIONS];
+    float levels_out[MAX_FM_STATIONS];
+    if (!measured.empty()) {
+        std::vector<double>::iterator floor_it = measured.begin() + size_t(NOISE_FLOOR_PERCENTILE * (measured.size() - 1));
+        std::nth_element(measured.begin(), floor_it, measured.end());
+        double threshold = *floor_it * pow(10.0, SNR_THRESHOLD_DB / 10.0);
+        for (unsigned int channel = 0; channel < FM_NUM_CHANNELS && found_stations < MAX_FM_STATIONS; ++channel) {
+            if (channel_measured[channel] && channel_power[channel] > threshold) {
+                double freq = FM_BAND_START_MHZ + channel * FM_CHANNEL_SPACING_MHZ;
+                printf("\tFound station: %f\n", freq);
                 station_info station;
+                memset(&station, 0, sizeof(station));
                 station.frequency = freq;
-                strncpy(station.name, name.c_str(), STATION_NAME_MAX_LEN);
-                strncpy(station.genre, genre.c_str(), STATION_GENRE_MAX_LEN);
+                complete_from_cache(tuner, station, 0);
+                station.cnr_db = float(10.0 * log10(channel_power[channel] / *floor_it));
+                station.metrics = RTL_METRIC_CNR;
+                station.quality = station_quality(station.cnr_db + FM_IMPROVEMENT_DB, 0.0f, false);
+                levels_out[found_stations] = station.cnr_db;
                 stations_out[found_stations++] = station;
             }
         }
     }
+    double completed = wall_time();
+    publish_stations(tuner, stations_out, found_stations, completed, false);
+    cache_scan(tuner, stations_out, levels_out, found_stations, completed);
+    printf("Finished wideband scan\n");
+    return true;
+}
+
+// Runs a scan of the FM band using the tuner's current scan mode
+// @param tuner Pointer to the tuner context
+// @returns false if the scan was aborted
+bool scan_fm_stations(rtl_ctx_t* tuner) {
+    // The cu8 front end can't change the RTL rate and its probe only sees the channel
+    if (tuner->scan_mode == RTL_SCAN_WIDEBAND && !tuner->cu8_source) {
+        // The PFB is designed for samp_rate, at the scan's rate every virtual tuner would be on
+        // some other station.  rtl_add_virtual_tuner waits for the scan to finish.
+        bool wideband;
+        {
+            std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+            wideband = tuner->virtual_tuners.empty();
+            tuner->wideband_scan = wideband;
+        }
+        if (wideband) {
+            bool completed = scan_fm_stations_wideband(tuner);
+            std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+            tuner->wideband_scan = false;
+            return completed;
+        }
+        printf("Warning: scan_fm_stations - virtual tuners are running, scanning sequentially instead\n");
+    }
+    return scan_fm_stations_sequential(tuner);
+}
+
+// Selects how scan_fm_stations searches the band
+// Part of the external C API
+// @param tuner Pointer to the tuner context
+// @param mode RTL_SCAN_SEQUENTIAL to retune to every channel, RTL_SCAN_WIDEBAND for the FFT scan
+void rtl_set_scan_mode(rtl_ctx_t* tuner, rtl_scan_mode_t mode)
+{
+    tuner->scan_mode = mode;
+}
+
+// Body of the scanner thread owned by each tuner.  Sleeps until a scan is requested or the scan
+// interval elapses, runs the scan and publishes the result, until the tuner is destroyed.
+// @param tuner Pointer to the tuner context
+void scan_worker(rtl_ctx_t* tuner)
+{
+    std::unique_lock<std::mutex> lock(tuner->scan_mtx);
+    while (!tuner->scan_stop) {
+        if (!tuner->scan_requested || tuner->paused) {
+            // Re-evaluate after every wakeup: stop, a request, an interval change and rtl_resume all
+            // notify.  A paused tuner has no samples to scan, requests wait for the resume.
+            unsigned int interval_ms = tuner->scan_interval_ms;
+            if (interval_ms == 0 || tuner->paused) {
+                tuner->scan_cv.wait(lock);
+            }
+            else if (tuner->scan_cv.wait_for(lock, std::chrono::milliseconds(interval_ms)) == std::cv_status::timeout) {
+                tuner->scan_requested = true;
+            }
+            continue;
+        }
+        tuner->scan_requested = false;
+        tuner->scan_active = true;
+        lock.unlock();
+        bool completed = scan_fm_stations(tuner);
+        lock.lock();
+        tuner->scan_active = false;
+        // A scan cut short by rtl_pause runs again after the resume
+        if (!completed && tuner->paused) {
+            tuner->scan_requested = true;
+        }
+    }
+}
+
+// Asks the scanner thread to rescan the band as soon as possible.  Nonblocking.
+// Part of the external C API
+// @param tuner Pointer to the tuner context
+void rtl_request_scan(rtl_ctx_t* tuner)
+{
+    {
+        std::lock_guard<std::mutex> lock(tuner->scan_mtx);
+        tuner->scan_requested = true;
+    }
+    tuner->scan_cv.notify_one();
+}
+
+// Sets how often the scanner thread rescans the band on its own.  With a single dongle every scan
+// retunes the audio path, so this defaults to 0 (scan only on request).
+// Part of the external C API
+// @param tuner Pointer to the tuner context
+// @param interval_ms Time between the end of one scan and the start of the next, 0 to disable
+void rtl_set_scan_interval(rtl_ctx_t* tuner, unsigned int interval_ms)
+{
     {
-        std::lock_guard<std::mutex> lock(tuner->station_list_mtx);
-        memcpy(tuner->station_list, stations_out, sizeof(station_info) * found_stations);
-        tuner->station_list_len = found_stations;
+        std::lock_guard<std::mutex> lock(tuner->scan_mtx);
+        tuner->scan_interval_ms = interval_ms;
     }
-    printf("Finished scan\n");
+    tuner->scan_cv.notify_one();
+}
+
+// Part of the external C API
+// @param tuner Pointer to the tuner context
+// @returns the periodic scan interval in milliseconds, 0 if periodic scanning is off
+unsigned int rtl_get_scan_interval(rtl_ctx_t* tuner)
+{
+    return tuner->scan_interval_ms;
 }
 
-// Gets the most recent station list measured by scan_fm_stations
+// Gets the most recent station list measured by the scanner thread.  Never blocks on a scan: this is
+// a lock-free copy of the last published list, so it is cheap enough to call every frame.  If no scan
+// has completed or started yet, one is requested.  Until it completes the stations from the station
+// cache are returned, or 0 stations if the tuner has no cache.
 // Part of the external C API
 // @param tuner Pointer to the tuner context
+// @param stations_out Array of at least 100 entries to copy the stations into
+// @returns the number of stations copied
 unsigned int rtl_get_fm_stations(rtl_ctx_t* tuner, station_info* stations_out) {
-    // TODO: scan_fm_stations should happen in the background once the tuner supports two antennas
-    scan_fm_stations(tuner);
-    unsigned int stations_out_len = 0;
-    {
-        std::lock_guard<std::mutex> lock(tuner->station_list_mtx);
-        memcpy(stations_out, tuner->station_list, sizeof(station_info) * tuner->station_list_len);
-        stations_out_len = tuner->station_list_len;
+    unsigned int seq;
+    unsigned int stations_out_len;
+    bool from_cache;
+    do {
+        seq = tuner->station_list_seq.load(std::memory_order_acquire);
+        const station_list_buf& front = tuner->station_lists[seq & 1];
+        stations_out_len = std::min(front.len, MAX_FM_STATIONS);
+        memcpy(stations_out, front.stations, sizeof(station_info) * stations_out_len);
+        from_cache = front.from_cache;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (tuner->station_list_seq.load(std::memory_order_relaxed) != seq);
+
+    // The cached list is returned right away, a scan then brings it up to date in the background
+    if ((seq == 0 || from_cache) && !tuner->scan_active) {
+        rtl_request_scan(tuner);
     }
     return stations_out_len;
 }
 
+// Sorts stations, e.g. from rtl_get_fm_stations, best quality first.  Stations of equal quality
+// (all of them for a list from the station cache) stay in frequency order.
+// Part of the external C API
+// @param stations The stations to sort in place
+// @param num_stations Number of stations
+void rtl_rank_stations(station_info_t* stations, unsigned int num_stations)
+{
+    std::stable_sort(stations, stations + num_stations, [](const station_info_t& a, const station_info_t& b) {
+        return a.quality > b.quality;
+    });
+}
+
+// Part of the external C API
+// @param tuner Pointer to the tuner context
+// @returns the wall clock time the last scan completed in seconds since the epoch, 0 if never
+double rtl_get_last_scan_time(rtl_ctx_t* tuner)
+{
+    unsigned int seq;
+    double completed;
+    do {
+        seq = tuner->station_list_seq.load(std::memory_order_acquire);
+        completed = tuner->station_lists[seq & 1].completed;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (tuner->station_list_seq.load(std::memory_order_relaxed) != seq);
+    return completed;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0) {
+        unsigned int r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// Fills in the configuration rtl_create_tuner uses: 1 MS/s capture, demodulation at 1 MS/s and
+// stereo audio plus RDS from the 250 kHz MPX
+// Part of the external (C) API
+// @param config_out Receives the defaults
+void rtl_get_default_tuner_config(rtl_tuner_config_t* config_out)
+{
+    config_out->sample_rate = (unsigned int)DEFAULT_SAMP_RATE;
+    config_out->max_quadrature_rate = 1000000;
+    config_out->channel_bw = 200e3;
+    config_out->audio_decimation = 4;
+    config_out->stereo = 1;
+    config_out->initial_freq_mhz = 101.9;
+    config_out->gain_mode = RTL_GAIN_SOFTWARE_AGC;
+    config_out->gain = 14;
+    config_out->if_gain = 24;
+    config_out->bb_gain = 20;
+    config_out->freq_corr_ppm = 0;
+}
+
+// Makes sure every rate derived from the config is usable, before anything is opened
+// @return false, after printing why, if it isn't
+static bool check_config(const rtl_tuner_config_t& config)
+{
+    if (config.sample_rate == 0 || config.max_quadrature_rate == 0 || config.audio_decimation == 0) {
+        printf("Error: rtl_tuner_config_t - rates and decimation must be non-zero\n");
+        return false;
+    }
+    unsigned int dec1 = gr::filter::fm_channelizer::choose_decimation(
+        config.sample_rate, config.max_quadrature_rate, 1e3 * config.audio_decimation);
+    double quad_rate = double(config.sample_rate) / dec1;
+    if (config.channel_bw <= 0 || config.channel_bw / 2.0 >= quad_rate / 2.0) {
+        printf("Error: rtl_tuner_config_t - channel bandwidth %f does not fit quadrature rate %f\n", config.channel_bw, quad_rate);
+        return false;
+    }
+    double mpx_rate = quad_rate / config.audio_decimation;
+    if (mpx_rate < RDS_MIN_MPX_RATE) {
+        printf("Error: rtl_tuner_config_t - MPX rate %f is too low for stereo and RDS, lower audio_decimation\n", mpx_rate);
+        return false;
+    }
+    return true;
+}
+
+// Puts the headroom probe for the software AGC on the dongle's samples and sets the starting gain.
+// The AGC thread is started with the scanner.
+// @param context The tuner context, its source open
+// @param gain Starting gain in dB, the nearest step the tuner has is used
+void create_agc(rtl_ctx &context, double gain)
+{
+    if (context.cu8_source) {
+        context.gain_steps = context.cu8_source->gains();
+    }
+    else if (context.replay_source) {
+        context.gain_steps.assign(REPLAY_GAIN_STEPS, REPLAY_GAIN_STEPS + sizeof(REPLAY_GAIN_STEPS) / sizeof(REPLAY_GAIN_STEPS[0]));
+        context.replay_gain_ref = gain;
+    }
+    else {
+        context.gain_steps = context.rtl_source->get_gain_range(0).values();
+    }
+    if (context.gain_steps.empty()) {
+        printf("Warning: create_fm_device - the tuner reports no gains, the software AGC is off\n");
+        return;
+    }
+    unsigned int nearest = 0;
+    for (unsigned int i = 0; i < context.gain_steps.size(); ++i) {
+        if (fabs(context.gain_steps[i] - gain) < fabs(context.gain_steps[nearest] - gain)) {
+            nearest = i;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(context.agc_mtx);
+        set_gain_step(&context, nearest);
+    }
+
+    context.headroom_probe = gr::blocks::adc_headroom_probe::make(bool(context.cu8_source), AGC_STRIDE, AGC_WINDOW);
+    context.top_block->connect(
+        context.source, 0,
+        context.headroom_probe, 0);
+}
+
 // Does all of the heavy listing setting up a flowgraph for an rtl_sdr radio source
 // @parame context Reference to the tuner context.  This is a struct and not a class because
 // the rtl_ctx is typedefed to an opaque type in the header to allow compatibility with C
-void create_fm_device(rtl_ctx &context)
+// @param device_index Which rtl dongle to open, as listed by rtl_get_devices
+// @param config Rates and gains, checked by check_config
+// @param options Recording and replay, may be NULL
+// @return false if the dongle or the recording could not be opened
+bool create_fm_device(rtl_ctx &context, unsigned int device_index, const rtl_tuner_config_t& config, const rtl_tuner_options_t* options)
 {
-    int transition = 1e6;
-    int samp_rate = 1e6;
-    int quadrature = 1e6;
-    double freq = 101.9;
-    int cutoff = 100e3;
-    int audio_dec = 4;
+    double samp_rate = config.sample_rate;
+    double freq = config.initial_freq_mhz;
+    double channel_bw = config.channel_bw;
+    unsigned int audio_dec = config.audio_decimation;
+    bool stereo = config.stereo != 0;
 
     gr::top_block_sptr tb = gr::make_top_block("top");
-    osmosdr::source::sptr rtlsrc = osmosdr::source::make("numchan=1 rtl=0");
-
-    if (rtlsrc->get_num_channels() < 1) {
-        printf("Error: No rtl sources.  This probably means you don't have an antenna plugged in.\n");
-        exit(EXIT_FAILURE);
+    uint64_t open_start = gr::blocks::retune_tagger_cc::timestamp_now();
+    if (options != NULL && options->replay_path != NULL) {
+        // The recording decides the rate and frequency, everything else still comes from config
+        try {
+            context.replay_source = gr::blocks::iq_replay_source_c::make(
+                options->replay_path,
+                options->replay_realtime != 0,
+                options->replay_repeat != 0);
+        } catch (const std::exception& e) {
+            printf("Error: create_fm_device - could not open recording %s: %s\n", options->replay_path, e.what());
+            return false;
+        }
+        rtl_tuner_config_t replay_config = config;
+        replay_config.sample_rate = (unsigned int)context.replay_source->sample_rate();
+        if (!check_config(replay_config)) {
+            return false;
+        }
+        samp_rate = context.replay_source->sample_rate();
+        freq = context.replay_source->center_freq() / 1e6;
+        context.source = context.replay_source;
+        if (options->cu8_front_end != 0) {
+            printf("Warning: create_fm_device - the cu8 front end is not used when replaying\n");
+        }
     }
+    else if (options != NULL && options->cu8_front_end != 0) {
+        try {
+            context.cu8_source = gr::blocks::rtl_cu8_source::make(
+                device_index,
+                samp_rate,
+                freq * 1e6,
+                config.freq_corr_ppm,
+                config.gain_mode == RTL_GAIN_DONGLE_AGC,
+                config.gain);
+        } catch (const std::exception& e) {
+            printf("Error: create_fm_device - could not open rtl device %u: %s\n", device_index, e.what());
+            return false;
+        }
+        samp_rate = context.cu8_source->sample_rate();
+        context.source = context.cu8_source;
+    }
+    else {
+        osmosdr::source::sptr rtlsrc;
+        try {
+            rtlsrc = osmosdr::source::make("numchan=1 rtl=" + std::to_string(device_index));
+        } catch (const std::exception& e) {
+            printf("Error: create_fm_device - could not open rtl device %u: %s\n", device_index, e.what());
+            return false;
+        }
 
-    context.top_block = tb;
-    context.rtl_source = rtlsrc;
-
-    //rtlsrc->set_time_now(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()), osmosdr::ALL_MBOARDS);
-    rtlsrc->set_sample_rate(samp_rate);
-    rtlsrc->set_center_freq(freq * 1e6);
-    rtlsrc->set_freq_corr(0, 0);
-    rtlsrc->set_dc_offset_mode(2, 0);
-    rtlsrc->set_iq_balance_mode(2, 0);
-    rtlsrc->set_gain_mode(false, 0);
-    rtlsrc->set_gain(14, 0);
-    rtlsrc->set_if_gain(24, 0);
-    rtlsrc->set_bb_gain(20, 0);
-    rtlsrc->set_antenna("", 0);
-    rtlsrc->set_bandwidth(0, 0);
-
-    int dec1 = int(samp_rate / quadrature);
-    printf("dec1: %d \n", dec1);
+        if (rtlsrc->get_num_channels() < 1) {
+            printf("Error: No rtl sources.  This probably means you don't have an antenna plugged in.\n");
+            return false;
+        }
 
-    gr::filter::rational_resampler_base_ccc::sptr rresamp1;
+        //rtlsrc->set_time_now(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()), osmosdr::ALL_MBOARDS);
+        rtlsrc->set_sample_rate(samp_rate);
+        rtlsrc->set_center_freq(freq * 1e6);
+        rtlsrc->set_freq_corr(config.freq_corr_ppm, 0);
+        rtlsrc->set_dc_offset_mode(2, 0);
+        rtlsrc->set_iq_balance_mode(2, 0);
+        rtlsrc->set_gain_mode(config.gain_mode == RTL_GAIN_DONGLE_AGC, 0);
+        rtlsrc->set_gain(config.gain, 0);
+        rtlsrc->set_if_gain(config.if_gain, 0);
+        rtlsrc->set_bb_gain(config.bb_gain, 0);
+        rtlsrc->set_antenna("", 0);
+        rtlsrc->set_bandwidth(0, 0);
+        context.rtl_source = rtlsrc;
+        context.source = rtlsrc;
+    }
+    context.startup_stats.device_open_ms = (gr::blocks::retune_tagger_cc::timestamp_now() - open_start) / 1e6;
 
-    double d = 1.0;
+    context.top_block = tb;
+    context.retune_tagger = gr::blocks::retune_tagger_cc::make();
+    context.samp_rate = samp_rate;
+    context.stereo = stereo;
+
+    // Channel selection and the decimation to the quadrature rate happen in one filter pass, so any
+    // RTL rate works as long as it's at least the channel bandwidth
+    unsigned int dec1 = gr::filter::fm_channelizer::choose_decimation(samp_rate, config.max_quadrature_rate, 1e3 * audio_dec);
+    double quad_rate = double(samp_rate) / dec1;
+
+    gr::basic_block_sptr channelizer;
+    if (context.cu8_source) {
+        channelizer = gr::filter::cu8_channelizer::make(samp_rate, dec1, channel_bw);
+    }
+    else {
+        channelizer = gr::filter::fm_channelizer::make(samp_rate, dec1, channel_bw);
+    }
 
-    double inter = floor(1.0 / d);
-    double deci = floor(double(dec1) / d);
+    context.channelizer = channelizer;
+    context.quad_rate = quad_rate;
+    context.audio_rate = quad_rate / audio_dec;
 
-    printf("inter: %f \n", inter);
+    // Smallest interpolation/decimation pair from the audio rate to the sinks' rate
+    unsigned int audio_rate_hz = (unsigned int)round(context.audio_rate);
+    unsigned int out_rate_hz = (unsigned int)AUDIO_OUT_RATE;
+    unsigned int common = gcd(audio_rate_hz, out_rate_hz);
+    unsigned int inter = out_rate_hz / common;
+    unsigned int deci = audio_rate_hz / common;
 
+    // Same design as GNU Radio's rational_resampler: Kaiser window, 40% of the output rate passed
     double fractional_bw = 0.4;
     double beta = 7.0;
     double halfband = 0.5;
-    double rate = 1.0 / deci;
+    double rate = double(inter) / deci;
     double trans_width = 0.0;
     double mid_transition_band = 0.0;
 
@@ -185,237 +1216,1440 @@ void create_fm_device(rtl_ctx &context)
     {
         trans_width = halfband - fractional_bw;
         mid_transition_band = halfband - trans_width / 2.0;
-        printf("mid_transition_band: %f \n", mid_transition_band);
     }
     else
     {
-        trans_width = rate * (halfband - fractional_bw);
-        printf("trans_width: %f \n", trans_width);
-        mid_transition_band = rate * halfband - trans_width / 2.0;
-        printf("mid_transition_band2: %f \n", mid_transition_band);
+        trans_width = rate * (halfband - fractional_bw);
+        mid_transition_band = rate * halfband - trans_width / 2.0;
+    }
+
+    const std::vector<float>& taps = gr::filter::tap_cache::low_pass(
+        (inter),
+        (inter),
+        float(mid_transition_band),
+        float(trans_width),
+        gr::filter::firdes::WIN_KAISER,
+        float(beta));
+
+    context.rresamp0 = gr::filter::rational_resampler_base_fff::make(
+        inter,
+        deci,
+        taps);
+
+    gr::basic_block_sptr wfm;
+    if (stereo) {
+        context.rresamp0_r = gr::filter::rational_resampler_base_fff::make(
+            inter,
+            deci,
+            taps);
+
+        wfm = gr::analog::wfmrcv_stereo::make(
+          quad_rate,
+          audio_dec
+        );
+    }
+    else {
+        wfm = gr::analog::wfmrcv::make(
+          quad_rate,
+          audio_dec,
+          true
+        );
+    }
+
+
+    gr::hier_block2_sptr wfmrcv = gr::make_hier_block2(
+        "wfm_rcv",
+        gr::io_signature::make(1, 1, sizeof(gr_complex)),
+        gr::io_signature::make(1, 1, sizeof(float)));
+
+    gr::analog::power_probe_f::sptr mag_probe = gr::analog::power_probe_f::make(
+        (unsigned int)round(context.audio_rate * POWER_PROBE_WINDOW_S));
+    context.avg_magnitude = mag_probe;
+
+    // In stereo the RDS subcarrier comes out of wfmrcv_stereo already mixed down by the pilot PLL
+    context.rds = gr::analog::rds_receiver::make(stereo, context.audio_rate);
+
+    context.band_probe = gr::fft::band_power_probe::make(BAND_PROBE_FFT_SIZE);
+    context.quality = gr::analog::channel_quality::make(context.audio_rate);
+
+    context.wfm = wfm;
+    context.retune_tagger->set_timestamp_interval(tagger_rate(&context) * LATENCY_STAMP_INTERVAL_S);
+    context.latency_probe = gr::blocks::latency_probe_f::make();
+
+    // The cu8 front end filters ahead of the tagger, so everything after it is at the quadrature rate
+    gr::basic_block_sptr demod_input = context.cu8_source ? gr::basic_block_sptr(context.retune_tagger) : channelizer;
+    if (context.cu8_source) {
+        tb->connect(
+            context.source, 0,
+            channelizer, 0);
+
+        tb->connect(
+            channelizer, 0,
+            context.retune_tagger, 0);
+    }
+    else {
+        // Closed by the wideband scan, see scan_fm_stations_wideband
+        context.scan_gate = gr::blocks::copy::make(sizeof(gr_complex));
+
+        tb->connect(
+            context.source, 0,
+            context.retune_tagger, 0);
+
+        tb->connect(
+            context.retune_tagger, 0,
+            context.scan_gate, 0);
+
+        tb->connect(
+            context.scan_gate, 0,
+            channelizer, 0);
+    }
+
+    if (options != NULL && options->record_path != NULL) {
+        gr::blocks::iq_format format = options->record_format == RTL_IQ_CF32 ? gr::blocks::iq_format::CF32 : gr::blocks::iq_format::CU8;
+        try {
+            context.recorder = gr::blocks::iq_recorder_c::make(options->record_path, format, tagger_rate(&context), freq * 1e6);
+        } catch (const std::exception& e) {
+            printf("Error: create_fm_device - could not record to %s: %s\n", options->record_path, e.what());
+            return false;
+        }
+        // After the tagger, so the recording gets a capture per retune
+        tb->connect(
+            context.retune_tagger, 0,
+            context.recorder, 0);
+    }
+
+    tb->connect(
+        context.retune_tagger, 0,
+        context.band_probe, 0);
+
+    tb->connect(
+        demod_input, 0,
+        wfm, 0);
+
+    tb->connect(
+        wfm, 0,
+        mag_probe, 0);
+
+    tb->connect(
+        demod_input, 0,
+        context.quality, 0);
+
+    tb->connect(
+        wfm, stereo ? 4 : 1,
+        context.quality, 1);
+
+    if (stereo) {
+        tb->connect(
+            wfm, 1,
+            context.rresamp0, 0);
+
+        tb->connect(
+            wfm, 2,
+            context.rresamp0_r, 0);
+
+        tb->connect(
+            wfm, 3,
+            context.rds, 0);
+    }
+    else {
+        tb->connect(
+            wfm, 0,
+            context.rresamp0, 0);
+
+        tb->connect(
+            wfm, 1,
+            context.rds, 0);
+    }
+
+    context.audio_mute = gr::blocks::retune_mute_ff::make(AUDIO_OUT_RATE);
+    // The RDS chain clears itself at the retune tag and moves to the channel's cache entry
+    gr::rds::station_cache::sptr cache = context.station_cache;
+    if (cache) {
+        context.rds->set_cache(cache);
+        context.rds->rds_sink->set_cache(cache, cache->channel_of(freq));
+    }
+    tb->connect(
+        context.rresamp0, 0,
+        context.audio_mute, 0);
+
+    if (stereo) {
+        context.audio_mute_r = gr::blocks::retune_mute_ff::make(AUDIO_OUT_RATE);
+        tb->connect(
+            context.rresamp0_r, 0,
+            context.audio_mute_r, 0);
+    }
+
+    // Reads the same buffer the audio sinks do, so it sees the stamps when they do
+    tb->connect(
+        context.audio_mute, 0,
+        context.latency_probe, 0);
+
+    std::fill(context.gain_presets, context.gain_presets + FM_NUM_CHANNELS, -1);
+    bool adc_model = context.replay_source && options->replay_adc_model != 0;
+    if (config.gain_mode == RTL_GAIN_SOFTWARE_AGC && (!context.replay_source || adc_model)) {
+        create_agc(context, config.gain);
+        context.agc_channel = channel_on_grid(freq);
+    }
+
+    // Sinks are defined in separate methods
+    printf("gr_rtl: flowgraph is connected\n");
+    return true;
+}
+
+// Adds the time since start to the tuner's reconfiguration stats.  Called with sink_mtx held.
+// @param tuner The tuner context
+// @param start retune_tagger_cc::timestamp_now() when the flowgraph was locked
+void record_reconfig(rtl_ctx_t* tuner, uint64_t start)
+{
+    double ms = (gr::blocks::retune_tagger_cc::timestamp_now() - start) / 1e6;
+    rtl_reconfig_stats_t& stats = tuner->reconfig_stats;
+    stats.count++;
+    stats.last_ms = ms;
+    stats.max_ms = std::max(stats.max_ms, ms);
+    stats.total_ms += ms;
+}
+
+// Connects a sink to the audio mutes.  A running flowgraph is locked around the change: GNU Radio
+// stops the block threads, merges the new edges in and starts them again.  Blocks keep their state
+// and their buffers, so the demodulator and RDS carry on where they were after a pause of the
+// time recorded in reconfig_stats.
+// @param tuner The tuner context
+// @param sink Takes one input per audio channel
+void attach_sink(rtl_ctx_t* tuner, gr::block_sptr sink)
+{
+    // rtl_start_fm only applies the audio group's settings to the sinks it starts with
+    const block_group_sched& sched = tuner->group_sched[RTL_GROUP_AUDIO];
+    const std::vector<int>& cores = sched.cpu_cores.empty() ? tuner->cpu_cores : sched.cpu_cores;
+    if (!cores.empty()) {
+        sink->set_processor_affinity(cores);
+    }
+    bound_block_buffers(sink, int(AUDIO_OUT_RATE * latency_budget_s(tuner)));
+    apply_block_sched(sink, sched);
+
+    std::lock_guard<std::mutex> lock(tuner->sink_mtx);
+    uint64_t start = gr::blocks::retune_tagger_cc::timestamp_now();
+    tuner->top_block->lock();
+    tuner->top_block->connect(
+        tuner->audio_mute, 0,
+        sink, 0);
+
+    if (tuner->stereo) {
+        tuner->top_block->connect(
+            tuner->audio_mute_r, 0,
+            sink, 1);
+    }
+    tuner->sinks.push_back(sink);
+    tuner->top_block->unlock();
+    record_reconfig(tuner, start);
+    // unlock() started the sink's thread if the flowgraph runs, otherwise rtl_start_fm does this
+    if (sched.priority > 0 && tuner->start_time_ns != 0 && !tuner->paused) {
+        apply_block_realtime(sink, sched.priority);
+    }
+}
+
+// Disconnects the most recently added sink, the same way attach_sink connects it
+// @param tuner The tuner context
+// @return false if the tuner has no sinks
+bool detach_last_sink(rtl_ctx_t* tuner)
+{
+    std::lock_guard<std::mutex> lock(tuner->sink_mtx);
+    if (tuner->sinks.empty()) {
+        return false;
+    }
+    uint64_t start = gr::blocks::retune_tagger_cc::timestamp_now();
+    tuner->top_block->lock();
+    tuner->top_block->disconnect(tuner->sinks.back());
+    tuner->sinks.pop_back();
+    tuner->top_block->unlock();
+    record_reconfig(tuner, start);
+    return true;
+}
+
+// Adds an audio sink device.  Works on a running tuner, see attach_sink.
+// Part of the external API
+// @param this_tuner The tuner context
+// @param device ALSA device name, e.g. "hw:0"
+// @param sampling_rate Rate the device runs at
+void rtl_add_audio_sink(rtl_ctx_t* this_tuner, const char* device, int sampling_rate) {
+    gr::audio::sink::sptr audsink = NULL;
+    try {
+        audsink = gr::audio::sink::make(sampling_rate, device);
+    } catch(...) {
+        // code to handle any exception
+        printf("Exception Caught: rtl_add_audio_sink - invalid audio sinks device\n");
+        return;
+    }
+
+    attach_sink(this_tuner, audsink);
+}
+
+// remove the last audio sink device.  Works on a running tuner, see attach_sink.
+// Part of the external API
+// @param The tuner context
+void rtl_remove_audio_sink(rtl_ctx_t* this_tuner) {
+    if (this_tuner == NULL)
+    {
+        printf("Error: rtl_remove_audio_sink - no tuner specified\n");
+        return;
+    }
+
+    if (!detach_last_sink(this_tuner))
+    {
+        printf("Error: rtl_remove_audio_sink - no audio sinks specified for tuner\n");
+    }
+}
+
+// Records the audio to a WAV file.  Works on a running tuner, see attach_sink, so a recording
+// starts without restarting the tuner; rtl_remove_audio_sink ends it.
+// Part of the external API
+// @param this_tuner The tuner context
+// @param file_name The WAV file
+// @param sampling_rate Rate written to the file's header
+void rtl_add_wav_sink(rtl_ctx_t* this_tuner, const char* file_name, int sampling_rate) {
+    gr::blocks::wavfile_sink::sptr filesink;
+    try {
+        filesink = gr::blocks::wavfile_sink::make(
+            file_name,
+            this_tuner->stereo ? 2 : 1,
+            sampling_rate
+        );
+    } catch (const std::exception& e) {
+        printf("Error: rtl_add_wav_sink - could not open %s: %s\n", file_name, e.what());
+        return;
+    }
+
+    attach_sink(this_tuner, filesink);
+}
+
+// Records the audio compressed, encoded on a thread of its own so the flowgraph never waits on the
+// disk.  Works on a running tuner, see attach_sink; rtl_remove_audio_sink ends the recording.
+// Part of the external (C) API
+// @param this_tuner The tuner context
+// @param base_path Where to write, .flac or .opus is appended
+// @param codec RTL_CODEC_FLAC or RTL_CODEC_OPUS
+// @param bitrate Opus bitrate in bits/s, 0 for the encoder's choice.  Not used for FLAC.
+// @param segment_seconds Starts a new file, <base_path>-0000, -0001, ..., this often, 0 for one file
+// @return 0 on success, -1 if the file could not be created
+int rtl_add_encoded_sink(rtl_ctx_t* this_tuner, const char* base_path, rtl_audio_codec_t codec, unsigned int bitrate, unsigned int segment_seconds)
+{
+    gr::blocks::encoded_audio_sink::sptr encsink;
+    try {
+        encsink = gr::blocks::encoded_audio_sink::make(
+            base_path,
+            codec == RTL_CODEC_OPUS ? gr::blocks::audio_codec::OPUS : gr::blocks::audio_codec::FLAC,
+            this_tuner->stereo ? 2 : 1,
+            (unsigned int)AUDIO_OUT_RATE,
+            bitrate,
+            segment_seconds);
+    } catch (const std::exception& e) {
+        printf("Error: rtl_add_encoded_sink - %s\n", e.what());
+        return -1;
+    }
+
+    attach_sink(this_tuner, encsink);
+    return 0;
+}
+
+// Gets how long sink changes interrupted the audio path, lock() until unlock() returned: the
+// block threads stopping, the flowgraph being merged and its threads starting again
+// Part of the external (C) API
+// @param this_tuner The tuner context
+// @param stats_out Receives the timings
+void rtl_get_reconfig_stats(rtl_ctx_t* this_tuner, rtl_reconfig_stats_t* stats_out)
+{
+    std::lock_guard<std::mutex> lock(this_tuner->sink_mtx);
+    *stats_out = this_tuner->reconfig_stats;
+}
+
+// Finds the PFB channel that carries freq while the tuner is tuned to center_freq.  Channel k sits
+// k channel spacings above the center, the upper half of the channels are the negative offsets.
+// @param tuner The tuner context
+// @param freq Station frequency in MHz
+// @param center_freq Tuned frequency in MHz
+// @return the channel, -1 if freq is off the channel grid or outside the captured span
+int virtual_channel(rtl_ctx_t* tuner, double freq, double center_freq)
+{
+    double offset = (freq - center_freq) / FM_CHANNEL_SPACING_MHZ;
+    int k = int(round(offset));
+    int channels = int(tuner->pfb_channels);
+    // The outermost channels run into the RTL's own anti-alias filter
+    if (fabs(offset - k) > 0.01 || 2 * abs(k) >= channels) {
+        return -1;
+    }
+    return k >= 0 ? k : channels + k;
+}
+
+// Points every virtual tuner's PFB output at its channel after the tuner was retuned
+// @param tuner The tuner context
+// @param center_freq New tuned frequency in MHz
+void remap_virtual_tuners(rtl_ctx_t* tuner, double center_freq)
+{
+    std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+    if (tuner->virtual_tuners.empty()) {
+        return;
+    }
+
+    std::vector<int> channel_map;
+    for (virtual_tuner& vt : tuner->virtual_tuners) {
+        int channel = virtual_channel(tuner, vt.freq, center_freq);
+        if (channel >= 0 && (!vt.in_span || channel != vt.channel)) {
+            // Starts over, the samples so far came from another channel
+            vt.rds->reset();
+            vt.probe->reset();
+        }
+        else if (channel < 0 && vt.in_span) {
+            // Parked: its output keeps carrying the old channel, which is some other station now
+            printf("Warning: virtual tuner %d at %f is outside the captured span, not available until it is back\n",
+                   vt.id, vt.freq);
+        }
+        vt.in_span = channel >= 0;
+        if (vt.in_span) {
+            vt.channel = channel;
+        }
+        channel_map.push_back(vt.channel);
+    }
+    tuner->pfb->set_channel_map(channel_map);
+}
+
+// Connects the PFB outputs to the virtual tuners in order.  Call with the flowgraph locked.
+// @param tuner The tuner context
+void connect_virtual_tuners(rtl_ctx_t* tuner)
+{
+    std::vector<int> channel_map;
+    for (unsigned int output = 0; output < tuner->virtual_tuners.size(); ++output) {
+        virtual_tuner& vt = tuner->virtual_tuners[output];
+        tuner->top_block->connect(
+            tuner->pfb, output,
+            vt.wfm, 0);
+        channel_map.push_back(vt.channel);
+    }
+    tuner->pfb->set_channel_map(channel_map);
+}
+
+// Adds a virtual tuner: a second station inside the captured span that is demodulated from the same
+// samples as the tuned one, so its RDS keeps updating while the tuned station plays.  One polyphase
+// filterbank splits the capture into all the 200 kHz channels at once, every virtual tuner then only
+// pays for its own FM demodulator and RDS decoder.  Works on a running tuner.
+// With the default 1 MS/s the span is the tuned frequency +-0.4 MHz, at RTL_MULTI_STATION_SAMPLE_RATE
+// it is +-1.0 MHz.  A virtual tuner outside the span after rtl_set_fm waits until it is back inside,
+// its station and signal strength are not available meanwhile.  Fails while a wideband scan runs.
+// Part of the external API
+// @param tuner The tuner context
+// @param freq Station frequency in MHz
+// @return id for the other rtl_*_virtual_tuner calls, -1 if freq is not inside the span
+int rtl_add_virtual_tuner(rtl_ctx_t* tuner, double freq)
+{
+    if (tuner->cu8_source) {
+        printf("Error: rtl_add_virtual_tuner - the cu8 front end only passes the tuned channel\n");
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+    if (tuner->wideband_scan) {
+        printf("Error: rtl_add_virtual_tuner - a wideband scan is running at a different sample rate\n");
+        return -1;
+    }
+    if (!tuner->pfb) {
+        double spacing = FM_CHANNEL_SPACING_MHZ * 1e6;
+        unsigned int channels = (unsigned int)round(tuner->samp_rate / spacing);
+        if (fabs(channels * spacing - tuner->samp_rate) > 1.0) {
+            printf("Error: rtl_add_virtual_tuner - sample rate %f is not a multiple of the channel spacing\n", tuner->samp_rate);
+            return -1;
+        }
+        // Oversampling by 2 keeps the FM sidebands clear of the channel edge, it needs an even
+        // number of channels.  Both ways the MPX comes out at VIRTUAL_MPX_RATE.
+        float oversample = channels % 2 == 0 ? 2.0f : 1.0f;
+        const std::vector<float>& taps = gr::filter::tap_cache::low_pass(
+            1.0,
+            tuner->samp_rate,
+            VIRTUAL_CHANNEL_CUTOFF,
+            VIRTUAL_CHANNEL_TRANSITION,
+            gr::filter::firdes::WIN_HAMMING);
+        tuner->pfb = gr::filter::pfb_channelizer_ccf::make(channels, taps, oversample);
+        tuner->pfb_channels = channels;
+    }
+
+    int channel = virtual_channel(tuner, freq, rtl_get_fm(tuner));
+    if (channel < 0) {
+        printf("Error: rtl_add_virtual_tuner - %f is outside the captured span\n", freq);
+        return -1;
+    }
+
+    double quad_rate = tuner->samp_rate / tuner->pfb_channels * (tuner->pfb_channels % 2 == 0 ? 2 : 1);
+    virtual_tuner vt;
+    vt.id = tuner->next_virtual_id++;
+    vt.freq = freq;
+    vt.in_span = true;
+    vt.channel = channel;
+    vt.wfm = gr::analog::wfmrcv::make(quad_rate, quad_rate / VIRTUAL_MPX_RATE, true);
+    vt.probe = gr::analog::power_probe_f::make((unsigned int)round(VIRTUAL_MPX_RATE * POWER_PROBE_WINDOW_S));
+    vt.rds = gr::analog::rds_receiver::make(false, VIRTUAL_MPX_RATE);
+    if (!tuner->cpu_cores.empty()) {
+        vt.wfm->set_processor_affinity(tuner->cpu_cores);
+        vt.probe->set_processor_affinity(tuner->cpu_cores);
+        vt.rds->set_processor_affinity(tuner->cpu_cores);
+        tuner->pfb->set_processor_affinity(tuner->cpu_cores);
+    }
+
+    tuner->top_block->lock();
+    if (tuner->virtual_tuners.empty()) {
+        tuner->top_block->connect(
+            tuner->retune_tagger, 0,
+            tuner->pfb, 0);
+    }
+    else {
+        // Outputs are renumbered below, so drop the old edges first
+        for (unsigned int output = 0; output < tuner->virtual_tuners.size(); ++output) {
+            tuner->top_block->disconnect(
+                tuner->pfb, output,
+                tuner->virtual_tuners[output].wfm, 0);
+        }
+    }
+    tuner->top_block->connect(
+        vt.wfm, 0,
+        vt.probe, 0);
+    tuner->top_block->connect(
+        vt.wfm, 1,
+        vt.rds, 0);
+    tuner->virtual_tuners.push_back(vt);
+    connect_virtual_tuners(tuner);
+    tuner->top_block->unlock();
+
+    return vt.id;
+}
+
+// Removes a virtual tuner added with rtl_add_virtual_tuner.  Works on a running tuner.
+// Part of the external API
+// @param tuner The tuner context
+// @param virtual_id Id returned by rtl_add_virtual_tuner
+void rtl_remove_virtual_tuner(rtl_ctx_t* tuner, int virtual_id)
+{
+    std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+    std::vector<virtual_tuner>::iterator it = std::find_if(
+        tuner->virtual_tuners.begin(),
+        tuner->virtual_tuners.end(),
+        [virtual_id](const virtual_tuner& vt) { return vt.id == virtual_id; });
+    if (it == tuner->virtual_tuners.end()) {
+        printf("Error: rtl_remove_virtual_tuner - no virtual tuner %d\n", virtual_id);
+        return;
+    }
+
+    tuner->top_block->lock();
+    for (unsigned int output = 0; output < tuner->virtual_tuners.size(); ++output) {
+        tuner->top_block->disconnect(
+            tuner->pfb, output,
+            tuner->virtual_tuners[output].wfm, 0);
+    }
+    tuner->top_block->disconnect(
+        it->wfm, 0,
+        it->probe, 0);
+    tuner->top_block->disconnect(
+        it->wfm, 1,
+        it->rds, 0);
+    tuner->virtual_tuners.erase(it);
+
+    if (tuner->virtual_tuners.empty()) {
+        tuner->top_block->disconnect(
+            tuner->retune_tagger, 0,
+            tuner->pfb, 0);
+    }
+    else {
+        connect_virtual_tuners(tuner);
+    }
+    tuner->top_block->unlock();
+}
+
+// Gets what a virtual tuner has decoded so far
+// Part of the external API
+// @param tuner The tuner context
+// @param virtual_id Id returned by rtl_add_virtual_tuner
+// @param station_out Receives frequency, RDS name and genre.  Name and genre are empty until decoded.
+// @return 0 on success, -1 if there's no such virtual tuner or it is outside the captured span
+int rtl_get_virtual_tuner_station(rtl_ctx_t* tuner, int virtual_id, station_info_t* station_out)
+{
+    std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+    for (virtual_tuner& vt : tuner->virtual_tuners) {
+        if (vt.id != virtual_id) {
+            continue;
+        }
+        if (!vt.in_span) {
+            return -1;
+        }
+        gr::rds::rds_snapshot rds;
+        vt.rds->rds_sink->get_snapshot(rds);
+        memset(station_out, 0, sizeof(*station_out));
+        station_out->frequency = vt.freq;
+        strncpy(station_out->name, rds.callsign, STATION_NAME_MAX_LEN);
+        strncpy(station_out->genre, rds.pty, STATION_GENRE_MAX_LEN);
+        return 0;
+    }
+    return -1;
+}
+
+// Returns the signal strength of a virtual tuner's station, on the same scale as rtl_get_signal_str
+// Part of the external API
+// @param tuner The tuner context
+// @param virtual_id Id returned by rtl_add_virtual_tuner
+// @return A float for the FM signal strength, 0 if there's no such virtual tuner or it is outside
+//         the captured span
+float rtl_get_virtual_tuner_signal_str(rtl_ctx_t* tuner, int virtual_id)
+{
+    std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+    for (virtual_tuner& vt : tuner->virtual_tuners) {
+        if (vt.id == virtual_id) {
+            // A parked tuner's output carries whatever is on its old channel now
+            return vt.in_span ? vt.probe->level() : 0.0f;
+        }
+    }
+    return 0.0f;
+}
+
+// Adds a sink that writes the 48 kHz audio (interleaved if stereo) into a lock-free single producer,
+// single consumer ring in POSIX shared memory.  The consumer reads the frames in place with
+// rtl_pcm_acquire/rtl_pcm_release, in this process or in another one that attached with rtl_pcm_open.
+// If the consumer falls behind, new frames are dropped rather than stalling the flowgraph.
+// Part of the external API
+// @param this_tuner The tuner context
+// @param shm_name Shared memory object name, e.g. "/rtl_pcm0".  An existing object is replaced.
+// @param capacity_frames Ring size in frames, rounded up to a power of two
+// @param format RTL_PCM_FLOAT32, or RTL_PCM_S16 to have the producer convert to int16
+// @param sampling_rate Recorded in the ring header for the consumer
+// @return handle to release with rtl_pcm_close, NULL on failure
+rtl_pcm_ring_t* rtl_add_pcm_ringbuffer_sink(rtl_ctx_t* this_tuner, const char* shm_name, unsigned int capacity_frames, rtl_pcm_format_t format, int sampling_rate)
+{
+    unsigned int channels = this_tuner->stereo ? 2 : 1;
+    gr::blocks::pcm_ring::sptr ring = gr::blocks::pcm_ring::create(
+        shm_name,
+        channels,
+        format == RTL_PCM_S16 ? gr::blocks::pcm_format::S16 : gr::blocks::pcm_format::FLOAT32,
+        sampling_rate,
+        capacity_frames);
+    if (!ring) {
+        printf("Error: rtl_add_pcm_ringbuffer_sink - could not set up shared memory %s\n", shm_name);
+        return NULL;
+    }
+
+    gr::blocks::pcm_ring_sink::sptr ringsink = gr::blocks::pcm_ring_sink::make(ring);
+    attach_sink(this_tuner, ringsink);
+
+    rtl_pcm_ring_t* handle = new rtl_pcm_ring_t;
+    handle->ring = ring;
+    return handle;
+}
+
+// Attaches to a PCM ring created by rtl_add_pcm_ringbuffer_sink, e.g. from another process
+// Part of the external API
+// @param shm_name Shared memory object name the ring was created with
+// @return handle to release with rtl_pcm_close, NULL if there is no such ring
+rtl_pcm_ring_t* rtl_pcm_open(const char* shm_name)
+{
+    gr::blocks::pcm_ring::sptr ring = gr::blocks::pcm_ring::open(shm_name);
+    if (!ring) {
+        printf("Error: rtl_pcm_open - no pcm ring %s\n", shm_name);
+        return NULL;
+    }
+    rtl_pcm_ring_t* handle = new rtl_pcm_ring_t;
+    handle->ring = ring;
+    return handle;
+}
+
+// Releases a PCM ring handle.  The shared memory stays alive while the sink still writes to it.
+// Part of the external API
+void rtl_pcm_close(rtl_pcm_ring_t* ring)
+{
+    delete ring;
+}
+
+// Part of the external API
+// @return number of interleaved channels per frame
+unsigned int rtl_pcm_channels(rtl_pcm_ring_t* ring)
+{
+    return ring->ring->header().channels;
+}
+
+// Gets the oldest unread frames, in place in the ring.  The frames stay valid until rtl_pcm_release.
+// Only one thread may consume from a ring.
+// Part of the external API
+// @param ring The ring handle
+// @param frames_out Receives a pointer to the first frame
+// @param max_frames Most frames the caller wants
+// @return number of contiguous frames at frames_out, 0 if the ring is empty
+unsigned int rtl_pcm_acquire(rtl_pcm_ring_t* ring, const void** frames_out, unsigned int max_frames)
+{
+    return ring->ring->acquire(frames_out, max_frames);
+}
+
+// Hands frames from rtl_pcm_acquire back to the producer
+// Part of the external API
+void rtl_pcm_release(rtl_pcm_ring_t* ring, unsigned int num_frames)
+{
+    ring->ring->release(num_frames);
+}
+
+// Lists the rtl dongles attached to the system
+// Part of the external API
+// @param devices_out Array to fill, may be NULL to only count the devices
+// @param max_devices Number of entries in devices_out
+// @return number of devices found, which may be more than max_devices
+unsigned int rtl_get_devices(rtl_device_info_t* devices_out, unsigned int max_devices)
+{
+    unsigned int num_devices = 0;
+    std::lock_guard<std::mutex> lock(device_pool_mtx);
+    for (osmosdr::device_t& dev : osmosdr::device::find()) {
+        // find() reports every osmosdr driver, rtl dongles are the ones with an "rtl" index
+        if (dev.count("rtl") == 0) {
+            continue;
+        }
+        if (devices_out != NULL && num_devices < max_devices) {
+            rtl_device_info_t& info = devices_out[num_devices];
+            info.index = std::stoul(dev["rtl"]);
+            snprintf(info.label, RTL_DEVICE_LABEL_MAX_LEN, "%s", dev["label"].c_str());
+            info.in_use = devices_in_use.count(info.index) > 0;
+        }
+        ++num_devices;
+    }
+    return num_devices;
+}
+
+// Creates and allocates an instance of an rtl tuner context on the first dongle.
+// Part of the external API
+// @return A pointer to a newly allocated tuner context, NULL if there is no usable device
+rtl_ctx_t* rtl_create_tuner()
+{
+    return rtl_create_tuner_ex(0, NULL);
+}
+
+// Creates and allocates an instance of an rtl tuner context on the given dongle.  Every tuner has
+// its own flowgraph and scanner, so several tuners can run side by side, e.g. one playing audio
+// while another scans.
+// Part of the external API
+// @param device_index Which dongle to open, see rtl_get_devices
+// @param options CPU pinning for the tuner's flowgraph, NULL for the defaults
+// @return A pointer to a newly allocated tuner context, NULL if the device is missing or already in use
+rtl_ctx_t* rtl_create_tuner_ex(unsigned int device_index, const rtl_tuner_options_t* options)
+{
+    rtl_tuner_config_t config;
+    rtl_get_default_tuner_config(&config);
+    if (options != NULL && options->sample_rate > 0) {
+        config.sample_rate = options->sample_rate;
+    }
+    return rtl_create_tuner_with_config(device_index, options, &config);
+}
+
+// Like rtl_create_tuner_ex, with the rates and gains of the flowgraph taken from config.  This is
+// where CPU is traded for quality, see rtl_tuner_config_t.
+// Part of the external API
+// @param device_index Which dongle to open, see rtl_get_devices
+// @param options CPU pinning and cache files, NULL for the defaults.  options->sample_rate is ignored.
+// @param config Rates and gains, start from rtl_get_default_tuner_config.  NULL for the defaults.
+// @return A pointer to a newly allocated tuner context, NULL if the config is unusable or the device
+//         is missing or already in use
+rtl_ctx_t* rtl_create_tuner_with_config(unsigned int device_index, const rtl_tuner_options_t* options, const rtl_tuner_config_t* config)
+{
+    rtl_tuner_config_t default_config;
+    if (config == NULL) {
+        rtl_get_default_tuner_config(&default_config);
+        config = &default_config;
+    }
+    if (!check_config(*config)) {
+        return NULL;
+    }
+
+    uint64_t create_start = gr::blocks::retune_tagger_cc::timestamp_now();
+    // A replaying tuner doesn't touch a dongle, so it doesn't claim one either
+    bool replay = options != NULL && options->replay_path != NULL;
+    if (replay) {
+        printf("gr_rtl: create_tuner replaying %s\n", options->replay_path);
+    }
+    else {
+        printf("gr_rtl: create_tuner on device %u\n", device_index);
+        std::lock_guard<std::mutex> lock(device_pool_mtx);
+        if (!devices_in_use.insert(device_index).second) {
+            printf("Error: rtl_create_tuner_ex - device %u is already in use\n", device_index);
+            return NULL;
+        }
+    }
+
+    rtl_ctx_t* tuner_ctx = new rtl_ctx_t;
+    if (tuner_ctx == NULL)
+    {
+        printf("Error: rtl_create_tuner - out of memory\n");
+        if (!replay) {
+            std::lock_guard<std::mutex> lock(device_pool_mtx);
+            devices_in_use.erase(device_index);
+        }
+        return NULL;
+    }
+    tuner_ctx->device_index = device_index;
+    tuner_ctx->owns_device = !replay;
+    tuner_ctx->create_time_ns = create_start;
+    memset(&tuner_ctx->startup_stats, 0, sizeof(tuner_ctx->startup_stats));
+    if (options != NULL && options->cpu_cores != NULL) {
+        tuner_ctx->cpu_cores.assign(options->cpu_cores, options->cpu_cores + options->num_cpu_cores);
+    }
+
+    if (options != NULL && options->station_cache_path != NULL) {
+        tuner_ctx->station_cache = gr::rds::station_cache::open(
+            options->station_cache_path,
+            FM_BAND_START_MHZ,
+            FM_CHANNEL_SPACING_MHZ,
+            FM_NUM_CHANNELS);
+        if (!tuner_ctx->station_cache) {
+            printf("Warning: rtl_create_tuner_ex - could not map station cache %s\n", options->station_cache_path);
+        }
+    }
+
+    const char* filter_cache_path = options != NULL ? options->filter_cache_path : NULL;
+    if (filter_cache_path != NULL) {
+        gr::filter::tap_cache::load(filter_cache_path);
+    }
+    unsigned int hits_before, misses_before, hits_after, misses_after;
+    double design_ms_before, design_ms_after;
+    gr::filter::tap_cache::get_stats(hits_before, misses_before, design_ms_before);
+
+    uint64_t flowgraph_start = gr::blocks::retune_tagger_cc::timestamp_now();
+    if (!create_fm_device(*tuner_ctx, device_index, *config, options)) {
+        delete tuner_ctx;
+        if (!replay) {
+            std::lock_guard<std::mutex> lock(device_pool_mtx);
+            devices_in_use.erase(device_index);
+        }
+        return NULL;
+    }
+
+    // The cache counters are process wide, tuners created at the same time see each other's designs
+    rtl_startup_stats_t& startup = tuner_ctx->startup_stats;
+    gr::filter::tap_cache::get_stats(hits_after, misses_after, design_ms_after);
+    startup.filters_cached = hits_after - hits_before;
+    startup.filters_designed = misses_after - misses_before;
+    startup.filter_design_ms = design_ms_after - design_ms_before;
+    startup.flowgraph_ms = (gr::blocks::retune_tagger_cc::timestamp_now() - flowgraph_start) / 1e6 - startup.device_open_ms;
+    if (filter_cache_path != NULL && gr::filter::tap_cache::modified()) {
+        if (!gr::filter::tap_cache::save(filter_cache_path)) {
+            printf("Warning: rtl_create_tuner_ex - could not write filter cache %s\n", filter_cache_path);
+        }
+    }
+
+    if (tuner_ctx->station_cache) {
+        double last_scan;
+        std::vector<gr::rds::station_cache_entry> cached = tuner_ctx->station_cache->found_stations(last_scan);
+        station_info stations[MAX_FM_STATIONS];
+        unsigned int num_stations = std::min((unsigned int)cached.size(), MAX_FM_STATIONS);
+        for (unsigned int i = 0; i < num_stations; ++i) {
+            memset(&stations[i], 0, sizeof(station_info));
+            stations[i].frequency = cached[i].frequency;
+            strncpy(stations[i].name, cached[i].callsign, STATION_NAME_MAX_LEN);
+            strncpy(stations[i].genre, cached[i].genre, STATION_GENRE_MAX_LEN);
+        }
+        if (num_stations > 0) {
+            publish_stations(tuner_ctx, stations, num_stations, last_scan, true);
+        }
+    }
+    // A recording can't be retuned, so there is nothing to scan
+    if (!replay) {
+        tuner_ctx->scan_thread = std::thread(scan_worker, tuner_ctx);
+    }
+    if (tuner_ctx->headroom_probe) {
+        tuner_ctx->agc_thread = std::thread(agc_worker, tuner_ctx);
+    }
+
+    startup.create_ms = (gr::blocks::retune_tagger_cc::timestamp_now() - create_start) / 1e6;
+    return tuner_ctx;
+}
+
+// Shuts down and destroyes a tuner context
+// Part of the external API
+// @param The tuner context
+void rtl_destroy_tuner(rtl_ctx_t* tuner)
+{
+    if (tuner == NULL)
+    {
+        printf("Error: rtl_destroy_tuner - null pointer\n");
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(tuner->scan_mtx);
+        tuner->scan_stop = true;
+    }
+    tuner->scan_cv.notify_one();
+    if (tuner->scan_thread.joinable()) {
+        tuner->scan_thread.join();
+    }
+    tuner->agc_stop = true;
+    if (tuner->agc_thread.joinable()) {
+        tuner->agc_thread.join();
+    }
+    // Also lets rtl_wait return if the tuner is paused
+    rtl_stop_fm(tuner);
+    tuner->top_block.reset();
+    unsigned int device_index = tuner->device_index;
+    bool owns_device = tuner->owns_device;
+    delete tuner;
+    if (!owns_device) {
+        return;
     }
 
-    std::vector<float> taps1 = gr::filter::firdes::low_pass(
-        (inter),
-        (inter),
-        (mid_transition_band),
-        (trans_width),
-        gr::filter::firdes::WIN_KAISER,
-        (beta));
-
-    std::vector<gr_complex> taps_comp;
+    std::lock_guard<std::mutex> lock(device_pool_mtx);
+    devices_in_use.erase(device_index);
+}
 
-    std::vector<float>::iterator iter = taps1.begin();
-    for (; iter != taps1.end(); ++iter)
-    {
-        taps_comp.push_back(gr_complex(*iter));
+// Reports where the time to first audio went: creating the tuner, and from rtl_start_fm to the
+// first samples arriving from the dongle and the first audio reaching the sinks.  For a tuner that
+// was paused, also how long the last rtl_pause and rtl_resume took and the resume's first audio.
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param stats_out Receives the timings, the first sample times stay 0 until samples arrived
+void rtl_get_startup_stats(rtl_ctx_t* tuner, rtl_startup_stats_t* stats_out)
+{
+    *stats_out = tuner->startup_stats;
+    uint64_t first_sample = tuner->retune_tagger->first_sample_time();
+    if (first_sample != 0) {
+        if (tuner->start_time_ns != 0) {
+            stats_out->start_to_first_sample_ms = (first_sample - tuner->start_time_ns) / 1e6;
+        }
+        stats_out->create_to_first_sample_ms = (first_sample - tuner->create_time_ns) / 1e6;
+    }
+    // The latency probe sits next to the sinks, so its first samples are the first audio
+    uint64_t first_audio = tuner->latency_probe->first_sample_time();
+    uint64_t start_audio = tuner->first_audio_ns != 0 ? tuner->first_audio_ns : (tuner->resume_time_ns == 0 ? first_audio : 0);
+    if (start_audio != 0 && tuner->start_time_ns != 0) {
+        stats_out->start_to_first_audio_ms = (start_audio - tuner->start_time_ns) / 1e6;
     }
+    if (first_audio != 0 && tuner->resume_time_ns != 0) {
+        stats_out->resume_to_first_audio_ms = (first_audio - tuner->resume_time_ns) / 1e6;
+    }
+}
 
-    rresamp1 = gr::filter::rational_resampler_base_ccc::make(
-        1.0,
-        dec1,
-        taps_comp);
+// Turns GNU Radio's per block performance counters on or off.  They time every work() call, so
+// they're off by default.  Takes effect the next time the tuner is started.
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param enabled Non-zero to keep the counters of rtl_get_perf_stats
+void rtl_set_perf_counters(rtl_ctx_t* tuner, int enabled)
+{
+    tuner->perf_counters = enabled != 0;
+}
 
-    int dec2 = int(quadrature / 1e3 / audio_dec);
-    printf("dec2: %d \n", dec2);
+// Adds blk to blocks if it's a primitive block, or the blocks it's made of if it's one of the
+// library's hier blocks.  Other hier blocks, e.g. the osmosdr source, can't be looked into.
+// @param blk The block
+// @param parent Name of the hier block blk is part of, empty at the top
+// @param blocks Receives the blocks and their parents
+void collect_perf_blocks(gr::basic_block_sptr blk, const std::string& parent, std::vector<std::pair<gr::block_sptr, std::string>>& blocks)
+{
+    gr::block_sptr block = boost::dynamic_pointer_cast<gr::block>(blk);
+    if (block) {
+        blocks.push_back(std::make_pair(block, parent));
+        return;
+    }
 
-    d = 2.0;
+    boost::shared_ptr<gr::block_list> list = boost::dynamic_pointer_cast<gr::block_list>(blk);
+    if (list) {
+        for (gr::basic_block_sptr inner : list->inner_blocks()) {
+            collect_perf_blocks(inner, blk->symbol_name(), blocks);
+        }
+    }
+}
 
-    inter = floor(48.0 / d);
-    printf("inter: %f \n", inter);
+// Gets the performance counters of every block in the tuner's flowgraph, down into the library's
+// hier blocks, to find the one that's falling behind.  Blocks that haven't run yet read 0.
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param stats_out Receives up to max_blocks blocks
+// @param max_blocks Size of stats_out
+// @return the number of blocks in the flowgraph, which can be more than max_blocks
+unsigned int rtl_get_perf_stats(rtl_ctx_t* tuner, rtl_perf_t* stats_out, unsigned int max_blocks)
+{
+    std::vector<std::pair<gr::block_sptr, std::string>> blocks;
+    for (gr::basic_block_sptr blk : tuner_blocks(tuner)) {
+        collect_perf_blocks(blk, "", blocks);
+    }
 
-    deci = floor(dec2 / d);
+    double tps = double(gr::high_res_timer_tps());
+    double wall_ms = 0.0;
+    if (tuner->perf_start_ns != 0) {
+        wall_ms = (gr::blocks::retune_tagger_cc::timestamp_now() - tuner->perf_start_ns) / 1e6;
+    }
+    unsigned int count = std::min(max_blocks, (unsigned int)blocks.size());
+    for (unsigned int i = 0; i < count; ++i) {
+        gr::block_sptr block = blocks[i].first;
+        rtl_perf_t& stats = stats_out[i];
+        memset(&stats, 0, sizeof(stats));
+        snprintf(stats.name, sizeof(stats.name), "%s", block->symbol_name().c_str());
+        snprintf(stats.parent, sizeof(stats.parent), "%s", blocks[i].second.c_str());
+
+        gr::block_detail_sptr detail = block->detail();
+        if (!detail) {
+            continue;
+        }
+        if (detail->ninputs() > 0) {
+            stats.items_read = block->nitems_read(0);
+        }
+        if (detail->noutputs() > 0) {
+            stats.items_written = block->nitems_written(0);
+        }
+        if (!tuner->perf_counters) {
+            continue;
+        }
 
-    fractional_bw = 0.4;
-    beta = 7.0;
-    halfband = 0.5;
-    rate = 1 / deci;
-    trans_width = 0.0;
-    mid_transition_band = 0.0;
+        stats.work_time_total_ms = block->pc_work_time_total() * 1e3 / tps;
+        stats.work_time_avg_us = block->pc_work_time_avg() * 1e6 / tps;
+        stats.busy_percent = wall_ms > 0.0 ? 100.0 * stats.work_time_total_ms / wall_ms : 0.0;
+        stats.noutput_items_avg = block->pc_noutput_items_avg();
+        stats.nproduced_avg = block->pc_nproduced_avg();
+        stats.throughput_avg = block->pc_throughput_avg();
+        for (float full : block->pc_input_buffers_full_avg()) {
+            stats.input_buffer_full = std::max(stats.input_buffer_full, full);
+        }
+        for (float full : block->pc_output_buffers_full_avg()) {
+            stats.output_buffer_full = std::max(stats.output_buffer_full, full);
+        }
+    }
+    return blocks.size();
+}
 
-    if (rate >= 1.0)
-    {
-        trans_width = halfband - fractional_bw;
-        mid_transition_band = halfband - trans_width / 2.0;
-        printf("mid_transition_band: %f \n", mid_transition_band);
+// Starts the averages and totals of rtl_get_perf_stats over, the item counts keep going
+// Part of the external (C) API
+// @param tuner The tuner context
+void rtl_reset_perf_stats(rtl_ctx_t* tuner)
+{
+    std::vector<std::pair<gr::block_sptr, std::string>> blocks;
+    for (gr::basic_block_sptr blk : tuner_blocks(tuner)) {
+        collect_perf_blocks(blk, "", blocks);
     }
-    else
-    {
-        trans_width = rate * (halfband - fractional_bw);
-        printf("trans_width: %f \n", trans_width);
-        mid_transition_band = rate * halfband - trans_width / 2.0;
-        printf("mid_transition_band2: %f \n", mid_transition_band);
+    for (auto& entry : blocks) {
+        if (entry.first->detail()) {
+            entry.first->reset_perf_counters();
+        }
     }
+    tuner->perf_start_ns = gr::blocks::retune_tagger_cc::timestamp_now();
+}
 
-    std::vector<float> taps = gr::filter::firdes::low_pass(
-        (inter),
-        (inter),
-        float(mid_transition_band),
-        float(trans_width),
-        gr::filter::firdes::WIN_KAISER,
-        float(beta));
+// Caps the items a block handles per call and the size of its output buffers.  GNU Radio still
+// rounds buffers up to whole pages and to what the downstream blocks need for history, so this
+// is an upper bound.  Hier blocks pass the output buffer cap on to the blocks inside them.
+// @param blk The block
+// @param max_items Limit in items, 0 to go back to the GNU Radio defaults
+void bound_block_buffers(gr::basic_block_sptr blk, int max_items)
+{
+    gr::block_sptr block = boost::dynamic_pointer_cast<gr::block>(blk);
+    if (block) {
+        if (max_items > 0) {
+            block->set_max_noutput_items(max_items);
+            block->set_max_output_buffer(max_items);
+        }
+        else {
+            block->unset_max_noutput_items();
+            block->set_max_output_buffer(-1);
+        }
+        return;
+    }
 
-    context.rresamp0 = gr::filter::rational_resampler_base_fff::make(
-        48.0,
-        dec2,
-        taps);
+    gr::hier_block2_sptr hier = boost::dynamic_pointer_cast<gr::hier_block2>(blk);
+    if (hier) {
+        hier->set_max_output_buffer(max_items > 0 ? max_items : -1);
+    }
+}
 
-    gr::filter::fir_filter_ccf::sptr lp0 = gr::filter::fir_filter_ccf::make(1,
-                                                                            gr::filter::firdes::low_pass(
-                                                                                1,
-                                                                                samp_rate,
-                                                                                cutoff,
-                                                                                transition));
+// @param tuner The tuner context
+// @return how much each buffer along the audio chain may hold, in seconds, 0 for no limit
+double latency_budget_s(rtl_ctx_t* tuner)
+{
+    return tuner->latency_profile == RTL_LATENCY_LOW ? RTL_LOW_LATENCY_BUFFER_MS / 1e3 : 0.0;
+}
 
+// Sizes the buffers along the audio chain for the tuner's latency profile.  The limits are in
+// time, so each block gets a number of items for the rate it runs at.
+// @param tuner The tuner context
+void apply_latency_profile(rtl_ctx_t* tuner)
+{
+    double budget_s = latency_budget_s(tuner);
 
-    gr::analog::wfmrcv::sptr wfm = gr::analog::wfmrcv::make(
-      quadrature,
-      audio_dec
-    );
+    bound_block_buffers(tuner->source, int(tuner->samp_rate * budget_s));
+    bound_block_buffers(tuner->retune_tagger, int(tagger_rate(tuner) * budget_s));
+    if (tuner->scan_gate) {
+        bound_block_buffers(tuner->scan_gate, int(tagger_rate(tuner) * budget_s));
+    }
+    bound_block_buffers(tuner->channelizer, int(tuner->quad_rate * budget_s));
+    bound_block_buffers(tuner->wfm, int(tuner->audio_rate * budget_s));
+    bound_block_buffers(tuner->rresamp0, int(AUDIO_OUT_RATE * budget_s));
+    bound_block_buffers(tuner->audio_mute, int(AUDIO_OUT_RATE * budget_s));
+    if (tuner->stereo) {
+        bound_block_buffers(tuner->rresamp0_r, int(AUDIO_OUT_RATE * budget_s));
+        bound_block_buffers(tuner->audio_mute_r, int(AUDIO_OUT_RATE * budget_s));
+    }
+    std::lock_guard<std::mutex> lock(tuner->sink_mtx);
+    for (gr::block_sptr sink : tuner->sinks) {
+        bound_block_buffers(sink, int(AUDIO_OUT_RATE * budget_s));
+    }
+}
 
+// Lists the top level blocks of one group of the tuner's flowgraph, hier blocks are not broken down
+// @param tuner The tuner context
+// @param group Which group
+gr::basic_block_vector_t group_blocks(rtl_ctx_t* tuner, rtl_block_group_t group)
+{
+    gr::basic_block_vector_t blocks;
+    std::lock_guard<std::mutex> lock(tuner->virtual_mtx);
+    switch (group) {
+    case RTL_GROUP_FRONT_END:
+        blocks = {tuner->source, tuner->retune_tagger, tuner->channelizer, tuner->band_probe};
+        if (tuner->scan_gate) {
+            blocks.push_back(tuner->scan_gate);
+        }
+        if (tuner->recorder) {
+            blocks.push_back(tuner->recorder);
+        }
+        if (tuner->headroom_probe) {
+            blocks.push_back(tuner->headroom_probe);
+        }
+        if (tuner->pfb) {
+            blocks.push_back(tuner->pfb);
+        }
+        break;
+    case RTL_GROUP_DEMOD:
+        blocks = {tuner->wfm, tuner->avg_magnitude, tuner->quality};
+        for (virtual_tuner& vt : tuner->virtual_tuners) {
+            blocks.push_back(vt.wfm);
+            blocks.push_back(vt.probe);
+        }
+        break;
+    case RTL_GROUP_AUDIO:
+        blocks = {tuner->rresamp0, tuner->audio_mute, tuner->latency_probe};
+        if (tuner->stereo) {
+            blocks.push_back(tuner->rresamp0_r);
+            blocks.push_back(tuner->audio_mute_r);
+        }
+        {
+            std::lock_guard<std::mutex> sink_lock(tuner->sink_mtx);
+            blocks.insert(blocks.end(), tuner->sinks.begin(), tuner->sinks.end());
+        }
+        break;
+    case RTL_GROUP_RDS:
+        blocks = {tuner->rds};
+        for (virtual_tuner& vt : tuner->virtual_tuners) {
+            blocks.push_back(vt.rds);
+        }
+        break;
+    default:
+        break;
+    }
+    return blocks;
+}
 
-    gr::hier_block2_sptr wfmrcv = gr::make_hier_block2(
-        "wfm_rcv",
-        gr::io_signature::make(1, 1, sizeof(gr_complex)),
-        gr::io_signature::make(1, 1, sizeof(float)));
+// Lists the top level blocks of the tuner's flowgraph, hier blocks are not broken down
+// @param tuner The tuner context
+gr::basic_block_vector_t tuner_blocks(rtl_ctx_t* tuner)
+{
+    gr::basic_block_vector_t blocks;
+    for (int group = 0; group < RTL_NUM_BLOCK_GROUPS; ++group) {
+        gr::basic_block_vector_t members = group_blocks(tuner, rtl_block_group_t(group));
+        blocks.insert(blocks.end(), members.begin(), members.end());
+    }
+    return blocks;
+}
 
-    gr::analog::probe_avg_mag_sqrd_f::sptr mag_probe = gr::analog::probe_avg_mag_sqrd_f::make(0.0);
-    context.avg_magnitude = mag_probe;
+// Pins every block of the tuner's flowgraph to its group's CPUs, or the tuner's if the group has
+// none, so tuners on different dongles don't compete for the same cores and caches.  Hier blocks
+// pass the affinity on to their insides.
+// @param tuner The tuner context
+void apply_cpu_affinity(rtl_ctx_t* tuner)
+{
+    for (int group = 0; group < RTL_NUM_BLOCK_GROUPS; ++group) {
+        const std::vector<int>& cores = tuner->group_sched[group].cpu_cores.empty() ?
+            tuner->cpu_cores : tuner->group_sched[group].cpu_cores;
+        if (cores.empty()) {
+            continue;
+        }
+        for (gr::basic_block_sptr blk : group_blocks(tuner, rtl_block_group_t(group))) {
+            blk->set_processor_affinity(cores);
+        }
+    }
+}
 
-    context.rds = gr::analog::rds_receiver::make();
+// Sets the work() size of blk, or of each block inside it for the library's hier blocks.  Other
+// hier blocks, e.g. the osmosdr source, keep the defaults.  The priority needs the block's thread,
+// apply_block_realtime sets it once the flowgraph runs.
+// @param blk The block
+// @param sched The group's settings
+void apply_block_sched(gr::basic_block_sptr blk, const block_group_sched& sched)
+{
+    gr::block_sptr block = boost::dynamic_pointer_cast<gr::block>(blk);
+    if (block) {
+        if (sched.max_noutput_items > 0) {
+            block->set_max_noutput_items(sched.max_noutput_items);
+        }
+        return;
+    }
 
-    tb->connect(
-        rtlsrc, 0,
-        rresamp1, 0);
+    boost::shared_ptr<gr::block_list> list = boost::dynamic_pointer_cast<gr::block_list>(blk);
+    if (list) {
+        for (gr::basic_block_sptr inner : list->inner_blocks()) {
+            apply_block_sched(inner, sched);
+        }
+    }
+}
 
-    tb->connect(
-        rresamp1, 0,
-        lp0, 0);
+// Applies each group's work() size.  Runs after apply_latency_profile, so a group's
+// max_noutput_items overrides the latency profile's.
+// @param tuner The tuner context
+void apply_group_sched(rtl_ctx_t* tuner)
+{
+    for (int group = 0; group < RTL_NUM_BLOCK_GROUPS; ++group) {
+        for (gr::basic_block_sptr blk : group_blocks(tuner, rtl_block_group_t(group))) {
+            apply_block_sched(blk, tuner->group_sched[group]);
+        }
+    }
+}
 
-    tb->connect(
-        lp0, 0,
-        wfm, 0);
+// Moves the thread of blk, or of each block inside it for the library's hier blocks, to SCHED_FIFO
+// at priority.  GNU Radio's set_thread_priority keeps the thread's SCHED_OTHER policy, which only
+// takes priority 0.  The flowgraph has to be running: each thread leaves its handle in the block's
+// detail as it starts.
+// @param blk The block
+// @param priority SCHED_FIFO priority, 1 and up
+// @return false if a thread could not be switched
+bool apply_block_realtime(gr::basic_block_sptr blk, int priority)
+{
+    gr::block_sptr block = boost::dynamic_pointer_cast<gr::block>(blk);
+    if (block) {
+        gr::block_detail_sptr detail = block->detail();
+        std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(THREAD_START_TIMEOUT_MS);
+        while (detail && !detail->threaded && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!detail || !detail->threaded) {
+            printf("Error: apply_block_realtime - %s has no thread\n", block->alias().c_str());
+            return false;
+        }
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        int err = pthread_setschedparam(detail->thread, SCHED_FIFO, &param);
+        if (err != 0) {
+            printf("Error: apply_block_realtime - %s to SCHED_FIFO %d: %s\n", block->alias().c_str(), priority, strerror(err));
+            return false;
+        }
+        return true;
+    }
 
-    tb->connect(
-        wfm, 0,
-        mag_probe, 0);
+    bool ok = true;
+    boost::shared_ptr<gr::block_list> list = boost::dynamic_pointer_cast<gr::block_list>(blk);
+    if (list) {
+        for (gr::basic_block_sptr inner : list->inner_blocks()) {
+            ok = apply_block_realtime(inner, priority) && ok;
+        }
+    }
+    return ok;
+}
 
-    tb->connect(
-        wfm, 0,
-        context.rresamp0, 0);
+// Moves the threads of every group with a priority to SCHED_FIFO, on a running flowgraph
+// @param tuner The tuner context
+// @return false if a thread could not be switched, e.g. without CAP_SYS_NICE or an rtprio limit
+bool apply_group_realtime(rtl_ctx_t* tuner)
+{
+    bool ok = true;
+    for (int group = 0; group < RTL_NUM_BLOCK_GROUPS; ++group) {
+        int priority = tuner->group_sched[group].priority;
+        if (priority <= 0) {
+            continue;
+        }
+        for (gr::basic_block_sptr blk : group_blocks(tuner, rtl_block_group_t(group))) {
+            ok = apply_block_realtime(blk, priority) && ok;
+        }
+    }
+    return ok;
+}
 
-    tb->connect(
-        wfm, 0,
-        context.rds, 0);
+// Chooses between GNU Radio's default buffer sizes and small buffers along the audio chain, which
+// bring the antenna to speaker delay and the audible delay after rtl_set_fm down.  Takes effect
+// the next time the tuner is started.
+// Part of the external API
+// @param tuner The tuner context
+// @param profile RTL_LATENCY_DEFAULT or RTL_LATENCY_LOW
+void rtl_set_latency_profile(rtl_ctx_t* tuner, rtl_latency_profile_t profile)
+{
+    tuner->latency_profile = profile;
+}
 
+// Sets the CPUs, real-time priority and work() size of one group of the tuner's blocks, see
+// rtl_group_sched_t for a recommended layout.  Takes effect the next time the tuner is started.
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param group Which blocks
+// @param sched The settings, NULL to go back to the defaults
+// @return 0 on success, -1 if the group or the priority is out of range
+int rtl_set_group_sched(rtl_ctx_t* tuner, rtl_block_group_t group, const rtl_group_sched_t* sched)
+{
+    if (group < 0 || group >= RTL_NUM_BLOCK_GROUPS) {
+        printf("Error: rtl_set_group_sched - no block group %d\n", int(group));
+        return -1;
+    }
 
-    // Sinks are defined in separate methods
-    printf("gr_rtl: flowgraph is connected\n");
-}
+    block_group_sched& settings = tuner->group_sched[group];
+    if (sched == NULL) {
+        settings = block_group_sched();
+        return 0;
+    }
+    if (sched->priority < 0 || sched->priority > sched_get_priority_max(SCHED_FIFO)) {
+        printf("Error: rtl_set_group_sched - priority %d is out of range\n", sched->priority);
+        return -1;
+    }
 
-void rtl_add_audio_sink(rtl_ctx_t* this_tuner, const char* device, int sampling_rate) {
-    gr::audio::sink::sptr audsink = NULL;
-    try {
-        audsink = gr::audio::sink::make(sampling_rate, device);
-    } catch(...) {
-        // code to handle any exception
-        printf("Exception Caught: rtl_add_audio_sink - invalid audio sinks device\n");
-        return;
+    settings.cpu_cores.clear();
+    if (sched->cpu_cores != NULL) {
+        settings.cpu_cores.assign(sched->cpu_cores, sched->cpu_cores + sched->num_cpu_cores);
     }
+    settings.priority = sched->priority;
+    settings.max_noutput_items = std::max(0, sched->max_noutput_items);
+    return 0;
+}
 
-    this_tuner->top_block->connect(
-        this_tuner->rresamp0, 0,
-        audsink, 0);
+// Gets the measured latency from the RTL source to the audio sinks since the tuner was started.
+// The time spent in the sound card's own buffer is not included.
+// Part of the external API
+// @param tuner The tuner context
+// @param stats_out Receives the measurements
+// @return number of measurements, one is taken every 100 ms
+unsigned int rtl_get_latency(rtl_ctx_t* tuner, rtl_latency_stats_t* stats_out)
+{
+    stats_out->num_measurements = tuner->latency_probe->get_stats(
+        stats_out->last_ms,
+        stats_out->mean_ms,
+        stats_out->min_ms,
+        stats_out->max_ms);
+    return stats_out->num_measurements;
+}
 
-    this_tuner->sinks.push_back(audsink);
+// Applies the tuner's scheduling settings and starts its flowgraph, for rtl_start_fm and rtl_resume
+// @param tuner The tuner context
+// @return false if a group's real-time priority could not be set, the flowgraph runs regardless
+bool start_flowgraph(rtl_ctx_t* tuner)
+{
+    apply_latency_profile(tuner);
+    apply_cpu_affinity(tuner);
+    apply_group_sched(tuner);
+    // The block executors read the switch as they are created, so it only applies to this flowgraph
+    gr::prefs::singleton()->set_bool("PerfCounters", "on", tuner->perf_counters);
+    tuner->perf_start_ns = gr::blocks::retune_tagger_cc::timestamp_now();
+    tuner->top_block->start();
+    return apply_group_realtime(tuner);
 }
 
-// remove the last audio sink device
+// Starts up a tuner context running.  Intended to be used with rtl_wait() since rtl_start_fm is nonblocking.
+// The assumption is that the caller will start this function on a dedicated thread and
+// then that thread will call rtl_wait to block until terminated by a different thread.
 // Part of the external API
-// @param The tuner context
-void rtl_remove_audio_sink(rtl_ctx_t* this_tuner) {
-    if (this_tuner == NULL)
+// @param tuner The tuner context
+// @return 0 once running, -1 if it could not be started, -2 if it runs but a block group's
+//         real-time priority could not be set
+int rtl_start_fm(rtl_ctx_t* tuner)
+{
+    if (tuner == NULL)
     {
         printf("Error: rtl_start_fm - no tuner specified\n");
-        return;
+        return -1;
     }
 
-    if (this_tuner->sinks.size() == 0)
+    if (tuner->sinks.size() == 0)
     {
         printf("Error: rtl_start_fm - no audio sinks specified for tuner\n");
-        return;
+        return -1;
     }
 
-    this_tuner->top_block->disconnect(this_tuner->sinks.back());
-    this_tuner->sinks.pop_back();
-}
-
-void rtl_add_wav_sink(rtl_ctx_t* this_tuner, const char* file_name, int sampling_rate) {
-    gr::blocks::wavfile_sink::sptr filesink = gr::blocks::wavfile_sink::make(
-        file_name,
-        1,
-        sampling_rate
-    );
-
-    this_tuner->top_block->connect(
-        this_tuner->rresamp0, 0,
-        filesink, 0);
-
-    this_tuner->sinks.push_back(filesink);
-}
-
-// Creates and allocates an instance of an rtl tuner context.
-// Part of the external API
-// @return A pointer to a newly allocated tuner context
-rtl_ctx_t* rtl_create_tuner()
-{
-    printf("gr_rtl: create_tuner\n");
-    rtl_ctx_t* tuner_ctx = new rtl_ctx_t;
-    if (tuner_ctx == NULL)
+    if (tuner->paused)
     {
-        printf("Error: rtl_create_tuner - out of memory\n");
-        return NULL;
+        printf("Error: rtl_start_fm - tuner is paused, use rtl_resume\n");
+        return -1;
     }
-    create_fm_device(*tuner_ctx);
 
-    return tuner_ctx;
+    tuner->latency_probe->reset();
+    if (tuner->start_time_ns == 0) {
+        tuner->start_time_ns = gr::blocks::retune_tagger_cc::timestamp_now();
+    }
+    return start_flowgraph(tuner) ? 0 : -2;
 }
 
-// Shuts down and destroyes a tuner context
+// Stops the dongle streaming and the flowgraph's threads without tearing anything down: the
+// device stays open, and the filter taps, PLL and RDS state and the station list stay as they
+// are, so rtl_resume only has to start the threads again.  A scan in progress is cut short and
+// runs again after the resume.  rtl_wait keeps blocking while the tuner is paused.
 // Part of the external API
-// @param The tuner context
-void rtl_destroy_tuner(rtl_ctx_t* tuner)
+// @param tuner The tuner context, started with rtl_start_fm
+void rtl_pause(rtl_ctx_t* tuner)
 {
     if (tuner == NULL)
     {
-        printf("Error: rtl_destroy_tuner - null pointer\n");
+        printf("Error: rtl_pause - no tuner specified\n");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lifecycle(tuner->lifecycle_mtx);
+    if (tuner->start_time_ns == 0) {
+        printf("Error: rtl_pause - the tuner was never started\n");
         return;
     }
+    uint64_t start = gr::blocks::retune_tagger_cc::timestamp_now();
+    {
+        std::lock_guard<std::mutex> lock(tuner->run_mtx);
+        if (tuner->paused) {
+            return;
+        }
+        tuner->paused = true;
+    }
+    // rtl_resume restarts the first audio clock, the one of rtl_start_fm is kept here
+    if (tuner->first_audio_ns == 0) {
+        tuner->first_audio_ns = tuner->latency_probe->first_sample_time();
+    }
     tuner->top_block->stop();
-    tuner->top_block.reset();
-    delete tuner;
+    {
+        // GNU Radio can't be waited on by two threads at once, rtl_wait's wait has to return first
+        std::unique_lock<std::mutex> lock(tuner->run_mtx);
+        tuner->run_cv.wait(lock, [tuner] { return tuner->waiters == 0; });
+    }
+    tuner->top_block->wait();
+    tuner->startup_stats.pause_ms = (gr::blocks::retune_tagger_cc::timestamp_now() - start) / 1e6;
 }
 
-// Starts up a tuner context running.  Intended to be used with rtl_wait() since rtl_start_fm is nonblocking.
-// The assumption is that the caller will start this function on a dedicated thread and
-// then that thread will call rtl_wait to block until terminated by a different thread.
+// Starts a tuner paused by rtl_pause again, on the frequency and with the sinks it had.  The
+// time to the first audio is in rtl_get_startup_stats.
 // Part of the external API
 // @param tuner The tuner context
-void rtl_start_fm(rtl_ctx_t* tuner)
+// @return 0 once running or if it wasn't paused, -1 without a tuner, -2 if it runs but a block
+//         group's real-time priority could not be set
+int rtl_resume(rtl_ctx_t* tuner)
 {
     if (tuner == NULL)
     {
-        printf("Error: rtl_start_fm - no tuner specified\n");
-        return;
+        printf("Error: rtl_resume - no tuner specified\n");
+        return -1;
     }
 
-    if (tuner->sinks.size() == 0)
+    std::lock_guard<std::mutex> lifecycle(tuner->lifecycle_mtx);
+    if (!tuner->paused) {
+        return 0;
+    }
+    uint64_t start = gr::blocks::retune_tagger_cc::timestamp_now();
+    tuner->resume_time_ns = start;
+    tuner->latency_probe->reset();
+    if (tuner->headroom_probe) {
+        // The first window after the restart can still hold samples from before the pause
+        std::lock_guard<std::mutex> lock(tuner->agc_mtx);
+        agc_restart_windows(tuner);
+    }
+    bool sched_ok = start_flowgraph(tuner);
     {
-        printf("Error: rtl_start_fm - no audio sinks specified for tuner\n");
-        return;
+        std::lock_guard<std::mutex> lock(tuner->run_mtx);
+        tuner->paused = false;
     }
-
-    tuner->top_block->start();
+    tuner->run_cv.notify_all();
+    {
+        // Taken so the scanner can't miss the wakeup between looking at paused and waiting
+        std::lock_guard<std::mutex> lock(tuner->scan_mtx);
+    }
+    tuner->scan_cv.notify_one();
+    ++tuner->startup_stats.resumes;
+    tuner->startup_stats.resume_ms = (gr::blocks::retune_tagger_cc::timestamp_now() - start) / 1e6;
+    return sched_ok ? 0 : -2;
 }
 
 // Blocks until the tuner is stopped from a different thread.  The flowgraph this was
@@ -429,7 +2663,20 @@ void rtl_wait(rtl_ctx_t* tuner)
         return;
     }
 
-    tuner->top_block->wait();
+    std::unique_lock<std::mutex> lock(tuner->run_mtx);
+    for (;;) {
+        tuner->run_cv.wait(lock, [tuner] { return !tuner->paused; });
+        ++tuner->waiters;
+        lock.unlock();
+        tuner->top_block->wait();
+        lock.lock();
+        --tuner->waiters;
+        tuner->run_cv.notify_all();
+        // Stopped, or a replay ran out, rather than paused
+        if (!tuner->paused) {
+            return;
+        }
+    }
 }
 
 // Stops a running flowgraph
@@ -443,6 +2690,13 @@ void rtl_stop_fm(rtl_ctx_t* tuner)
         return;
     }
 
+    std::lock_guard<std::mutex> lifecycle(tuner->lifecycle_mtx);
+    {
+        // A paused tuner is already stopped, this lets rtl_wait return
+        std::lock_guard<std::mutex> lock(tuner->run_mtx);
+        tuner->paused = false;
+    }
+    tuner->run_cv.notify_all();
     tuner->top_block->stop();
 }
 
@@ -454,3 +2708,93 @@ float rtl_get_signal_str(rtl_ctx_t* tuner)
 {
     return tuner->avg_magnitude->level();
 }
+
+// Measures the tuned station the way the scanner does: RSSI, SNR and pilot since the last retune,
+// and the RDS block error rate since RDS was last reset (the retune, or the scanner)
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param station_out Receives the frequency, RDS name and genre, and the metrics
+void rtl_get_station_quality(rtl_ctx_t* tuner, station_info_t* station_out)
+{
+    gr::rds::rds_snapshot rds;
+    tuner->rds->rds_sink->get_snapshot(rds);
+    memset(station_out, 0, sizeof(*station_out));
+    station_out->frequency = rtl_get_fm(tuner);
+    strncpy(station_out->name, rds.callsign, STATION_NAME_MAX_LEN);
+    strncpy(station_out->genre, rds.pty, STATION_GENRE_MAX_LEN);
+    fill_station_metrics(tuner, rds, *station_out);
+}
+
+// Reports the gain the software AGC has set and the ADC level it set it for
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param stats_out Receives the AGC state, all 0 if it isn't running
+void rtl_get_agc_stats(rtl_ctx_t* tuner, rtl_agc_stats_t* stats_out)
+{
+    std::lock_guard<std::mutex> lock(tuner->agc_mtx);
+    *stats_out = tuner->agc_stats;
+    stats_out->enabled = tuner->headroom_probe ? 1 : 0;
+}
+
+static_assert(unsigned(RTL_RDS_PI) == gr::rds::RDS_FIELD_PI &&
+              unsigned(RTL_RDS_FLAGS) == gr::rds::RDS_FIELD_FLAGS,
+              "rtl_rds_field_t must match gr::rds::rds_field");
+static_assert(RTL_RDS_MAX_AF == gr::rds::RDS_MAX_AF, "AF list sizes differ");
+
+// Copies the RDS data decoded for the tuned station.  Safe to call from any thread, including the
+// RDS callback, it neither locks nor allocates.
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param info_out Receives the data, fields not decoded yet are 0 or empty
+void rtl_get_rds_info(rtl_ctx_t* tuner, rtl_rds_info_t* info_out)
+{
+    gr::rds::rds_snapshot rds;
+    tuner->rds->rds_sink->get_snapshot(rds);
+
+    memset(info_out, 0, sizeof(*info_out));
+    info_out->pi = rds.pi;
+    memcpy(info_out->callsign, rds.callsign, sizeof(info_out->callsign));
+    memcpy(info_out->ps, rds.ps, sizeof(info_out->ps));
+    info_out->pty = rds.pty_code;
+    memcpy(info_out->pty_name, rds.pty, sizeof(info_out->pty_name));
+    info_out->traffic_program = rds.traffic_program;
+    info_out->traffic_announcement = rds.traffic_announcement;
+    info_out->music = rds.music;
+    memcpy(info_out->radiotext, rds.radiotext, sizeof(info_out->radiotext));
+    for (int i = 0; i < 2; i++) {
+        info_out->rtplus_type[i] = rds.rtplus[i].content_type;
+        memcpy(info_out->rtplus_text[i], rds.rtplus[i].text, sizeof(info_out->rtplus_text[i]));
+    }
+    info_out->clock_time = rds.clock_time;
+    info_out->clock_offset_min = rds.clock_offset_min;
+    info_out->num_af = rds.num_af;
+    memcpy(info_out->af_khz, rds.af_khz, sizeof(info_out->af_khz));
+}
+
+static void rds_changed(uint32_t changed, void* user_data)
+{
+    rtl_ctx_t* tuner = (rtl_ctx_t*)user_data;
+    if (tuner->rds_callback) {
+        tuner->rds_callback(tuner, changed, tuner->rds_callback_data);
+    }
+}
+
+// Registers a callback for changes of the tuned station's RDS data, so it doesn't need polling with
+// rtl_get_rds_info.  A retune clears the data, expect RTL_RDS_PI first and the text fields once
+// they were received completely.  Scans retune too, so the callback sees the stations they visit.
+// Set it before rtl_start_fm.
+// Part of the external (C) API
+// @param tuner The tuner context
+// @param callback Called with the rtl_rds_field_t bits that changed, NULL to stop
+// @param user_data Handed back to the callback
+void rtl_set_rds_callback(rtl_ctx_t* tuner, rtl_rds_callback_t callback, void* user_data)
+{
+    tuner->rds_callback = callback;
+    tuner->rds_callback_data = user_data;
+    if (callback) {
+        tuner->rds->rds_sink->set_change_callback(rds_changed, tuner);
+    }
+    else {
+        tuner->rds->rds_sink->set_change_callback(nullptr, nullptr);
+    }
+}
@@ -0,0 +1,171 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Tim Rice (trice2@jaguarlandrover.com)
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gr_station_cache.h"
+
+namespace gr
+{
+namespace rds
+{
+
+station_cache::station_cache(void *mapping, size_t mapping_len)
+    : _mapping(mapping),
+    _mapping_len(mapping_len),
+    _hdr((station_cache_header *)mapping),
+    _entries((station_cache_entry *)((uint8_t *)mapping + sizeof(station_cache_header)))
+{
+}
+
+station_cache::~station_cache()
+{
+    msync(_mapping, _mapping_len, MS_SYNC);
+    munmap(_mapping, _mapping_len);
+}
+
+// Maps the cache file, creating it or starting it over if it doesn't match the band plan
+// @param path File to keep the cache in
+// @return the cache, or an empty pointer if the file could not be mapped
+station_cache::sptr station_cache::open(
+    const std::string &path,
+    double band_start_mhz,
+    double spacing_mhz,
+    unsigned int num_channels)
+{
+    size_t len = sizeof(station_cache_header) + num_channels * sizeof(station_cache_entry);
+    int fd = ::open(path.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return sptr();
+    }
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || size_t(st.st_size) != len;
+    void *mapping = MAP_FAILED;
+    if (!fresh || ftruncate(fd, len) == 0) {
+        mapping = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return sptr();
+    }
+
+    station_cache_header *hdr = (station_cache_header *)mapping;
+    if (fresh
+        || hdr->magic != STATION_CACHE_MAGIC
+        || hdr->version != STATION_CACHE_VERSION
+        || hdr->num_channels != num_channels
+        || hdr->entry_size != sizeof(station_cache_entry)
+        || hdr->band_start_mhz != band_start_mhz
+        || hdr->spacing_mhz != spacing_mhz) {
+        memset(mapping, 0, len);
+        hdr->magic = STATION_CACHE_MAGIC;
+        hdr->version = STATION_CACHE_VERSION;
+        hdr->num_channels = num_channels;
+        hdr->entry_size = sizeof(station_cache_entry);
+        hdr->band_start_mhz = band_start_mhz;
+        hdr->spacing_mhz = spacing_mhz;
+        station_cache_entry *entries = (station_cache_entry *)((uint8_t *)mapping + sizeof(station_cache_header));
+        for (unsigned int channel = 0; channel < num_channels; ++channel) {
+            entries[channel].frequency = band_start_mhz + channel * spacing_mhz;
+        }
+    }
+    return sptr(new station_cache(mapping, len));
+}
+
+// @return the channel freq_mhz is on, -1 if it is outside the band or between channels
+int station_cache::channel_of(double freq_mhz) const
+{
+    double offset = (freq_mhz - _hdr->band_start_mhz) / _hdr->spacing_mhz;
+    int channel = int(round(offset));
+    if (fabs(offset - channel) > 0.01 || channel < 0 || channel >= int(_hdr->num_channels)) {
+        return -1;
+    }
+    return channel;
+}
+
+// Copies the entry of a channel
+// @return false if the channel is out of range or nothing is known about it
+bool station_cache::lookup(int channel, station_cache_entry &entry)
+{
+    if (channel < 0 || channel >= int(_hdr->num_channels)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    entry = _entries[channel];
+    return entry.pi != 0 || entry.last_seen > 0.0;
+}
+
+// Gets the stations the most recent scan found, in channel order
+// @param last_scan Receives when that scan completed, 0 if the cache has never seen a scan
+std::vector<station_cache_entry> station_cache::found_stations(double &last_scan)
+{
+    std::vector<station_cache_entry> stations;
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (unsigned int channel = 0; channel < _hdr->num_channels; ++channel) {
+        if (_entries[channel].found) {
+            stations.push_back(_entries[channel]);
+        }
+    }
+    last_scan = _hdr->last_scan;
+    return stations;
+}
+
+// Stores the PI and callsign rds_sink decoded on a channel.  Takes C strings so the message thread
+// doesn't build a std::string for every group.
+void station_cache::update_pi(int channel, uint32_t pi, const char *callsign)
+{
+    if (channel < 0 || channel >= int(_hdr->num_channels)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    station_cache_entry &entry = _entries[channel];
+    entry.pi = pi;
+    snprintf(entry.callsign, sizeof(entry.callsign), "%s", callsign);
+}
+
+// Stores the program type rds_sink decoded on a channel
+void station_cache::update_genre(int channel, const char *genre)
+{
+    if (channel < 0 || channel >= int(_hdr->num_channels)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    snprintf(_entries[channel].genre, sizeof(_entries[channel].genre), "%s", genre);
+}
+
+// Records the result of a full scan: the channels it found a station on and their levels.  Every
+// other channel is marked as not found but keeps its RDS data for the next time it shows up.
+void station_cache::record_scan(const std::vector<int> &channels, const std::vector<float> &levels, double completed)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (unsigned int channel = 0; channel < _hdr->num_channels; ++channel) {
+            _entries[channel].found = 0;
+        }
+        for (size_t i = 0; i < channels.size(); ++i) {
+            if (channels[i] < 0 || channels[i] >= int(_hdr->num_channels)) {
+                continue;
+            }
+            station_cache_entry &entry = _entries[channels[i]];
+            entry.found = 1;
+            entry.level = levels[i];
+            entry.last_seen = completed;
+        }
+        _hdr->last_scan = completed;
+    }
+    msync(_mapping, _mapping_len, MS_ASYNC);
+}
+
+} // namespace rds
+} // namespace gr
@@ -0,0 +1,128 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <algorithm>
+#include <cmath>
+#include <gnuradio/io_signature.h>
+
+#include "gr_stereo_demod.h"
+#include "gr_retune_tagger.h"
+
+namespace gr
+{
+namespace analog
+{
+
+const double PILOT_CUTOFF = 20.0;       // corner of each of the pilot detector's two one poles, Hz
+const double PILOT_SETTLE = 5.0;        // detector time constants before the blend moves off mono
+const double NOISE_TAU_S = 0.2;         // time constant of the noise power average
+// The pilot SNR is in the detector's bandwidth of a few Hz.  With FM's rising noise it comes out a
+// few dB above the mono audio SNR, and L-R costs about 20 dB of that.
+const double BLEND_MONO_DB = 30.0;      // pilot SNR at and below which L-R is muted
+const double BLEND_STEREO_DB = 50.0;    // pilot SNR from which L-R is passed in full
+const double BLEND_SLEW_S = 0.1;        // fastest time from mono to full stereo, so it doesn't click
+const unsigned int BLEND_DECIM = 16;    // samples per update of the blend target
+
+stereo_demod::~stereo_demod()
+{
+}
+
+void stereo_demod::restart()
+{
+    _n = 0;
+    _pilot1 = gr_complex(0.0f, 0.0f);
+    _pilot2 = gr_complex(0.0f, 0.0f);
+    _noise = 0.0f;
+    _blend_gain = 0.0f;
+    _blend_target = 0.0f;
+}
+
+// The second one pole takes the 2 * 19 kHz mixing product and the program around the pilot down
+// another 40 dB or so, a single one would leave enough of them to hold the SNR near BLEND_STEREO_DB
+void stereo_demod::update_blend()
+{
+    float in_phase = _pilot2.real();
+    float quadrature = _pilot2.imag();
+    _noise += _noise_alpha * (quadrature * quadrature - _noise);
+    if (_n < _settle || in_phase <= 0.0f) {
+        // Still acquiring, or locked to anything but the pilot's phase
+        _blend_target = 0.0f;
+        return;
+    }
+    double snr_db = 10.0 * log10(in_phase * in_phase / std::max(_noise, 1e-20f));
+    _blend_target = float(std::min(1.0, std::max(0.0,
+        (snr_db - BLEND_MONO_DB) / (BLEND_STEREO_DB - BLEND_MONO_DB))));
+}
+
+// The pilot is sin(t) and the L-R subcarrier sin(2t).  The complex band pass in front of the PLL
+// keeps only the positive frequency half of the pilot, e^(j(t - pi/2)), which the PLL locks to, so
+//   ref   = -j e^(jt)
+//   ref^2 = -e^(j2t)   and   sin(2t) = -Im(ref^2)
+//   ref^3 =  j e^(j3t)
+// The RDS phase doesn't matter, the PSK demodulator recovers it.  Re(ref) = sin(t) is the pilot's
+// phase, so the pilot detector low-passes 2 * mpx * conj(ref): the real part is the pilot
+// amplitude and the imaginary part, on cos(t), has only the noise.
+int stereo_demod::work(
+    int noutput_items,
+    gr_vector_const_void_star &input_items,
+    gr_vector_void_star &output_items)
+{
+    const float *mpx = (const float *)input_items[0];
+    const gr_complex *ref = (const gr_complex *)input_items[1];
+    float *lpr = (float *)output_items[0];
+    float *lmr = (float *)output_items[1];
+    gr_complex *rds = (gr_complex *)output_items[2];
+
+    uint64_t first = nitems_read(0);
+    get_tags_in_range(_tags, 0, first, first + noutput_items, blocks::retune_tagger_cc::retune_key());
+    std::sort(_tags.begin(), _tags.end(), tag_t::offset_compare);
+    std::vector<tag_t>::const_iterator tag = _tags.begin();
+    for (int i = 0; i < noutput_items; ++i) {
+        for (; tag != _tags.end() && tag->offset == first + i; ++tag) {
+            restart();
+        }
+        gr_complex ref2 = ref[i] * ref[i];
+        gr_complex ref3 = ref2 * ref[i];
+        _pilot1 += _pilot_alpha * (2.0f * mpx[i] * std::conj(ref[i]) - _pilot1);
+        _pilot2 += _pilot_alpha * (_pilot1 - _pilot2);
+        if (++_n % BLEND_DECIM == 0) {
+            update_blend();
+        }
+        if (_blend_gain < _blend_target) {
+            _blend_gain = std::min(_blend_target, _blend_gain + _blend_step);
+        }
+        else {
+            _blend_gain = std::max(_blend_target, _blend_gain - _blend_step);
+        }
+        lpr[i] = mpx[i];
+        lmr[i] = -2.0f * _blend_gain * mpx[i] * ref2.imag();
+        rds[i] = mpx[i] * std::conj(ref3);
+    }
+    return noutput_items;
+}
+
+stereo_demod::stereo_demod(double sample_rate)
+    : sync_block(
+        "stereo_demod",
+        io_signature::makev(2, 2, std::vector<int>{sizeof(float), sizeof(gr_complex)}),
+        io_signature::makev(3, 3, std::vector<int>{sizeof(float), sizeof(float), sizeof(gr_complex)}))
+{
+    _pilot_alpha = float(1.0 - exp(-2.0 * M_PI * PILOT_CUTOFF / sample_rate));
+    _noise_alpha = float(BLEND_DECIM / (NOISE_TAU_S * sample_rate));
+    _blend_step = float(1.0 / (BLEND_SLEW_S * sample_rate));
+    _settle = uint64_t(PILOT_SETTLE / _pilot_alpha);
+    restart();
+}
+
+// @param sample_rate Rate of the MPX and the reference, for the pilot detector and the blend times
+stereo_demod::sptr stereo_demod::make(double sample_rate)
+{
+    return gnuradio::get_initial_sptr(new stereo_demod(sample_rate));
+}
+
+} // namespace analog
+} // namespace gr
@@ -0,0 +1,320 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+
+#include "gr_tap_cache.h"
+
+namespace gr
+{
+namespace filter
+{
+
+enum tap_design : uint32_t {
+    DESIGN_LOW_PASS = 1,
+    DESIGN_LOW_PASS_2,
+    DESIGN_COMPLEX_BAND_PASS,
+    DESIGN_ROOT_RAISED_COSINE
+};
+
+// Which design and its parameters, also the on-disk record header
+struct tap_key {
+    uint32_t design;
+    int32_t window;
+    double params[6];
+
+    bool operator<(const tap_key &other) const
+    {
+        return memcmp(this, &other, sizeof(tap_key)) < 0;
+    }
+};
+static_assert(sizeof(tap_key) == 56, "tap cache keys are a fixed on-disk layout");
+
+struct tap_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t reserved;
+};
+
+struct tap_record_header {
+    tap_key key;
+    uint32_t is_complex;
+    uint32_t num_taps;
+};
+
+struct tap_entry {
+    std::vector<float> real;
+    std::vector<gr_complex> complex;
+};
+
+struct tap_store {
+    std::mutex mtx;
+    std::map<tap_key, tap_entry> entries;   // never erased from, references into it stay valid
+    bool modified = false;
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+    double design_ms = 0.0;
+};
+
+static tap_store &store()
+{
+    static tap_store s;
+    return s;
+}
+
+static std::vector<float> &entry_taps(tap_entry &entry, const float *)
+{
+    return entry.real;
+}
+
+static std::vector<gr_complex> &entry_taps(tap_entry &entry, const gr_complex *)
+{
+    return entry.complex;
+}
+
+static tap_key make_key(tap_design design, int window, double p0, double p1, double p2, double p3,
+                        double p4 = 0.0, double p5 = 0.0)
+{
+    tap_key key;
+    memset(&key, 0, sizeof(key));
+    key.design = design;
+    key.window = window;
+    key.params[0] = p0;
+    key.params[1] = p1;
+    key.params[2] = p2;
+    key.params[3] = p3;
+    key.params[4] = p4;
+    key.params[5] = p5;
+    return key;
+}
+
+// Returns the cached taps for key, running design() first if there are none
+template <typename T, typename Design>
+static const std::vector<T>& lookup(const tap_key &key, Design design)
+{
+    tap_store &s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto it = s.entries.find(key);
+    if (it != s.entries.end() && !entry_taps(it->second, (const T *)nullptr).empty()) {
+        ++s.hits;
+        return entry_taps(it->second, (const T *)nullptr);
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<T> &taps = entry_taps(s.entries[key], (const T *)nullptr);
+    taps = design();
+    s.design_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ++s.misses;
+    s.modified = true;
+    return taps;
+}
+
+const std::vector<float>& tap_cache::low_pass(
+    double gain,
+    double sampling_freq,
+    double cutoff_freq,
+    double transition_width,
+    firdes::win_type window,
+    double beta)
+{
+    return lookup<float>(
+        make_key(DESIGN_LOW_PASS, window, gain, sampling_freq, cutoff_freq, transition_width, beta),
+        [&]() { return firdes::low_pass(gain, sampling_freq, cutoff_freq, transition_width, window, beta); });
+}
+
+const std::vector<float>& tap_cache::low_pass_2(
+    double gain,
+    double sampling_freq,
+    double cutoff_freq,
+    double transition_width,
+    double attenuation_dB,
+    firdes::win_type window,
+    double beta)
+{
+    return lookup<float>(
+        make_key(DESIGN_LOW_PASS_2, window, gain, sampling_freq, cutoff_freq, transition_width, attenuation_dB, beta),
+        [&]() { return firdes::low_pass_2(gain, sampling_freq, cutoff_freq, transition_width, attenuation_dB, window, beta); });
+}
+
+const std::vector<gr_complex>& tap_cache::complex_band_pass(
+    double gain,
+    double sampling_freq,
+    double low_cutoff_freq,
+    double high_cutoff_freq,
+    double transition_width,
+    firdes::win_type window,
+    double beta)
+{
+    return lookup<gr_complex>(
+        make_key(DESIGN_COMPLEX_BAND_PASS, window, gain, sampling_freq, low_cutoff_freq, high_cutoff_freq, transition_width, beta),
+        [&]() { return firdes::complex_band_pass(gain, sampling_freq, low_cutoff_freq, high_cutoff_freq, transition_width, window, beta); });
+}
+
+const std::vector<float>& tap_cache::root_raised_cosine(
+    double gain,
+    double sampling_freq,
+    double symbol_rate,
+    double alpha,
+    int ntaps)
+{
+    return lookup<float>(
+        make_key(DESIGN_ROOT_RAISED_COSINE, 0, gain, sampling_freq, symbol_rate, alpha, ntaps),
+        [&]() { return firdes::root_raised_cosine(gain, sampling_freq, symbol_rate, alpha, ntaps); });
+}
+
+// Adds the designs in a file written by save().  Designs already in the cache are kept.
+// @param path The cache file
+// @return false if the file is missing, not a tap cache or corrupt
+bool tap_cache::load(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    tap_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != TAP_CACHE_MAGIC ||
+        header.version != TAP_CACHE_VERSION) {
+        fclose(file);
+        return false;
+    }
+    long data_start = ftell(file);
+    if (data_start < 0 || fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return false;
+    }
+    long file_end = ftell(file);
+    if (file_end < data_start || fseek(file, data_start, SEEK_SET) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    // The records are read in full before any goes in the cache, so a truncated or corrupt file
+    // adds nothing.  A num_taps bigger than what's left of the file is corrupt, never allocated.
+    std::map<tap_key, tap_entry> loaded;
+    bool ok = true;
+    try {
+        uint64_t remaining = uint64_t(file_end - data_start);
+        for (uint32_t i = 0; i < header.num_entries && ok; ++i) {
+            tap_record_header record;
+            if (remaining < sizeof(record) || fread(&record, sizeof(record), 1, file) != 1) {
+                ok = false;
+                break;
+            }
+            remaining -= sizeof(record);
+            size_t tap_size = record.is_complex ? sizeof(gr_complex) : sizeof(float);
+            if (record.num_taps > remaining / tap_size) {
+                ok = false;
+                break;
+            }
+            remaining -= uint64_t(record.num_taps) * tap_size;
+            tap_entry &entry = loaded[record.key];
+            if (record.is_complex) {
+                entry.complex.resize(record.num_taps);
+                ok = fread(entry.complex.data(), sizeof(gr_complex), entry.complex.size(), file) == entry.complex.size();
+            }
+            else {
+                entry.real.resize(record.num_taps);
+                ok = fread(entry.real.data(), sizeof(float), entry.real.size(), file) == entry.real.size();
+            }
+        }
+    }
+    catch (const std::bad_alloc &) {
+        ok = false;
+    }
+    fclose(file);
+    if (!ok) {
+        printf("Warning: tap_cache::load - %s is corrupt, ignored\n", path.c_str());
+        return false;
+    }
+
+    tap_store &s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    for (auto &it : loaded) {
+        tap_entry &entry = s.entries[it.first];
+        if (entry.real.empty()) {
+            entry.real.swap(it.second.real);
+        }
+        if (entry.complex.empty()) {
+            entry.complex.swap(it.second.complex);
+        }
+    }
+    return true;
+}
+
+// Writes every design in the cache.  The file is replaced in one rename, so a reader never sees it
+// half written.
+// @param path The cache file
+// @return false if it could not be written
+bool tap_cache::save(const std::string &path)
+{
+    std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    tap_store &s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    tap_file_header header = {TAP_CACHE_MAGIC, TAP_CACHE_VERSION, 0, 0};
+    for (const auto &entry : s.entries) {
+        header.num_entries += !entry.second.real.empty();
+        header.num_entries += !entry.second.complex.empty();
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const auto &entry : s.entries) {
+        tap_record_header record;
+        record.key = entry.first;
+        if (!entry.second.real.empty()) {
+            record.is_complex = 0;
+            record.num_taps = entry.second.real.size();
+            ok = ok && fwrite(&record, sizeof(record), 1, file) == 1;
+            ok = ok && fwrite(entry.second.real.data(), sizeof(float), record.num_taps, file) == record.num_taps;
+        }
+        if (!entry.second.complex.empty()) {
+            record.is_complex = 1;
+            record.num_taps = entry.second.complex.size();
+            ok = ok && fwrite(&record, sizeof(record), 1, file) == 1;
+            ok = ok && fwrite(entry.second.complex.data(), sizeof(gr_complex), record.num_taps, file) == record.num_taps;
+        }
+    }
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    s.modified = false;
+    return true;
+}
+
+// @return true if something was designed since the last load or save
+bool tap_cache::modified()
+{
+    tap_store &s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    return s.modified;
+}
+
+// @param hits Lookups answered from the cache
+// @param misses Lookups that had to design the filter
+// @param design_ms Time spent designing
+void tap_cache::get_stats(unsigned int &hits, unsigned int &misses, double &design_ms)
+{
+    tap_store &s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    hits = s.hits;
+    misses = s.misses;
+    design_ms = s.design_ms;
+}
+
+} // namespace filter
+} // namespace gr
@@ -6,6 +6,7 @@
 // Author: Jason Anderson (jander10@jaguarlandrover.com)
 
 #include "gr_wfmrcv.h"
+#include "gr_tap_cache.h"
 #include <gnuradio/filter/firdes.h>
 
 namespace gr
@@ -17,23 +18,43 @@ wfmrcv::~wfmrcv()
 {
 }
 
-void wfmrcv::init_block(float quad_rate, float audio_decimation)
+// @param fused Use the single fm_demod_fused_cf block instead of the quadrature_demod_cf ->
+//              fir_filter_fff -> fm_deemph chain.  The chain is kept as the reference version.
+void wfmrcv::init_block(float quad_rate, float audio_decimation, bool fused)
 {
     float max_dev = 75.0e3;
     float fm_demod_gain = quad_rate / (2 * M_PI * max_dev);
     float audio_rate = quad_rate / audio_decimation;
 
-    fm_demod = quadrature_demod_cf::make(fm_demod_gain);
-    deemph = fm_deemph::make(audio_rate);
-
     double width = audio_rate / 32.0;
-    audio_coeffs = filter::firdes::low_pass(
+    audio_coeffs = filter::tap_cache::low_pass(
         1.0,
         quad_rate,
         audio_rate / 2.0 - width,
         width,
         filter::firdes::WIN_HAMMING);
 
+    if (fused) {
+        std::vector<double> btaps;
+        std::vector<double> ataps;
+        fm_deemph::design(audio_rate, btaps, ataps);
+        fused_demod = fm_demod_fused_cf::make(
+            fm_demod_gain,
+            (unsigned int)audio_decimation,
+            audio_coeffs,
+            btaps,
+            ataps);
+
+        connect(self(), 0, fused_demod, 0);
+        connect(fused_demod, 0, self(), 0);
+        connect(fused_demod, 1, self(), 1);
+        add_inner_blocks({fused_demod});
+        return;
+    }
+
+    fm_demod = quadrature_demod_cf::make(fm_demod_gain);
+    deemph = fm_deemph::make(audio_rate);
+
     audio_filter = filter::fir_filter_fff::make(
         audio_decimation,
         audio_coeffs
@@ -43,20 +64,22 @@ void wfmrcv::init_block(float quad_rate, float audio_decimation)
     connect(fm_demod, 0, audio_filter, 0);
     connect(audio_filter, 0, deemph, 0);
     connect(deemph, 0, self(), 0);
+    connect(audio_filter, 0, self(), 1);
+    add_inner_blocks({fm_demod, audio_filter, deemph});
 }
 
-wfmrcv::wfmrcv(float quad_rate, float audio_decimation)
+wfmrcv::wfmrcv(float quad_rate, float audio_decimation, bool fused)
     : hier_block2(
         "wfmrcv",
         io_signature::make(1, 1, sizeof(gr_complex)),
-        io_signature::make(1, 1, sizeof(float)))
+        io_signature::make(2, 2, sizeof(float)))
 {
-    init_block(quad_rate, audio_decimation);
+    init_block(quad_rate, audio_decimation, fused);
 }
 
-wfmrcv::sptr wfmrcv::make(float quad_rate, float audio_decimation)
+wfmrcv::sptr wfmrcv::make(float quad_rate, float audio_decimation, bool fused)
 {
-    return gnuradio::get_initial_sptr(new wfmrcv(quad_rate, audio_decimation));
+    return gnuradio::get_initial_sptr(new wfmrcv(quad_rate, audio_decimation, fused));
 }
 
 } // namespace analog
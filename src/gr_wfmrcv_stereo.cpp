@@ -0,0 +1,110 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Jason Anderson (jander10@jaguarlandrover.com)
+
+#include <gnuradio/io_signature.h>
+#include <gnuradio/filter/firdes.h>
+#include <gnuradio/filter/fft_filter_fff.h>
+#include <gnuradio/blocks/delay.h>
+#include <gnuradio/blocks/add_ff.h>
+#include <gnuradio/blocks/sub_ff.h>
+
+#include "gr_wfmrcv_stereo.h"
+#include "gr_tap_cache.h"
+
+namespace gr
+{
+namespace analog
+{
+
+wfmrcv_stereo::~wfmrcv_stereo()
+{
+}
+
+void wfmrcv_stereo::init_block(float quad_rate, float audio_decimation)
+{
+    float audio_rate = quad_rate / audio_decimation;
+
+    // Mono audio and the MPX both come from the fused mono receiver
+    mono = wfmrcv::make(quad_rate, audio_decimation, true);
+
+    // Pilot recovery: complex band pass around 19 kHz, then a PLL that stays within +-200 Hz of it
+    pilot_coeffs = filter::tap_cache::complex_band_pass(
+        1.0,
+        audio_rate,
+        18.5e3,
+        19.5e3,
+        2.5e3,
+        filter::firdes::WIN_HAMMING);
+    pilot_filter = filter::fir_filter_fcc::make(1, pilot_coeffs);
+
+    float loop_bw = 2 * M_PI / 100.0;
+    float max_freq = 2 * M_PI * 19.2e3 / audio_rate;
+    float min_freq = 2 * M_PI * 18.8e3 / audio_rate;
+    pilot_pll = pll_refout_cc::make(loop_bw, max_freq, min_freq);
+
+    // Delay the MPX by the group delay of the pilot filter so it lines up with the PLL reference
+    auto mpx_delay = gr::blocks::delay::make(sizeof(float), (pilot_coeffs.size() - 1) / 2);
+
+    demod = stereo_demod::make(audio_rate);
+
+    // L = (L+R + L-R) / 2 and R = (L+R - L-R) / 2, the halving is folded into the filter gain
+    auto &stereo_coeffs = filter::tap_cache::low_pass(
+        0.5,
+        audio_rate,
+        15e3,
+        4e3,
+        filter::firdes::WIN_HAMMING);
+    auto lpr_filter = filter::fft_filter_fff::make(1, stereo_coeffs);
+    auto lmr_filter = filter::fft_filter_fff::make(1, stereo_coeffs);
+    auto lpr_deemph = fm_deemph::make(audio_rate);
+    auto lmr_deemph = fm_deemph::make(audio_rate);
+    auto left = gr::blocks::add_ff::make();
+    auto right = gr::blocks::sub_ff::make();
+
+    connect(self(), 0, mono, 0);
+    connect(mono, 0, self(), 0);
+
+    connect(mono, 1, pilot_filter, 0);
+    connect(pilot_filter, 0, pilot_pll, 0);
+    connect(mono, 1, mpx_delay, 0);
+    connect(mpx_delay, 0, demod, 0);
+    connect(pilot_pll, 0, demod, 1);
+
+    connect(demod, 0, lpr_filter, 0);
+    connect(lpr_filter, 0, lpr_deemph, 0);
+    connect(demod, 1, lmr_filter, 0);
+    connect(lmr_filter, 0, lmr_deemph, 0);
+
+    connect(lpr_deemph, 0, left, 0);
+    connect(lmr_deemph, 0, left, 1);
+    connect(lpr_deemph, 0, right, 0);
+    connect(lmr_deemph, 0, right, 1);
+    connect(left, 0, self(), 1);
+    connect(right, 0, self(), 2);
+
+    connect(demod, 2, self(), 3);
+    connect(mono, 1, self(), 4);
+    add_inner_blocks({mono, pilot_filter, pilot_pll, mpx_delay, demod, lpr_filter, lmr_filter,
+                      lpr_deemph, lmr_deemph, left, right});
+}
+
+wfmrcv_stereo::wfmrcv_stereo(float quad_rate, float audio_decimation)
+    : hier_block2(
+        "wfmrcv_stereo",
+        io_signature::make(1, 1, sizeof(gr_complex)),
+        io_signature::makev(5, 5, std::vector<int>{sizeof(float), sizeof(float), sizeof(float), sizeof(gr_complex), sizeof(float)}))
+{
+    init_block(quad_rate, audio_decimation);
+}
+
+wfmrcv_stereo::sptr wfmrcv_stereo::make(float quad_rate, float audio_decimation)
+{
+    return gnuradio::get_initial_sptr(new wfmrcv_stereo(quad_rate, audio_decimation));
+}
+
+} // namespace analog
+} // namespace gr